@@ -3,7 +3,8 @@
 
 /*
  * Simple crit-bit implementation for C99.
- * Supports only non-zero even keys of type uintptr_t.
+ * Supports only non-zero even keys of type uintptr_t unless CRITBIT_ANY_KEYS
+ * is defined.
  *
  * Author: Aliaksandr Valialkin <valyala@gmail.com>
  */
@@ -11,9 +12,16 @@
 /*******************************************************************************
  * Interface.
  ******************************************************************************/
+#include <limits.h>  /* for CHAR_BIT */
 #include <stddef.h>  /* for size_t */
 #include <stdint.h>  /* for uint*_t */
 
+/*
+ * Crit bits strictly increase from the root to leaves, so a path
+ * can't contain more nodes than there are bits in a key.
+ */
+#define _CRITBIT_MAX_DEPTH (sizeof(uintptr_t) * CHAR_BIT)
+
 /* Opaque crit-bit structure. */
 struct critbit;
 
@@ -31,6 +39,24 @@ struct critbit_node_allocator
 
   /* Arbitrary context, which is passed to alloc_node() and free_node(). */
   void *ctx;
+
+  /*
+   * Optional. If set, critbit_delete() calls it instead of calling
+   * free_node() for each node, so the allocator may release all its memory
+   * at once. Set it only if the allocator serves a single crit-bit.
+   * It isn't called for crit-bits, which exchanged nodes with other
+   * crit-bits via critbit_union(), critbit_split_at() or critbit_join().
+   */
+  void (*release_all_nodes)(void *ctx);
+
+  /*
+   * Optional. If set, critbit_remove() passes removed nodes to it instead of
+   * free_node(). It must postpone releasing the node until concurrent
+   * readers, which may still access the node, finish, e.g. via epoch-based
+   * or RCU reclamation. The callback is required if critbit_remove() runs
+   * concurrently with readers (see CRITBIT_CONCURRENT).
+   */
+  void (*retire_node)(void *ctx, void *node);
 };
 
 /* Item visitor for critbit_foreach(). */
@@ -56,6 +82,19 @@ static inline size_t critbit_node_size(void);
 static inline struct critbit *critbit_create(
     const struct critbit_node_allocator *node_allocator);
 
+/*
+ * Creates a crit-bit containing n items from a. Items in a must be sorted
+ * in ascending order without duplicates. Each item must be non-zero even
+ * integer.
+ * This is much faster than adding items one by one with critbit_add(),
+ * since it takes O(n) time. Nodes are allocated in depth-first order,
+ * so they occupy adjacent memory if node_allocator hands out adjacent
+ * chunks of memory.
+ */
+static inline struct critbit *critbit_build_sorted(
+    const struct critbit_node_allocator *node_allocator,
+    const uintptr_t *a, size_t n);
+
 /*
  * Deletes the given crit-bit
  */
@@ -88,257 +127,6317 @@ static inline int critbit_contains(const struct critbit *cb, uintptr_t v);
 static inline void critbit_foreach(const struct critbit *const cb,
     const struct critbit_visitor *visitor);
 
+/*
+ * Checks whether the crit-bit contains each of n keys and stores the result
+ * (1 or 0) into the corresponding out item. This is faster than calling
+ * critbit_contains() for each key on large crit-bits, since lookups
+ * for multiple keys are interleaved in order to overlap cache misses.
+ * Keys must be non-zero even integers.
+ */
+static inline void critbit_contains_batch(const struct critbit *cb,
+    const uintptr_t *keys, size_t n, int *out);
 
-/*******************************************************************************
- * Implementation.
- ******************************************************************************/
-#include <assert.h>
-#include <limits.h>  /* for CHAR_BIT */
-#include <stddef.h>  /* for size_t */
-#include <stdint.h>  /* for uint*_t */
-#include <stdlib.h>  /* for malloc/free */
+/*
+ * Adds n keys to crit-bit. Returns the number of added keys, i.e. keys, which
+ * didn't exist in the crit-bit. Paths for multiple keys are found
+ * by interleaved descents, which overlap cache misses, and new nodes are
+ * usually linked at the found paths without descending again.
+ * This is faster than critbit_add() only on crit-bits larger than caches.
+ * Keys must be non-zero even integers.
+ */
+static inline size_t critbit_add_batch(struct critbit *cb,
+    const uintptr_t *keys, size_t n);
 
-struct critbit
-{
-  uintptr_t root;
-  const struct critbit_node_allocator *node_allocator;
-};
+/*
+ * Moves all the items from src to dst, so dst becomes the union of both
+ * crit-bits, while src becomes empty. Both crit-bits must share the node
+ * allocator, so critbit_delete() releases their nodes one by one afterwards
+ * instead of calling release_all_nodes().
+ * The crit-bits are walked in lockstep by comparing crit bits, so src
+ * subtrees, which don't overlap with dst, are adopted by dst as a whole
+ * without visiting their items.
+ */
+static inline void critbit_union(struct critbit *dst, struct critbit *src);
 
-struct _critbit_node
-{
-  uintptr_t next[2];
-  uint8_t crit_bit;
-};
+/*
+ * Removes items missing in src from dst, so dst becomes the intersection
+ * of both crit-bits.
+ * dst subtrees, which don't overlap with src, are removed as a whole.
+ */
+static inline void critbit_intersect(struct critbit *dst,
+    const struct critbit *src);
 
-static const uint8_t _CRITBIT_PTR_BITS = sizeof(void *) * CHAR_BIT;
+/*
+ * Removes items existing in src from dst, so dst becomes the difference
+ * of both crit-bits.
+ * dst subtrees, which don't overlap with src, are skipped as a whole.
+ */
+static inline void critbit_difference(struct critbit *dst,
+    const struct critbit *src);
 
-static inline int _critbit_has_tag(const uintptr_t v)
-{
-  assert(v != 0);
+/*
+ * Moves items greater or equal to v from cb to a new crit-bit and returns it.
+ * The new crit-bit uses the node allocator of cb, so critbit_delete()
+ * releases nodes of both crit-bits one by one instead of calling
+ * release_all_nodes(), which would release nodes of the other crit-bit too.
+ * Only nodes on the path to v are relinked, so other items aren't visited.
+ * v must be non-zero even integer.
+ */
+static inline struct critbit *critbit_split_at(struct critbit *cb,
+    uintptr_t v);
 
-  return (v & 1);
-}
+/*
+ * Moves all the items from src to dst, so src becomes empty. All the src
+ * items must be either smaller or greater than dst items. Both crit-bits
+ * must share the node allocator, so critbit_delete() releases their nodes
+ * one by one afterwards instead of calling release_all_nodes(), which would
+ * release nodes of the other crit-bit too.
+ * Only nodes on the paths to the adjacent items of src and dst are visited.
+ */
+static inline void critbit_join(struct critbit *dst, struct critbit *src);
 
-static inline int _critbit_is_set(const uintptr_t v, const uint8_t bit)
-{
-  assert(bit < _CRITBIT_PTR_BITS - 1);
+/*
+ * Copies all the nodes of cb into memory obtained from new_allocator and
+ * releases the old nodes, so cb uses new_allocator afterwards. Nodes are
+ * allocated in breadth-first order for the top levels of the tree, which
+ * fit a memory page, and in depth-first order below them. So lookups touch
+ * fewer cache lines and pages after long churn if new_allocator hands out
+ * nodes sequentially, like a fresh critbit_slab_allocator does.
+ * The old node allocator may be destroyed after the call if it served
+ * only cb. Takes O(n) time.
+ */
+static inline void critbit_compact(struct critbit *cb,
+    const struct critbit_node_allocator *new_allocator);
 
-  return (v & (((uintptr_t)1) << (_CRITBIT_PTR_BITS - 1 - bit)));
-}
+#if defined(CRITBIT_PERSISTENT)
+/*
+ * Returns a new crit-bit with the same items as cb in O(1) time.
+ * The snapshot shares nodes with cb, while modifications of any of them
+ * copy only nodes on the modified paths, so the other one remains intact.
+ * The snapshot must be deleted with critbit_delete().
+ */
+static inline struct critbit *critbit_snapshot(const struct critbit *cb);
+#endif
 
-static inline uint8_t _critbit_get_crit_bit(const uintptr_t v1,
-    const uintptr_t v2)
-{
-  assert(v1 != v2);
-  assert(!_critbit_has_tag(v1));
-  assert(!_critbit_has_tag(v2));
+#if defined(CRITBIT_PARALLEL)
+/*
+ * Creates a crit-bit from n sorted unique keys like critbit_build_sorted(),
+ * but builds subtrees on up to threads threads. Keys are split by their
+ * top bits into ranges, whose subtrees are built concurrently and are
+ * stitched together by a few top-level nodes.
+ * node_allocator is called concurrently, so it must be thread-safe
+ * if threads > 1. critbit_slab_allocator isn't thread-safe.
+ */
+static inline struct critbit *critbit_build_sorted_parallel(
+    const struct critbit_node_allocator *node_allocator,
+    const uintptr_t *a, size_t n, size_t threads);
 
-  const uintptr_t x = v1 ^ v2;
-  uint8_t crit_bit = 0;
-  for (;;) {
-    if (_critbit_is_set(x, crit_bit)) {
-      break;
-    }
-    ++crit_bit;
-  }
-  return crit_bit;
-}
+/*
+ * Calls visitor for each crit-bit item on up to threads threads. Idle threads
+ * steal unvisited subtrees from busy threads, so the work stays balanced
+ * for skewed trees. The visitor is called concurrently, and items are
+ * visited in no particular order.
+ * Do not modify crit-bit in visitor!
+ */
+static inline void critbit_parallel_foreach(const struct critbit *cb,
+    const struct critbit_visitor *visitor, size_t threads);
+#endif
 
-static inline size_t _critbit_get_index(const uintptr_t v, const uint8_t bit)
+/*
+ * Cursor for ordered iteration over crit-bit items.
+ * Any crit-bit modification invalidates all the cursors pointing to it.
+ *
+ * Usage:
+ *
+ *   struct critbit_cursor c;
+ *   if (critbit_seek_ge(&c, cb, v)) {
+ *     do {
+ *       uintptr_t item = critbit_cursor_get(&c);
+ *       ...
+ *     } while (critbit_cursor_next(&c));
+ *   }
+ */
+struct critbit_cursor
 {
-  assert(v != 0);
+  /* All the members are private. */
+  const struct critbit *cb;
+  uintptr_t key;
+  size_t depth;
+  uintptr_t path[_CRITBIT_MAX_DEPTH];
+};
 
-  return (_critbit_is_set(v, bit) ? 1 : 0);
-}
+/*
+ * Positions the cursor at the smallest item in the crit-bit.
+ * Returns 1 on success, 0 if the crit-bit is empty.
+ */
+static inline int critbit_seek_first(struct critbit_cursor *c,
+    const struct critbit *cb);
 
-static inline uintptr_t _critbit_add_tag(const struct _critbit_node *const node)
-{
-  const uintptr_t v = (uintptr_t)node;
-  assert(!_critbit_has_tag(v));
+/*
+ * Positions the cursor at the largest item in the crit-bit.
+ * Returns 1 on success, 0 if the crit-bit is empty.
+ */
+static inline int critbit_seek_last(struct critbit_cursor *c,
+    const struct critbit *cb);
 
-  return v + 1;
-}
+/*
+ * Positions the cursor at the smallest item, which is greater or equal to v.
+ * Returns 1 on success, 0 if there is no such item.
+ * v must be non-zero even integer.
+ */
+static inline int critbit_seek_ge(struct critbit_cursor *c,
+    const struct critbit *cb, uintptr_t v);
 
-static inline struct _critbit_node *_critbit_remove_tag(const uintptr_t v)
-{
-  assert(_critbit_has_tag(v));
+/*
+ * Positions the cursor at the largest item, which is less or equal to v.
+ * Returns 1 on success, 0 if there is no such item.
+ * v must be non-zero even integer.
+ */
+static inline int critbit_seek_le(struct critbit_cursor *c,
+    const struct critbit *cb, uintptr_t v);
 
-  return (struct _critbit_node *)(v - 1);
-}
+/*
+ * Returns the item the cursor is positioned at.
+ * The cursor must be successfully positioned with critbit_seek_*().
+ */
+static inline uintptr_t critbit_cursor_get(const struct critbit_cursor *c);
 
-static inline uintptr_t _critbit_create_node(const struct critbit *const cb,
-    const uintptr_t v1, const uintptr_t v2, const uint8_t crit_bit)
-{
-  assert(v1 != v2);
-  assert(!_critbit_has_tag(v1));
+/*
+ * Moves the cursor to the next item. Returns 1 on success, 0 if the cursor
+ * is positioned at the largest item. The cursor isn't moved on failure.
+ */
+static inline int critbit_cursor_next(struct critbit_cursor *c);
 
-  struct _critbit_node *const node = cb->node_allocator->alloc_node(
-      cb->node_allocator->ctx);
-  const size_t index = _critbit_get_index(v1, crit_bit);
-  if (!_critbit_has_tag(v2)) {
-    assert(_critbit_get_index(v2, crit_bit) == (index ^ 1));
-  }
-  node->next[index] = v1;
-  node->next[index ^ 1] = v2;
-  node->crit_bit = crit_bit;
-  return _critbit_add_tag(node);
-}
+/*
+ * Moves the cursor to the previous item. Returns 1 on success, 0 if the cursor
+ * is positioned at the smallest item. The cursor isn't moved on failure.
+ */
+static inline int critbit_cursor_prev(struct critbit_cursor *c);
 
-static inline uintptr_t _critbit_delete_node(const struct critbit *const cb,
-    const uintptr_t tagged_node, const uintptr_t v)
-{
-  struct _critbit_node *const node = _critbit_remove_tag(tagged_node);
-  const size_t index = _critbit_get_index(v, node->crit_bit);
-  uintptr_t remaining_child = node->next[index ^ 1];
-  cb->node_allocator->free_node(cb->node_allocator->ctx, node);
-  return remaining_child;
-}
+/*
+ * Stores the largest item, which is less or equal to v, into result.
+ * Returns 1 on success, 0 if there is no such item. It is cheaper than
+ * critbit_seek_le(), since it doesn't need a cursor.
+ * v must be non-zero even integer.
+ */
+static inline int critbit_predecessor(const struct critbit *cb, uintptr_t v,
+    uintptr_t *result);
 
-static inline uintptr_t *_critbit_get_leaf_ptr(const struct critbit *const cb,
-    const uintptr_t v)
-{
-  const uintptr_t *next = &cb->root;
-  while (_critbit_has_tag(*next)) {
-    const struct _critbit_node *const node = _critbit_remove_tag(*next);
-    const size_t index = _critbit_get_index(v, node->crit_bit);
-    next = &node->next[index];
-  }
-  return (uintptr_t *) next;
-}
+/*
+ * Stores the smallest item, which is greater or equal to v, into result.
+ * Returns 1 on success, 0 if there is no such item.
+ * v must be non-zero even integer.
+ */
+static inline int critbit_successor(const struct critbit *cb, uintptr_t v,
+    uintptr_t *result);
 
-static inline uintptr_t *_critbit_get_node_ptr(const struct critbit *const cb,
-    const uintptr_t v, const uint8_t crit_bit)
-{
-  const uintptr_t *next = &cb->root;
-  while (_critbit_has_tag(*next)) {
-    const struct _critbit_node *const node = _critbit_remove_tag(*next);
-    assert(node->crit_bit != crit_bit);
-    if (node->crit_bit > crit_bit) {
-      break;
-    }
-    const size_t index = _critbit_get_index(v, node->crit_bit);
-    next = &node->next[index];
-  }
-  return (uintptr_t *) next;
-}
+/*
+ * Stores the item sharing the longest prefix with v, i.e. the item with
+ * the smallest (item ^ v), into result. Returns 1 on success, 0 if
+ * the crit-bit is empty.
+ * v must be non-zero even integer.
+ */
+static inline int critbit_closest_xor(const struct critbit *cb, uintptr_t v,
+    uintptr_t *result);
 
-static inline void _critbit_remove_all_nodes(const struct critbit *const cb,
-    const uintptr_t v)
-{
-  if (_critbit_has_tag(v)) {
-    struct _critbit_node *const node = _critbit_remove_tag(v);
-    _critbit_remove_all_nodes(cb, node->next[0]);
-    _critbit_remove_all_nodes(cb, node->next[1]);
-    cb->node_allocator->free_node(cb->node_allocator->ctx, node);
-  }
-}
+/*
+ * Calls visitor for each crit-bit item in the range [lo, hi)
+ * in ascending order. lo and hi may be arbitrary integers.
+ * Do not modify crit-bit in visitor!
+ */
+static inline void critbit_foreach_range(const struct critbit *cb,
+    uintptr_t lo, uintptr_t hi, const struct critbit_visitor *visitor);
 
-static inline size_t critbit_node_size(void)
+/*
+ * The subtree of crit-bit items sharing a prefix, which is returned
+ * by critbit_subtree_root(). It remains valid until the crit-bit
+ * is modified.
+ */
+struct critbit_subtree
 {
-  return sizeof(struct _critbit_node);
-}
+  /* The number of the most significant bits shared by all the items. */
+  unsigned shared_bits;
 
-static inline struct critbit *critbit_create(
-    const struct critbit_node_allocator *const node_allocator)
-{
-  struct critbit *const cb = malloc(sizeof(*cb));
-  cb->root = 0;
-  cb->node_allocator = node_allocator;
-  return cb;
-}
+  /* The rest of members are private. */
+  uintptr_t root;
+  int root_is_node;
+};
 
-static inline void critbit_delete(struct critbit *const cb)
-{
-  if (cb->root != 0) {
-    _critbit_remove_all_nodes(cb, cb->root);
-  }
-  free(cb);
-}
+/*
+ * Finds the subtree of items, which share the given number of the most
+ * significant bits with prefix, in O(depth) time.
+ * E.g. items in [base, base + 2^k) for base aligned to 2^k share base
+ * as a prefix of sizeof(uintptr_t) * CHAR_BIT - k bits. The rest of prefix
+ * bits are ignored. Returns 1 on success, 0 if there are no such items.
+ */
+static inline int critbit_subtree_root(const struct critbit *cb,
+    uintptr_t prefix, unsigned bits, struct critbit_subtree *st);
 
-static inline int critbit_add(struct critbit *const cb, const uintptr_t v)
-{
-  assert(!_critbit_has_tag(v));
+/*
+ * Calls visitor for each subtree item in ascending order.
+ * Do not modify crit-bit in visitor!
+ */
+static inline void critbit_subtree_foreach(const struct critbit_subtree *st,
+    const struct critbit_visitor *visitor);
 
-  if (cb->root == 0) {
-    cb->root = v;
-    return 1;
-  }
+/*
+ * Calls visitor for each crit-bit item with the given prefix (see
+ * critbit_subtree_root()) in ascending order.
+ * Do not modify crit-bit in visitor!
+ */
+static inline void critbit_foreach_prefix(const struct critbit *cb,
+    uintptr_t prefix, unsigned bits, const struct critbit_visitor *visitor);
 
-  uintptr_t *next = _critbit_get_leaf_ptr(cb, v);
-  if (*next == v) {
-    return 0;
-  }
-  const uint8_t crit_bit = _critbit_get_crit_bit(*next, v);
-  next = _critbit_get_node_ptr(cb, v, crit_bit);
-  *next = _critbit_create_node(cb, v, *next, crit_bit);
-  return 1;
-}
+/*
+ * Removes all the items with the given prefix (see critbit_subtree_root()).
+ * Their subtree is unlinked at once and its nodes are released in a single
+ * pass, so this is faster than removing items one by one. Returns 1
+ * if any items were removed, 0 otherwise.
+ */
+static inline int critbit_remove_prefix(struct critbit *cb, uintptr_t prefix,
+    unsigned bits);
 
-static inline int critbit_remove(struct critbit *const cb, const uintptr_t v)
+/*
+ * Serializes the crit-bit into buf in a flat format, which may be queried
+ * in place with critbit_open_mapped(), e.g. after writing it to a file and
+ * mapping the file into memory with mmap(). Nodes are stored in DFS order
+ * and refer to their children by relative offsets, so the serialized
+ * crit-bit doesn't depend on its address. The format depends on the byte
+ * order and the size of uintptr_t.
+ * buf must be aligned to 8 bytes. Returns the number of bytes required
+ * for the serialized crit-bit. Nothing is written if it exceeds size,
+ * so call it with NULL buf in order to obtain the required size.
+ */
+static inline size_t critbit_serialize(const struct critbit *cb, void *buf,
+    size_t size);
+
+/*
+ * Read-only crit-bit, which is serialized with critbit_serialize().
+ * Many processes may share a single copy of the mapped file in the page
+ * cache, while pages are loaded lazily on the first access.
+ */
+struct critbit_mapped
 {
-  assert(!_critbit_has_tag(v));
+  /* All the members are private. */
+  uintptr_t root;
+  int has_root;
+  int root_is_node;
+};
 
-  if (cb->root == 0) {
-    return 0;
-  }
+/*
+ * Opens the crit-bit serialized in data of the given size without
+ * copying it. data must be aligned to 8 bytes and must remain intact
+ * until m is used. Returns 1 on success. Returns 0 and clears m if data
+ * doesn't contain a crit-bit serialized on a compatible platform.
+ * Only the header is validated, so pages with nodes are loaded lazily.
+ * Nodes are trusted: data must be written by critbit_serialize(), since
+ * corrupt child offsets make queries access memory outside of data.
+ */
+static inline int critbit_open_mapped(struct critbit_mapped *m,
+    const void *data, size_t size);
 
-  if (!_critbit_has_tag(cb->root)) {
-    if (cb->root == v) {
-      cb->root = 0;
-      return 1;
-    }
-    return 0;
-  }
+/*
+ * Returns 1 if the mapped crit-bit contains v, otherwise returns 0.
+ */
+static inline int critbit_mapped_contains(const struct critbit_mapped *m,
+    uintptr_t v);
 
-  uintptr_t *prev = &cb->root;
-  struct _critbit_node *node = _critbit_remove_tag(*prev);
-  size_t index = _critbit_get_index(v, node->crit_bit);
-  uintptr_t *next = &node->next[index];
-  while (_critbit_has_tag(*next)) {
-    prev = next;
-    node = _critbit_remove_tag(*next);
-    index = _critbit_get_index(v, node->crit_bit);
-    next = &node->next[index];
-  }
-  if (*next != v) {
-    return 0;
-  }
-  *prev = _critbit_delete_node(cb, *prev, v);
-  return 1;
-}
+/*
+ * Calls visitor for each mapped crit-bit item in ascending order.
+ */
+static inline void critbit_mapped_foreach(const struct critbit_mapped *m,
+    const struct critbit_visitor *visitor);
 
-static inline int critbit_contains(const struct critbit *const cb,
-    const uintptr_t v)
+/*
+ * Cursor for ordered iteration over mapped crit-bit items. It works
+ * the same way as critbit_cursor.
+ */
+struct critbit_mapped_cursor
 {
-  assert(!_critbit_has_tag(v));
+  /* All the members are private. */
+  const struct critbit_mapped *m;
+  uintptr_t key;
+  size_t depth;
+  uintptr_t path[_CRITBIT_MAX_DEPTH];
+};
 
-  if (cb->root == 0) {
-    return 0;
-  }
+/*
+ * Positions the cursor at the smallest item in the mapped crit-bit.
+ * Returns 1 on success, 0 if the mapped crit-bit is empty.
+ */
+static inline int critbit_mapped_seek_first(struct critbit_mapped_cursor *c,
+    const struct critbit_mapped *m);
 
-  uintptr_t *next = _critbit_get_leaf_ptr(cb, v);
-  return (*next == v);
-}
+/*
+ * Positions the cursor at the largest item in the mapped crit-bit.
+ * Returns 1 on success, 0 if the mapped crit-bit is empty.
+ */
+static inline int critbit_mapped_seek_last(struct critbit_mapped_cursor *c,
+    const struct critbit_mapped *m);
 
-static inline void _critbit_visit(
-    const struct critbit_visitor *const visitor, const uintptr_t v)
-{
-  if (_critbit_has_tag(v)) {
-    const struct _critbit_node *const node = _critbit_remove_tag(v);
-    const uintptr_t left = node->next[0];
-    const uintptr_t right = node->next[1];
-    _critbit_visit(visitor, left);
-    _critbit_visit(visitor, right);
-  }
-  else {
-    visitor->callback(visitor->ctx, v);
-  }
-}
+/*
+ * Positions the cursor at the smallest item greater or equal to v.
+ * Returns 1 on success, 0 if there is no such item.
+ */
+static inline int critbit_mapped_seek_ge(struct critbit_mapped_cursor *c,
+    const struct critbit_mapped *m, uintptr_t v);
 
-static inline void critbit_foreach(const struct critbit *const cb,
-    const struct critbit_visitor *const visitor)
+/*
+ * Positions the cursor at the largest item less or equal to v.
+ * Returns 1 on success, 0 if there is no such item.
+ */
+static inline int critbit_mapped_seek_le(struct critbit_mapped_cursor *c,
+    const struct critbit_mapped *m, uintptr_t v);
+
+/*
+ * Returns the item the cursor points to.
+ * The cursor must be successfully positioned with critbit_mapped_seek_*().
+ */
+static inline uintptr_t critbit_mapped_cursor_get(
+    const struct critbit_mapped_cursor *c);
+
+/*
+ * Moves the cursor to the next item. Returns 1 on success, 0 if the cursor
+ * is positioned at the largest item. The cursor isn't moved on failure.
+ */
+static inline int critbit_mapped_cursor_next(struct critbit_mapped_cursor *c);
+
+/*
+ * Moves the cursor to the previous item. Returns 1 on success, 0 if the cursor
+ * is positioned at the smallest item. The cursor isn't moved on failure.
+ */
+static inline int critbit_mapped_cursor_prev(struct critbit_mapped_cursor *c);
+
+/* Crit-bit shape statistics filled by critbit_get_stats(). */
+struct critbit_stats
+{
+  /* The number of internal nodes. */
+  size_t node_count;
+
+  /* The number of items. */
+  size_t leaf_count;
+
+  /* The maximum and the average number of nodes on the path to an item. */
+  size_t max_depth;
+  double avg_depth;
+
+  /*
+   * Memory occupied by live nodes, i.e. node_count * critbit_node_size().
+   * Allocator overhead and nodes cached by the allocator aren't counted.
+   */
+  size_t node_bytes;
+
+  /* The number of items, which are located at the given depth. */
+  size_t depth_histogram[_CRITBIT_MAX_DEPTH + 1];
+
+  /* The number of nodes with the given crit bit, starting from the MSB. */
+  size_t crit_bit_histogram[_CRITBIT_MAX_DEPTH];
+};
+
+/*
+ * Fills stats for the given crit-bit. Takes O(n) time.
+ */
+static inline void critbit_get_stats(const struct critbit *cb,
+    struct critbit_stats *stats);
+
+#if defined(CRITBIT_COUNTERS)
+/*
+ * Operation counters, which are maintained if CRITBIT_COUNTERS is defined.
+ * Counters aren't thread-safe, so they are approximate if CRITBIT_CONCURRENT
+ * readers run in parallel. Batch lookups aren't counted.
+ */
+struct critbit_counters
+{
+  size_t contains_calls;
+  size_t contains_node_visits;
+  size_t add_calls;
+  size_t add_node_visits;
+  size_t remove_calls;
+  size_t remove_node_visits;
+};
+
+/* Copies operation counters for the given crit-bit to counters. */
+static inline void critbit_get_counters(const struct critbit *cb,
+    struct critbit_counters *counters);
+
+/* Resets operation counters for the given crit-bit. */
+static inline void critbit_reset_counters(struct critbit *cb);
+#endif
+
+#if defined(CRITBIT_TRACE)
+/*
+ * Latency tracing, which is enabled if CRITBIT_TRACE is defined.
+ * critbit_contains(), critbit_add() and critbit_remove() record their
+ * depth and duration into the tracer attached with critbit_set_tracer().
+ * Durations are CPU cycles on x86 (TSC) and ARM64 (virtual counter)
+ * and clock() ticks elsewhere. Like counters, tracers aren't thread-safe.
+ */
+
+/*
+ * HDR-style histogram with 16 linear buckets per power of two, so bucket
+ * bounds are within 6.25% of recorded values.
+ */
+#define CRITBIT_HISTOGRAM_BUCKETS ((64 - 4 + 1) * 16)
+
+struct critbit_histogram
+{
+  uint64_t count;
+  uint64_t max;
+  uint64_t buckets[CRITBIT_HISTOGRAM_BUCKETS];
+};
+
+/*
+ * Returns the upper bound of the bucket holding the given percentile
+ * of recorded values, or 0 if the histogram is empty. percent must be
+ * in the range [0..100].
+ */
+static inline uint64_t critbit_histogram_percentile(
+    const struct critbit_histogram *h, unsigned percent);
+
+enum critbit_trace_op
+{
+  CRITBIT_TRACE_CONTAINS,
+  CRITBIT_TRACE_ADD,
+  CRITBIT_TRACE_REMOVE,
+  CRITBIT_TRACE_OPS,
+};
+
+struct critbit_trace_stats
+{
+  struct critbit_histogram cycles;
+
+  /* The number of operations, which visited the given number of nodes. */
+  uint64_t depth_histogram[_CRITBIT_MAX_DEPTH + 1];
+};
+
+struct critbit_tracer
+{
+  /* Stats indexed by enum critbit_trace_op. */
+  struct critbit_trace_stats stats[CRITBIT_TRACE_OPS];
+
+  /*
+   * Optional. Called when an operation visits more than
+   * deep_path_threshold nodes.
+   */
+  void (*on_deep_path)(void *ctx, enum critbit_trace_op op, uintptr_t v,
+      size_t depth);
+  size_t deep_path_threshold;
+
+  /*
+   * Optional. Called by critbit_traced_allocator for each allocated
+   * and released node.
+   */
+  void (*on_alloc_node)(void *ctx, void *node);
+  void (*on_free_node)(void *ctx, void *node);
+
+  /* Arbitrary context, which is passed to the callbacks. */
+  void *ctx;
+};
+
+/* Initializes the tracer with empty stats and no callbacks. */
+static inline void critbit_tracer_init(struct critbit_tracer *t);
+
+/* Clears tracer stats, keeping its callbacks. */
+static inline void critbit_tracer_reset(struct critbit_tracer *t);
+
+/*
+ * Attaches the tracer to the crit-bit. Pass NULL in order to stop tracing.
+ * A tracer may be shared by multiple crit-bits. Crit-bits start without
+ * a tracer, including those returned by critbit_split_at() and
+ * critbit_snapshot().
+ */
+static inline void critbit_set_tracer(struct critbit *cb,
+    struct critbit_tracer *tracer);
+
+/*
+ * Node allocator, which reports nodes allocated and released via another
+ * allocator to tracer callbacks:
+ *
+ *   struct critbit_traced_allocator ta;
+ *   critbit_traced_allocator_init(&ta, &s.node_allocator, &tracer);
+ *   struct critbit *cb = critbit_create(&ta.node_allocator);
+ *
+ * It never releases all nodes at once, so every node passes
+ * through on_free_node. Retired nodes are reported when retired.
+ */
+struct critbit_traced_allocator
+{
+  /* Pass a pointer to this member to critbit_create(). */
+  struct critbit_node_allocator node_allocator;
+
+  /* The rest of members are private. */
+  const struct critbit_node_allocator *inner;
+  struct critbit_tracer *tracer;
+};
+
+static inline void critbit_traced_allocator_init(
+    struct critbit_traced_allocator *ta,
+    const struct critbit_node_allocator *inner, struct critbit_tracer *tracer);
+#endif
+
+#if defined(CRITBIT_ORDER_STATS)
+/*
+ * Order statistics, which are available if CRITBIT_ORDER_STATS is defined.
+ * Then each node keeps the number of items in its subtree, so the functions
+ * below take O(depth) time. They may not run concurrently with writers.
+ */
+
+/* Returns the number of items in the crit-bit. */
+static inline size_t critbit_size(const struct critbit *cb);
+
+/*
+ * Returns the number of items less than v.
+ * v must be non-zero even integer.
+ */
+static inline size_t critbit_rank(const struct critbit *cb, uintptr_t v);
+
+/*
+ * Stores the k-th smallest item, starting from 0, into v. Returns 1
+ * on success, 0 if the crit-bit contains k or less items.
+ */
+static inline int critbit_select(const struct critbit *cb, size_t k,
+    uintptr_t *v);
+
+/*
+ * Returns the number of items in the range [lo, hi). lo and hi may be
+ * arbitrary integers.
+ */
+static inline size_t critbit_count_range(const struct critbit *cb,
+    uintptr_t lo, uintptr_t hi);
+
+/*
+ * Returns the number of items with the given prefix (see
+ * critbit_subtree_root()).
+ */
+static inline size_t critbit_count_prefix(const struct critbit *cb,
+    uintptr_t prefix, unsigned bits);
+#endif
+
+/*
+ * Opaque crit-bit map structure. It maps keys to values and has the same
+ * restrictions on keys as crit-bit. Concurrent access to crit-bit maps
+ * isn't supported, even if CRITBIT_CONCURRENT is defined.
+ */
+struct critbit_map;
+
+/* Item visitor for critbit_map_foreach(). */
+struct critbit_map_visitor
+{
+  /* The callback is called for each crit-bit map item. */
+  void (*callback)(void *ctx, uintptr_t key, void *value);
+
+  /* Arbitrary context, which is passed to the callback. */
+  void *ctx;
+};
+
+/*
+ * Returns a size of a crit-bit map node. The result of this function must be
+ * used by critbit_node_allocator passed to critbit_map_create().
+ */
+static inline size_t critbit_map_node_size(void);
+
+/*
+ * Creates a crit-bit map. Uses node_allocator for dynamic memory allocation
+ * for crit-bit map nodes.
+ */
+static inline struct critbit_map *critbit_map_create(
+    const struct critbit_node_allocator *node_allocator);
+
+/*
+ * Deletes the given crit-bit map.
+ */
+static inline void critbit_map_delete(struct critbit_map *m);
+
+/*
+ * Associates value with key. Returns 1 if key has been added, 0 if the value
+ * for the existing key has been replaced.
+ * key must be non-zero even integer.
+ */
+static inline int critbit_map_put(struct critbit_map *m, uintptr_t key,
+    void *value);
+
+/*
+ * Returns 1 and stores the value associated with key into value if key exists
+ * in the crit-bit map, otherwise returns 0.
+ * key must be non-zero even integer.
+ */
+static inline int critbit_map_get(const struct critbit_map *m, uintptr_t key,
+    void **value);
+
+/*
+ * Removes key from the crit-bit map. Returns 1 on success, 0 if key doesn't
+ * exist in the crit-bit map. The value associated with the removed key
+ * is stored into value unless it is NULL.
+ * key must be non-zero even integer.
+ */
+static inline int critbit_map_remove(struct critbit_map *m, uintptr_t key,
+    void **value);
+
+/*
+ * Calls visitor for each crit-bit map item in ascending key order.
+ * Do not modify crit-bit map in visitor!
+ */
+static inline void critbit_map_foreach(const struct critbit_map *m,
+    const struct critbit_map_visitor *visitor);
+
+/*
+ * Opaque crit-bit structure for byte string keys. Keys are either
+ * fixed-size binary blobs or NUL-terminated strings. They are ordered
+ * lexicographically by unsigned bytes, i.e. as memcmp() or strcmp() does.
+ * The crit-bit stores pointers to keys, so keys must stay unchanged
+ * while they are in the crit-bit. Key pointers must be aligned to at least
+ * two bytes, which is the case for malloc()'ed memory.
+ * Concurrent access isn't supported, even if CRITBIT_CONCURRENT is defined.
+ */
+struct critbit_bytes;
+
+/* Item visitor for critbit_bytes_foreach(). */
+struct critbit_bytes_visitor
+{
+  /* The callback is called for each key in the crit-bit. */
+  void (*callback)(void *ctx, const void *key);
+
+  /* Arbitrary context, which is passed to the callback. */
+  void *ctx;
+};
+
+/*
+ * Returns a size of a byte string crit-bit node. The result of this function
+ * must be used by critbit_node_allocator passed to critbit_bytes_create().
+ */
+static inline size_t critbit_bytes_node_size(void);
+
+/*
+ * Creates a crit-bit for keys of the given size in bytes. Pass zero key_size
+ * for NUL-terminated string keys. 8- and 16-byte keys are compared
+ * a word at a time. Uses node_allocator for dynamic memory allocation
+ * for crit-bit nodes.
+ */
+static inline struct critbit_bytes *critbit_bytes_create(
+    const struct critbit_node_allocator *node_allocator, size_t key_size);
+
+/*
+ * Deletes the given crit-bit. Keys aren't touched.
+ */
+static inline void critbit_bytes_delete(struct critbit_bytes *cb);
+
+/*
+ * Adds the given key to the crit-bit. Returns 1 on success, 0 if an equal key
+ * already exists in the crit-bit.
+ */
+static inline int critbit_bytes_add(struct critbit_bytes *cb, const void *key);
+
+/*
+ * Removes an equal key from the crit-bit. Returns 1 on success, 0 if there is
+ * no such key in the crit-bit. The key passed to this function may differ
+ * from the key stored in the crit-bit.
+ */
+static inline int critbit_bytes_remove(struct critbit_bytes *cb,
+    const void *key);
+
+/*
+ * Returns 1 if an equal key exists in the crit-bit, otherwise returns 0.
+ */
+static inline int critbit_bytes_contains(const struct critbit_bytes *cb,
+    const void *key);
+
+/*
+ * Calls visitor for each key in the crit-bit in ascending order.
+ * Do not modify crit-bit in visitor!
+ */
+static inline void critbit_bytes_foreach(const struct critbit_bytes *cb,
+    const struct critbit_bytes_visitor *visitor);
+
+/*
+ * Opaque hybrid crit-bit structure. It stores keys in small sorted buckets
+ * instead of crit-bit leaves, so the bottom levels of the tree are replaced
+ * by a cache line with keys. A bucket splits into a crit-bit node with two
+ * buckets when it overflows. This reduces both the number of nodes
+ * and the tree height.
+ * Keys have the same restrictions as crit-bit keys and must be non-zero even
+ * if CRITBIT_ANY_KEYS is defined. Concurrent access to hybrid crit-bits
+ * isn't supported, even if CRITBIT_CONCURRENT is defined.
+ */
+struct critbit_hybrid;
+
+/*
+ * Returns a size of a hybrid crit-bit bucket. The result of this function
+ * must be used by the bucket allocator passed to critbit_hybrid_create().
+ */
+static inline size_t critbit_hybrid_bucket_size(void);
+
+/*
+ * Creates a hybrid crit-bit. Uses node_allocator for nodes
+ * of critbit_node_size() and bucket_allocator for buckets
+ * of critbit_hybrid_bucket_size(). Buckets should be cache line-aligned
+ * for the best performance, which is the case for critbit_slab_allocator.
+ */
+static inline struct critbit_hybrid *critbit_hybrid_create(
+    const struct critbit_node_allocator *node_allocator,
+    const struct critbit_node_allocator *bucket_allocator);
+
+/*
+ * Deletes the given hybrid crit-bit.
+ */
+static inline void critbit_hybrid_delete(struct critbit_hybrid *h);
+
+/*
+ * Adds the given item to the hybrid crit-bit. Returns 1 on success, 0 if
+ * the item already exists in the hybrid crit-bit.
+ */
+static inline int critbit_hybrid_add(struct critbit_hybrid *h, uintptr_t v);
+
+/*
+ * Removes the given item from the hybrid crit-bit. Returns 1 on success, 0 if
+ * the item doesn't exist in the hybrid crit-bit.
+ */
+static inline int critbit_hybrid_remove(struct critbit_hybrid *h, uintptr_t v);
+
+/*
+ * Returns 1 if the given item exists in the hybrid crit-bit, otherwise
+ * returns 0.
+ */
+static inline int critbit_hybrid_contains(const struct critbit_hybrid *h,
+    uintptr_t v);
+
+/*
+ * Calls visitor for each item in the hybrid crit-bit in ascending order.
+ * Do not modify hybrid crit-bit in visitor!
+ */
+static inline void critbit_hybrid_foreach(const struct critbit_hybrid *h,
+    const struct critbit_visitor *visitor);
+
+/*
+ * Opaque wide crit-bit structure. Each node branches on an aligned group
+ * of 4 key bits instead of a single bit, so the tree is up to 4 times
+ * shallower than struct critbit, and lookups take fewer dependent cache
+ * misses. Nodes store a bitmap of present children followed by an array
+ * of the present children, which is indexed by the bitmap popcount.
+ * Nodes come in CRITBIT_WIDE_SIZE_CLASSES sizes, which are grown
+ * and shrunk as children are added and removed.
+ * Keys have the same restrictions as crit-bit keys and must be non-zero even
+ * if CRITBIT_ANY_KEYS is defined. Concurrent access to wide crit-bits
+ * isn't supported, even if CRITBIT_CONCURRENT is defined.
+ */
+struct critbit_wide;
+
+/* The number of node sizes in a wide crit-bit. */
+#define CRITBIT_WIDE_SIZE_CLASSES 4
+
+/*
+ * Returns a size of wide crit-bit nodes of the given size class, which must
+ * be used by the corresponding allocator passed to critbit_wide_create().
+ */
+static inline size_t critbit_wide_node_size(size_t size_class);
+
+/*
+ * Creates a wide crit-bit. node_allocators must contain
+ * CRITBIT_WIDE_SIZE_CLASSES allocators, one per node size class,
+ * e.g. critbit_slab_allocator for each critbit_wide_node_size().
+ */
+static inline struct critbit_wide *critbit_wide_create(
+    const struct critbit_node_allocator *const *node_allocators);
+
+/*
+ * Deletes the given wide crit-bit.
+ */
+static inline void critbit_wide_delete(struct critbit_wide *w);
+
+/*
+ * Adds the given item to the wide crit-bit. Returns 1 on success, 0 if
+ * the item already exists in the wide crit-bit.
+ */
+static inline int critbit_wide_add(struct critbit_wide *w, uintptr_t v);
+
+/*
+ * Removes the given item from the wide crit-bit. Returns 1 on success, 0 if
+ * the item doesn't exist in the wide crit-bit.
+ */
+static inline int critbit_wide_remove(struct critbit_wide *w, uintptr_t v);
+
+/*
+ * Returns 1 if the given item exists in the wide crit-bit, otherwise
+ * returns 0.
+ */
+static inline int critbit_wide_contains(const struct critbit_wide *w,
+    uintptr_t v);
+
+/*
+ * Calls visitor for each item in the wide crit-bit in ascending order.
+ * Do not modify wide crit-bit in visitor!
+ */
+static inline void critbit_wide_foreach(const struct critbit_wide *w,
+    const struct critbit_visitor *visitor);
+
+#if defined(__GNUC__)
+/*
+ * Opaque sharded crit-bit. It splits the key space by the top shard_bits
+ * bits of keys into 2^shard_bits crit-bits, which are protected by distinct
+ * spinlocks, so writers touching distinct shards don't contend. Shards are
+ * contiguous key ranges, so ordered iteration visits shards one by one.
+ * Sharded crit-bits may be accessed from multiple threads without external
+ * locking. Requires GCC-compatible __atomic builtins.
+ */
+struct critbit_sharded;
+
+/*
+ * Creates a sharded crit-bit with 2^shard_bits shards. shard_bits mustn't
+ * exceed 16. node_allocators must contain an allocator per shard, which is
+ * used only under the shard lock, so distinct shards don't contend
+ * in the allocator. A critbit_slab_allocator per shard fits well.
+ */
+static inline struct critbit_sharded *critbit_sharded_create(
+    const struct critbit_node_allocator *const *node_allocators,
+    unsigned shard_bits);
+
+/*
+ * Deletes the given sharded crit-bit.
+ */
+static inline void critbit_sharded_delete(struct critbit_sharded *sh);
+
+/*
+ * Adds the given item to the sharded crit-bit. Returns 1 on success, 0 if
+ * the item already exists in the sharded crit-bit.
+ */
+static inline int critbit_sharded_add(struct critbit_sharded *sh,
+    uintptr_t v);
+
+/*
+ * Removes the given item from the sharded crit-bit. Returns 1 on success,
+ * 0 if the item doesn't exist in the sharded crit-bit.
+ */
+static inline int critbit_sharded_remove(struct critbit_sharded *sh,
+    uintptr_t v);
+
+/*
+ * Returns 1 if the given item exists in the sharded crit-bit, otherwise
+ * returns 0.
+ */
+static inline int critbit_sharded_contains(struct critbit_sharded *sh,
+    uintptr_t v);
+
+/*
+ * Calls visitor for each item in the sharded crit-bit in ascending order.
+ * Each shard is locked while its items are visited, so the visitor sees
+ * a consistent view of every shard, but not of the whole crit-bit.
+ * Do not modify sharded crit-bit in visitor!
+ */
+static inline void critbit_sharded_foreach(struct critbit_sharded *sh,
+    const struct critbit_visitor *visitor);
+
+/*
+ * Cursor for ordered iteration over sharded crit-bit items. Unlike
+ * critbit_cursor, it remembers only the current item and looks up
+ * its neighbours under the shard lock on each step, so concurrent
+ * modifications don't invalidate it.
+ */
+struct critbit_sharded_cursor
+{
+  /* All the members are private. */
+  struct critbit_sharded *sh;
+  uintptr_t key;
+};
+
+/*
+ * Positions the cursor at the smallest item in the sharded crit-bit.
+ * Returns 1 on success, 0 if the sharded crit-bit is empty.
+ */
+static inline int critbit_sharded_seek_first(struct critbit_sharded_cursor *c,
+    struct critbit_sharded *sh);
+
+/*
+ * Positions the cursor at the largest item in the sharded crit-bit.
+ * Returns 1 on success, 0 if the sharded crit-bit is empty.
+ */
+static inline int critbit_sharded_seek_last(struct critbit_sharded_cursor *c,
+    struct critbit_sharded *sh);
+
+/*
+ * Positions the cursor at the smallest item greater or equal to v.
+ * Returns 1 on success, 0 if there is no such item.
+ */
+static inline int critbit_sharded_seek_ge(struct critbit_sharded_cursor *c,
+    struct critbit_sharded *sh, uintptr_t v);
+
+/*
+ * Positions the cursor at the largest item less or equal to v.
+ * Returns 1 on success, 0 if there is no such item.
+ */
+static inline int critbit_sharded_seek_le(struct critbit_sharded_cursor *c,
+    struct critbit_sharded *sh, uintptr_t v);
+
+/*
+ * Returns the item the cursor points to.
+ * The cursor must be successfully positioned with critbit_sharded_seek_*().
+ */
+static inline uintptr_t critbit_sharded_cursor_get(
+    const struct critbit_sharded_cursor *c);
+
+/*
+ * Moves the cursor to the next item. Returns 1 on success, 0 if the cursor
+ * is positioned at the largest item. The cursor isn't moved on failure.
+ */
+static inline int critbit_sharded_cursor_next(
+    struct critbit_sharded_cursor *c);
+
+/*
+ * Moves the cursor to the previous item. Returns 1 on success, 0 if the cursor
+ * is positioned at the smallest item. The cursor isn't moved on failure.
+ */
+static inline int critbit_sharded_cursor_prev(
+    struct critbit_sharded_cursor *c);
+#endif
+
+/*
+ * Returns the index of the first item equal to v in the array a of n items,
+ * or n if a doesn't contain v. Items may go in any order. Takes O(n) time,
+ * so it suits small arrays such as buckets.
+ * Uses the widest SIMD instructions supported by the CPU.
+ */
+static inline size_t critbit_array_find(const uintptr_t *a, size_t n,
+    uintptr_t v);
+
+/*
+ * Returns the index of the first item not less than v in the array a
+ * of n items sorted in ascending order, e.g. by critbit_foreach().
+ * Returns n if all the items are less than v.
+ * Uses the widest SIMD instructions supported by the CPU for comparing
+ * the last items of the binary search at once.
+ */
+static inline size_t critbit_array_lower_bound(const uintptr_t *a, size_t n,
+    uintptr_t v);
+
+/*
+ * Returns the name of the instruction set used by critbit_array_find()
+ * and critbit_array_lower_bound() on this CPU.
+ */
+static inline const char *critbit_array_get_isa(void);
+
+/*
+ * Slab allocator for crit-bit nodes, which can be used instead of a custom
+ * critbit_node_allocator.
+ * Nodes are carved from cache line-aligned slabs. Released nodes are kept
+ * in a free list for subsequent allocations. All the slabs are released
+ * at once by critbit_slab_allocator_destroy().
+ *
+ * Usage:
+ *
+ *   struct critbit_slab_allocator s;
+ *   critbit_slab_allocator_init(&s, critbit_node_size());
+ *   struct critbit *cb = critbit_create(&s.node_allocator);
+ *   ...
+ *   critbit_delete(cb);
+ *   critbit_slab_allocator_destroy(&s);
+ *
+ * The allocator may be shared among multiple crit-bits, since critbit_delete()
+ * returns nodes one by one to the free list unless
+ * critbit_slab_allocator_set_exclusive() is called.
+ */
+struct critbit_slab_allocator
+{
+  /* Pass a pointer to this member to critbit_create(). */
+  struct critbit_node_allocator node_allocator;
+
+  /* The rest of members are private. */
+  void *slabs;
+  void *free_nodes;
+  char *next_node;
+  size_t slab_free_bytes;
+  size_t node_size;
+};
+
+/*
+ * Initializes the slab allocator for nodes of the given size.
+ * node_size is usually critbit_node_size().
+ */
+static inline void critbit_slab_allocator_init(
+    struct critbit_slab_allocator *s, size_t node_size);
+
+/*
+ * Makes critbit_delete() release all the slabs at once instead of visiting
+ * every node. Call it only if the allocator serves a single crit-bit,
+ * otherwise deleting any crit-bit would release nodes of the others.
+ */
+static inline void critbit_slab_allocator_set_exclusive(
+    struct critbit_slab_allocator *s);
+
+/* Releases all the memory allocated by the slab allocator. */
+static inline void critbit_slab_allocator_destroy(
+    struct critbit_slab_allocator *s);
+
+
+/*******************************************************************************
+ * Implementation.
+ ******************************************************************************/
+#include <assert.h>
+#include <limits.h>  /* for CHAR_BIT */
+#include <stddef.h>  /* for size_t */
+#include <stdint.h>  /* for uint*_t */
+#include <stdlib.h>  /* for malloc/free */
+#include <string.h>  /* for memcpy/strlen */
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>  /* for SSE2 intrinsics */
+#endif
+
+/*
+ * By default leaves are keys, while pointers to nodes are tagged with
+ * the lowest bit, so keys must be non-zero even integers. Define
+ * CRITBIT_ANY_KEYS in order to allow arbitrary keys, including zero and
+ * odd integers. Then each node stores a bit per child telling whether
+ * the child is a node, while the crit-bit stores such a bit for the root.
+ * The descent reads the bit from the node it already holds, so it doesn't
+ * take more branches than the tagged descent.
+ *
+ * Node children and their bits can't be updated atomically, and compact
+ * nodes have no room for the bits, so CRITBIT_ANY_KEYS can't be combined
+ * with CRITBIT_CONCURRENT and CRITBIT_COMPACT_NODES.
+ */
+#if defined(CRITBIT_ANY_KEYS)
+#  if defined(CRITBIT_CONCURRENT)
+#    error "CRITBIT_ANY_KEYS and CRITBIT_CONCURRENT are mutually exclusive"
+#  endif
+#  if defined(CRITBIT_COMPACT_NODES)
+#    error "CRITBIT_ANY_KEYS and CRITBIT_COMPACT_NODES are mutually exclusive"
+#  endif
+#endif
+
+struct critbit
+{
+  uintptr_t root;
+#if defined(CRITBIT_ANY_KEYS)
+  uint8_t root_kinds;
+  uint8_t has_root;
+#endif
+  const struct critbit_node_allocator *node_allocator;
+
+  /*
+   * Set if nodes were exchanged with other crit-bits, which use the same
+   * node allocator, so release_all_nodes() can't be called on delete.
+   */
+  int shares_node_allocator;
+#if defined(CRITBIT_COUNTERS)
+  struct critbit_counters counters;
+#endif
+#if defined(CRITBIT_TRACE)
+  struct critbit_tracer *tracer;
+#endif
+};
+
+/*
+ * Increments the given operation counter if CRITBIT_COUNTERS is defined.
+ * Counters are updated by read-only operations too, hence the cast.
+ */
+#if defined(CRITBIT_COUNTERS)
+#  define _CRITBIT_COUNT(cb, counter) \
+    (++((struct critbit *)(cb))->counters.counter)
+#else
+#  define _CRITBIT_COUNT(cb, counter) ((void)0)
+#endif
+
+#if defined(CRITBIT_TRACE)
+#  if !(defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__) || \
+      defined(__aarch64__)))
+#    include <time.h>  /* for clock() */
+#  endif
+
+static inline uint64_t _critbit_read_cycles(void)
+{
+#  if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return __builtin_ia32_rdtsc();
+#  elif defined(__GNUC__) && defined(__aarch64__)
+  uint64_t t;
+  __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(t));
+  return t;
+#  else
+  return (uint64_t)clock();
+#  endif
+}
+
+/* Values below 16 have exact buckets. */
+static inline size_t _critbit_histogram_get_index(const uint64_t v)
+{
+  if (v < 16) {
+    return (size_t)v;
+  }
+#  if defined(__GNUC__)
+  const unsigned msb = 63 - (unsigned)__builtin_clzll(v);
+#  else
+  unsigned msb = 0;
+  while ((v >> msb) > 1) {
+    ++msb;
+  }
+#  endif
+  return (size_t)(msb - 3) * 16 + (size_t)((v >> (msb - 4)) & 15);
+}
+
+static inline uint64_t _critbit_histogram_get_upper_bound(const size_t index)
+{
+  assert(index < CRITBIT_HISTOGRAM_BUCKETS);
+  if (index < 16) {
+    return index;
+  }
+  const unsigned shift = (unsigned)(index / 16) - 1;
+  return ((uint64_t)(16 + index % 16) << shift) + ((uint64_t)1 << shift) - 1;
+}
+
+static inline void _critbit_histogram_record(struct critbit_histogram *const h,
+    const uint64_t v)
+{
+  ++h->count;
+  ++h->buckets[_critbit_histogram_get_index(v)];
+  if (v > h->max) {
+    h->max = v;
+  }
+}
+
+static inline void _critbit_trace_end(struct critbit_tracer *const t,
+    const enum critbit_trace_op op, const uintptr_t v, const size_t depth,
+    const uint64_t start)
+{
+  if (t == NULL) {
+    return;
+  }
+  struct critbit_trace_stats *const stats = &t->stats[op];
+  _critbit_histogram_record(&stats->cycles, _critbit_read_cycles() - start);
+  assert(depth <= _CRITBIT_MAX_DEPTH);
+  ++stats->depth_histogram[depth];
+  if (depth > t->deep_path_threshold && t->on_deep_path != NULL) {
+    t->on_deep_path(t->ctx, op, v, depth);
+  }
+}
+#endif
+
+/*
+ * Brackets a traced operation if CRITBIT_TRACE is defined. The clock isn't
+ * read if the crit-bit has no tracer.
+ */
+#if defined(CRITBIT_TRACE)
+#  define _CRITBIT_TRACE_START(cb) \
+    ((cb)->tracer != NULL ? _critbit_read_cycles() : 0)
+#  define _CRITBIT_TRACE_END(cb, op, v, depth, start) \
+    _critbit_trace_end((cb)->tracer, op, v, depth, start)
+#else
+#  define _CRITBIT_TRACE_START(cb) ((void)(cb), (uint64_t)0)
+#  define _CRITBIT_TRACE_END(cb, op, v, depth, start) \
+    ((void)(v), (void)(depth), (void)(start))
+#endif
+
+/*
+ * By default a node stores the index of its crit bit. Define CRITBIT_NODE_MASK
+ * in order to store the ready-made mask for the crit bit instead, so the node
+ * descent doesn't need to rebuild the mask at every step.
+ *
+ * Define CRITBIT_COMPACT_NODES in order to keep the crit bit in the top byte
+ * of the tagged pointer to the node instead. This shrinks the node
+ * to two pointers, but requires 64-bit pointers with zero top byte,
+ * which is the case for user-space addresses on x86-64 and AArch64.
+ */
+#if defined(CRITBIT_COMPACT_NODES)
+#  if defined(CRITBIT_NODE_MASK)
+#    error "CRITBIT_COMPACT_NODES and CRITBIT_NODE_MASK are mutually exclusive"
+#  endif
+#  if UINTPTR_MAX != UINT64_MAX
+#    error "CRITBIT_COMPACT_NODES requires 64-bit pointers"
+#  endif
+#  define _CRITBIT_CRIT_BIT_SHIFT 56
+#  define _CRITBIT_ADDRESS_MASK \
+    ((((uintptr_t)1) << _CRITBIT_CRIT_BIT_SHIFT) - 1)
+#endif
+
+struct _critbit_node
+{
+  uintptr_t next[2];
+#if defined(CRITBIT_NODE_MASK)
+  uintptr_t mask;
+#elif !defined(CRITBIT_COMPACT_NODES)
+  uint8_t crit_bit;
+#endif
+#if defined(CRITBIT_ANY_KEYS)
+  /* Bit i is set if next[i] refers to a node. */
+  uint8_t kinds;
+#endif
+#if defined(CRITBIT_ORDER_STATS)
+  /*
+   * The number of items in the subtree. It is maintained only in nodes
+   * of struct critbit.
+   */
+  size_t count;
+#endif
+#if defined(CRITBIT_PERSISTENT)
+  /* The number of references to the node from crit-bits and nodes. */
+  size_t refs;
+#endif
+};
+
+/*
+ * Define CRITBIT_PERSISTENT in order to share nodes among crit-bits, so
+ * critbit_snapshot() takes O(1) time. Each node counts references to it.
+ * Writers copy shared nodes on the path before modifying them, while nodes
+ * owned by a single crit-bit are modified in place. Shared nodes are
+ * released when the last crit-bit referring to them is deleted.
+ * Reference counts are atomic, so snapshots may be deleted by any thread.
+ */
+#if defined(CRITBIT_PERSISTENT) && !defined(__GNUC__)
+#  error "CRITBIT_PERSISTENT requires GCC-compatible __atomic builtins"
+#endif
+
+/*
+ * Define CRITBIT_CONCURRENT in order to allow a single writer modifying
+ * the crit-bit concurrently with multiple readers. The writer publishes
+ * changes with release stores to node slots and retires removed nodes
+ * via critbit_node_allocator.retire_node, while readers traverse the tree
+ * with acquire loads without any locks.
+ *
+ * Readers are critbit_contains(), critbit_contains_batch(),
+ * critbit_foreach(), critbit_foreach_range() and cursor functions.
+ * Writers are the rest of functions modifying the crit-bit.
+ */
+#if defined(CRITBIT_CONCURRENT) && !defined(__GNUC__)
+#  error "CRITBIT_CONCURRENT requires GCC-compatible __atomic builtins"
+#endif
+
+static inline uintptr_t _critbit_load(const uintptr_t *const slot)
+{
+#if defined(CRITBIT_CONCURRENT)
+  return __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+#else
+  return *slot;
+#endif
+}
+
+static inline void _critbit_store(uintptr_t *const slot, const uintptr_t v)
+{
+#if defined(CRITBIT_CONCURRENT)
+  __atomic_store_n(slot, v, __ATOMIC_RELEASE);
+#else
+  *slot = v;
+#endif
+}
+
+static const uint8_t _CRITBIT_PTR_BITS = sizeof(void *) * CHAR_BIT;
+
+static inline int _critbit_has_tag(const uintptr_t v)
+{
+  assert(v != 0);
+
+  return (v & 1);
+}
+
+/* Returns 1 if v may be used as a key. */
+static inline int _critbit_is_valid_key(const uintptr_t v)
+{
+#if defined(CRITBIT_ANY_KEYS)
+  (void)v;
+  return 1;
+#else
+  return (v != 0 && !_critbit_has_tag(v));
+#endif
+}
+
+static inline uintptr_t _critbit_get_mask(const uint8_t bit)
+{
+  assert(bit < _CRITBIT_PTR_BITS);
+
+  return (((uintptr_t)1) << (_CRITBIT_PTR_BITS - 1 - bit));
+}
+
+static inline int _critbit_is_set(const uintptr_t v, const uint8_t bit)
+{
+  return ((v & _critbit_get_mask(bit)) != 0);
+}
+
+/*
+ * Returns the number of leading zero bits in x using a single instruction
+ * where possible. Define CRITBIT_NO_CLZ in order to fall back
+ * to the bit-by-bit loop in _critbit_scan_first_set_bit().
+ */
+#if !defined(CRITBIT_NO_CLZ)
+#  if defined(__GNUC__)
+#    if UINTPTR_MAX == ULONG_MAX
+#      define _CRITBIT_CLZ(x) ((uint8_t)__builtin_clzl(x))
+#    elif UINTPTR_MAX == ULLONG_MAX
+#      define _CRITBIT_CLZ(x) ((uint8_t)__builtin_clzll(x))
+#    endif
+#  elif defined(_MSC_VER)
+#    include <intrin.h>  /* for _BitScanReverse*() */
+static inline uint8_t _critbit_clz_msvc(const uintptr_t x)
+{
+  unsigned long index;
+#    if UINTPTR_MAX == UINT64_MAX
+  _BitScanReverse64(&index, x);
+#    else
+  _BitScanReverse(&index, x);
+#    endif
+  return (uint8_t)(sizeof(x) * CHAR_BIT - 1 - index);
+}
+#    define _CRITBIT_CLZ(x) _critbit_clz_msvc(x)
+#  elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 202311L && \
+      defined(__has_include)
+#    if __has_include(<stdbit.h>)
+#      include <stdbit.h>  /* for stdc_leading_zeros() */
+#      define _CRITBIT_CLZ(x) ((uint8_t)stdc_leading_zeros(x))
+#    endif
+#  endif
+#endif
+
+static inline uint8_t _critbit_scan_first_set_bit(const uintptr_t x)
+{
+  assert(x != 0);
+
+  uint8_t bit = 0;
+  for (;;) {
+    if (_critbit_is_set(x, bit)) {
+      break;
+    }
+    ++bit;
+  }
+  return bit;
+}
+
+static inline uint8_t _critbit_get_first_set_bit(const uintptr_t x)
+{
+  assert(x != 0);
+
+#if defined(_CRITBIT_CLZ)
+  return _CRITBIT_CLZ(x);
+#else
+  return _critbit_scan_first_set_bit(x);
+#endif
+}
+
+static inline uint8_t _critbit_get_crit_bit(const uintptr_t v1,
+    const uintptr_t v2)
+{
+  assert(v1 != v2);
+  assert(_critbit_is_valid_key(v1));
+  assert(_critbit_is_valid_key(v2));
+
+  return _critbit_get_first_set_bit(v1 ^ v2);
+}
+
+static inline size_t _critbit_get_index(const uintptr_t v, const uint8_t bit)
+{
+  assert(_critbit_is_valid_key(v));
+
+  return (_critbit_is_set(v, bit) ? 1 : 0);
+}
+
+static inline uintptr_t _critbit_add_tag(const struct _critbit_node *const node,
+    const uint8_t crit_bit)
+{
+  const uintptr_t v = (uintptr_t)node;
+  assert(!_critbit_has_tag(v));
+
+#if defined(CRITBIT_COMPACT_NODES)
+  assert((v >> _CRITBIT_CRIT_BIT_SHIFT) == 0);
+  return v + (((uintptr_t)crit_bit) << _CRITBIT_CRIT_BIT_SHIFT) + 1;
+#else
+  (void)crit_bit;
+  return v + 1;
+#endif
+}
+
+static inline struct _critbit_node *_critbit_remove_tag(const uintptr_t v)
+{
+  assert(_critbit_has_tag(v));
+
+#if defined(CRITBIT_COMPACT_NODES)
+  return (struct _critbit_node *)((v & _CRITBIT_ADDRESS_MASK) - 1);
+#else
+  return (struct _critbit_node *)(v - 1);
+#endif
+}
+
+static inline void _critbit_node_set_crit_bit(
+    struct _critbit_node *const node, const uint8_t crit_bit)
+{
+#if defined(CRITBIT_COMPACT_NODES)
+  /* The crit bit is stored in the tagged node pointer. */
+  (void)node;
+  (void)crit_bit;
+#elif defined(CRITBIT_NODE_MASK)
+  node->mask = _critbit_get_mask(crit_bit);
+#else
+  node->crit_bit = crit_bit;
+#endif
+}
+
+static inline uint8_t _critbit_node_get_crit_bit(const uintptr_t tagged_node)
+{
+#if defined(CRITBIT_COMPACT_NODES)
+  assert(_critbit_has_tag(tagged_node));
+  return (uint8_t)(tagged_node >> _CRITBIT_CRIT_BIT_SHIFT);
+#elif defined(CRITBIT_NODE_MASK)
+  return _critbit_get_first_set_bit(_critbit_remove_tag(tagged_node)->mask);
+#else
+  return _critbit_remove_tag(tagged_node)->crit_bit;
+#endif
+}
+
+static inline size_t _critbit_node_get_index(const uintptr_t tagged_node,
+    const uintptr_t v)
+{
+  assert(_critbit_is_valid_key(v));
+
+#if defined(CRITBIT_NODE_MASK)
+  return ((v & _critbit_remove_tag(tagged_node)->mask) != 0);
+#else
+  return _critbit_get_index(v, _critbit_node_get_crit_bit(tagged_node));
+#endif
+}
+
+/*
+ * Returns 1 if the node's crit bit is located after the given crit bit,
+ * i.e. the node must be placed below a node with the given crit bit.
+ */
+static inline int _critbit_node_is_after(const uintptr_t tagged_node,
+    const uint8_t crit_bit)
+{
+#if defined(CRITBIT_NODE_MASK)
+  const struct _critbit_node *const node = _critbit_remove_tag(tagged_node);
+  return (node->mask < _critbit_get_mask(crit_bit));
+#else
+  return (_critbit_node_get_crit_bit(tagged_node) > crit_bit);
+#endif
+}
+
+/*
+ * Returns a pointer to bits telling which children of the node are nodes,
+ * or NULL if the lowest bit of the child tells that.
+ */
+static inline uint8_t *_critbit_node_kinds(
+    const struct _critbit_node *const node)
+{
+#if defined(CRITBIT_ANY_KEYS)
+  return (uint8_t *)&node->kinds;
+#else
+  (void)node;
+  return NULL;
+#endif
+}
+
+static inline void _critbit_node_set_kinds(struct _critbit_node *const node,
+    const unsigned kinds)
+{
+#if defined(CRITBIT_ANY_KEYS)
+  node->kinds = (uint8_t)kinds;
+#else
+  (void)node;
+  (void)kinds;
+#endif
+}
+
+/*
+ * Returns 1 if v, which is referred by the given index of kinds,
+ * is a node. Otherwise v is a key.
+ */
+static inline int _critbit_kinds_is_node(const uint8_t *const kinds,
+    const size_t index, const uintptr_t v)
+{
+#if defined(CRITBIT_ANY_KEYS)
+  (void)v;
+  return ((*kinds >> index) & 1);
+#else
+  (void)kinds;
+  (void)index;
+  return _critbit_has_tag(v);
+#endif
+}
+
+static inline int _critbit_child_is_node(
+    const struct _critbit_node *const node, const size_t index,
+    const uintptr_t child)
+{
+  return _critbit_kinds_is_node(_critbit_node_kinds(node), index, child);
+}
+
+#if defined(CRITBIT_ORDER_STATS)
+/* Returns the number of items in the subtree v. */
+static inline size_t _critbit_subtree_get_count(const uintptr_t v,
+    const int is_node)
+{
+  return (is_node ? _critbit_remove_tag(v)->count : 1);
+}
+
+static inline size_t _critbit_child_get_count(
+    const struct _critbit_node *const node, const size_t index)
+{
+  const uintptr_t child = node->next[index];
+  return _critbit_subtree_get_count(child,
+      _critbit_child_is_node(node, index, child));
+}
+#endif
+
+/*
+ * Recalculates the number of items in the subtree of the node after its
+ * children change. Does nothing unless CRITBIT_ORDER_STATS is defined.
+ */
+static inline void _critbit_node_update_count(
+    struct _critbit_node *const node)
+{
+#if defined(CRITBIT_ORDER_STATS)
+  node->count = _critbit_child_get_count(node, 0) +
+      _critbit_child_get_count(node, 1);
+#else
+  (void)node;
+#endif
+}
+
+/*
+ * Root accessors shared by crit-bits and crit-bit maps. The root of an empty
+ * crit-bit is zero unless CRITBIT_ANY_KEYS is defined.
+ */
+#if defined(CRITBIT_ANY_KEYS)
+#  define _CRITBIT_ROOT_KINDS(owner) ((uint8_t *)&(owner)->root_kinds)
+#  define _CRITBIT_IS_EMPTY(owner, root) ((void)(root), !(owner)->has_root)
+#  define _CRITBIT_SET_HAS_ROOT(owner, x) \
+    ((void)(((owner)->has_root = (x)), ((owner)->root_kinds = 0)))
+#else
+#  define _CRITBIT_ROOT_KINDS(owner) ((uint8_t *)NULL)
+#  define _CRITBIT_IS_EMPTY(owner, root) ((void)(owner), (root) == 0)
+#  define _CRITBIT_SET_HAS_ROOT(owner, x) ((void)(owner), (void)(x))
+#endif
+#define _CRITBIT_ROOT_IS_NODE(owner, root) \
+    _critbit_kinds_is_node(_CRITBIT_ROOT_KINDS(owner), 0, (root))
+#define _CRITBIT_ROOT_SLOT(owner) \
+    _critbit_make_slot((uintptr_t *)&(owner)->root, \
+        _CRITBIT_ROOT_KINDS(owner), 0)
+
+/* A modifiable reference to the root or to a node child. */
+struct _critbit_slot
+{
+  uintptr_t *v;
+  uint8_t *kinds;
+  size_t index;
+};
+
+static inline struct _critbit_slot _critbit_make_slot(uintptr_t *const v,
+    uint8_t *const kinds, const size_t index)
+{
+  struct _critbit_slot slot;
+  slot.v = v;
+  slot.kinds = kinds;
+  slot.index = index;
+  return slot;
+}
+
+static inline struct _critbit_slot _critbit_child_slot(
+    const struct _critbit_node *const node, const size_t index)
+{
+  return _critbit_make_slot((uintptr_t *)&node->next[index],
+      _critbit_node_kinds(node), index);
+}
+
+static inline int _critbit_slot_is_node(const struct _critbit_slot slot)
+{
+  return _critbit_kinds_is_node(slot.kinds, slot.index, *slot.v);
+}
+
+static inline void _critbit_slot_set(const struct _critbit_slot slot,
+    const uintptr_t v, const int is_node)
+{
+#if defined(CRITBIT_ANY_KEYS)
+  const unsigned mask = 1u << slot.index;
+  *slot.kinds = (uint8_t)((*slot.kinds & ~mask) | (is_node ? mask : 0));
+#else
+  assert(is_node == _critbit_has_tag(v));
+  (void)is_node;
+#endif
+  _critbit_store(slot.v, v);
+}
+
+/* Allocates a node, which is referred once. */
+static inline struct _critbit_node *_critbit_alloc_node(
+    const struct critbit_node_allocator *const a)
+{
+  struct _critbit_node *const node = a->alloc_node(a->ctx);
+#if defined(CRITBIT_PERSISTENT)
+  node->refs = 1;
+#endif
+  return node;
+}
+
+/* Adds a reference to the subtree v if it is a node. */
+static inline void _critbit_ref_subtree(const uintptr_t v, const int is_node)
+{
+#if defined(CRITBIT_PERSISTENT)
+  if (is_node) {
+    __atomic_add_fetch(&_critbit_remove_tag(v)->refs, 1, __ATOMIC_RELAXED);
+  }
+#else
+  (void)v;
+  (void)is_node;
+#endif
+}
+
+/*
+ * Creates a node with the key v1 and the subtree v2, which is a node
+ * if v2_is_node is set, and returns the tagged node.
+ */
+static inline uintptr_t _critbit_create_node(const struct critbit *const cb,
+    const uintptr_t v1, const uintptr_t v2, const int v2_is_node,
+    const uint8_t crit_bit)
+{
+  assert(_critbit_is_valid_key(v1));
+
+  struct _critbit_node *const node = _critbit_alloc_node(cb->node_allocator);
+  const size_t index = _critbit_get_index(v1, crit_bit);
+  if (!v2_is_node) {
+    assert(v1 != v2);
+    assert(_critbit_get_index(v2, crit_bit) == (index ^ 1));
+  }
+  node->next[index] = v1;
+  node->next[index ^ 1] = v2;
+  _critbit_node_set_kinds(node, (unsigned)v2_is_node << (index ^ 1));
+  _critbit_node_set_crit_bit(node, crit_bit);
+  _critbit_node_update_count(node);
+  return _critbit_add_tag(node, crit_bit);
+}
+
+/*
+ * Releases the node, which was unlinked from the crit-bit. The node is retired
+ * if the allocator supports this, since concurrent readers may still access
+ * it.
+ */
+static inline void _critbit_release_node(
+    const struct critbit_node_allocator *const a,
+    struct _critbit_node *const node)
+{
+  if (a->retire_node != NULL) {
+    a->retire_node(a->ctx, node);
+  }
+  else {
+    a->free_node(a->ctx, node);
+  }
+}
+
+/*
+ * Replaces the node referred by the slot with the node's child, which doesn't
+ * lead to v, and deletes the node.
+ */
+static inline void _critbit_delete_node(const struct critbit *const cb,
+    const struct _critbit_slot slot, const uintptr_t v)
+{
+  const uintptr_t tagged_node = *slot.v;
+  struct _critbit_node *const node = _critbit_remove_tag(tagged_node);
+  const size_t index = _critbit_node_get_index(tagged_node, v) ^ 1;
+  const uintptr_t child = node->next[index];
+  _critbit_slot_set(slot, child, _critbit_child_is_node(node, index, child));
+  _critbit_release_node(cb->node_allocator, node);
+}
+
+/*
+ * Adds delta to the number of items in nodes on the path from the root
+ * to the slot stop, which leads to v. Does nothing unless
+ * CRITBIT_ORDER_STATS is defined.
+ */
+static inline void _critbit_add_path_counts(struct critbit *const cb,
+    const uintptr_t v, const uintptr_t *const stop, const size_t delta)
+{
+#if defined(CRITBIT_ORDER_STATS)
+  struct _critbit_slot slot = _CRITBIT_ROOT_SLOT(cb);
+  while (slot.v != stop) {
+    const uintptr_t tagged_node = *slot.v;
+    struct _critbit_node *const node = _critbit_remove_tag(tagged_node);
+    node->count += delta;
+    slot = _critbit_child_slot(node, _critbit_node_get_index(tagged_node, v));
+  }
+#else
+  (void)cb;
+  (void)v;
+  (void)stop;
+  (void)delta;
+#endif
+}
+
+/*
+ * Stores slots on the path from the root to the leaf nearest to v into path
+ * and returns the number of nodes on the path. path[depth] is the leaf slot.
+ */
+static inline size_t _critbit_get_leaf_path(const struct critbit *const cb,
+    const uintptr_t v, struct _critbit_slot *const path)
+{
+  size_t depth = 0;
+  path[0] = _CRITBIT_ROOT_SLOT(cb);
+  while (_critbit_slot_is_node(path[depth])) {
+    const uintptr_t tagged_node = *path[depth].v;
+    assert(depth < _CRITBIT_MAX_DEPTH);
+    path[depth + 1] = _critbit_child_slot(_critbit_remove_tag(tagged_node),
+        _critbit_node_get_index(tagged_node, v));
+    ++depth;
+  }
+  return depth;
+}
+
+static inline void _critbit_prefetch_node(const uintptr_t tagged_node)
+{
+#if defined(__GNUC__)
+  __builtin_prefetch(_critbit_remove_tag(tagged_node));
+#else
+  (void)tagged_node;
+#endif
+}
+
+/*
+ * Releases all the nodes of the subtree v. Nodes are retired if retire is set
+ * and the subtree was unlinked from a crit-bit, which is still in use.
+ * Only drops a reference to nodes, which are shared with other crit-bits
+ * if CRITBIT_PERSISTENT is defined.
+ */
+static inline void _critbit_remove_all_nodes(
+    const struct critbit_node_allocator *const node_allocator, uintptr_t v,
+    int is_node, const int retire)
+{
+  /* Right subtrees, which are waiting for removal. All of them are nodes. */
+  uintptr_t stack[_CRITBIT_MAX_DEPTH];
+  size_t depth = 0;
+
+  for (;;) {
+    while (is_node) {
+      struct _critbit_node *const node = _critbit_remove_tag(v);
+#if defined(CRITBIT_PERSISTENT)
+      if (__atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        break;
+      }
+#endif
+      const uintptr_t left = node->next[0];
+      const uintptr_t right = node->next[1];
+      const int left_is_node = _critbit_child_is_node(node, 0, left);
+      const int right_is_node = _critbit_child_is_node(node, 1, right);
+      if (retire) {
+        _critbit_release_node(node_allocator, node);
+      }
+      else {
+        node_allocator->free_node(node_allocator->ctx, node);
+      }
+      if (right_is_node) {
+        assert(depth < _CRITBIT_MAX_DEPTH);
+        _critbit_prefetch_node(right);
+        stack[depth++] = right;
+      }
+      v = left;
+      is_node = left_is_node;
+    }
+    if (depth == 0) {
+      break;
+    }
+    v = stack[--depth];
+    is_node = 1;
+  }
+}
+
+/*
+ * Returns the tagged node, which may be modified in place instead
+ * of the given one, and passes the reference to the given node to it.
+ * Shared nodes are copied if CRITBIT_PERSISTENT is defined.
+ */
+static inline uintptr_t _critbit_take_node(
+    const struct critbit_node_allocator *const a, const uintptr_t tagged_node)
+{
+#if defined(CRITBIT_PERSISTENT)
+  const struct _critbit_node *const node = _critbit_remove_tag(tagged_node);
+  if (__atomic_load_n(&node->refs, __ATOMIC_ACQUIRE) == 1) {
+    return tagged_node;
+  }
+  struct _critbit_node *const copy = _critbit_alloc_node(a);
+  *copy = *node;
+  copy->refs = 1;
+  for (size_t i = 0; i < 2; ++i) {
+    _critbit_ref_subtree(copy->next[i],
+        _critbit_child_is_node(copy, i, copy->next[i]));
+  }
+  _critbit_remove_all_nodes(a, tagged_node, 1, 1);
+  return _critbit_add_tag(copy, _critbit_node_get_crit_bit(tagged_node));
+#else
+  (void)a;
+  return tagged_node;
+#endif
+}
+
+/*
+ * Makes the node referred by the slot modifiable in place and returns it.
+ */
+static inline struct _critbit_node *_critbit_own_slot(
+    const struct critbit *const cb, const struct _critbit_slot slot)
+{
+  const uintptr_t tagged_node = _critbit_take_node(cb->node_allocator,
+      *slot.v);
+  if (tagged_node != *slot.v) {
+    _critbit_slot_set(slot, tagged_node, 1);
+  }
+  return _critbit_remove_tag(tagged_node);
+}
+
+#if defined(CRITBIT_PERSISTENT)
+/*
+ * Makes nodes on the path from the root to the node last, which is on the path
+ * to v, modifiable in place. Returns the slot referring to the node last.
+ */
+static inline struct _critbit_slot _critbit_own_path(
+    struct critbit *const cb, const uintptr_t v, const uintptr_t last)
+{
+  struct _critbit_slot slot = _CRITBIT_ROOT_SLOT(cb);
+  for (;;) {
+    const int is_last = (*slot.v == last);
+    const struct _critbit_node *const node = _critbit_own_slot(cb, slot);
+    if (is_last) {
+      return slot;
+    }
+    slot = _critbit_child_slot(node, _critbit_node_get_index(*slot.v, v));
+  }
+}
+#endif
+
+static inline size_t critbit_node_size(void)
+{
+  return sizeof(struct _critbit_node);
+}
+
+static inline struct critbit *critbit_create(
+    const struct critbit_node_allocator *const node_allocator)
+{
+  struct critbit *const cb = malloc(sizeof(*cb));
+  cb->root = 0;
+  _CRITBIT_SET_HAS_ROOT(cb, 0);
+  cb->node_allocator = node_allocator;
+  cb->shares_node_allocator = 0;
+#if defined(CRITBIT_COUNTERS)
+  critbit_reset_counters(cb);
+#endif
+#if defined(CRITBIT_TRACE)
+  cb->tracer = NULL;
+#endif
+  return cb;
+}
+
+/*
+ * Returns the index of the first item in a[lo..hi) with the given bit set.
+ * a[lo] must have the bit cleared, while a[hi - 1] must have the bit set.
+ * The search gallops from both ends, so it takes O(log(m)) time, where m
+ * is the size of the smaller part. This makes the total time required
+ * for building a crit-bit from n items O(n).
+ */
+static inline size_t _critbit_find_split(const uintptr_t *const a,
+    size_t lo, size_t hi, const uint8_t bit)
+{
+  assert(hi - lo >= 2);
+  assert(!_critbit_is_set(a[lo], bit));
+  assert(_critbit_is_set(a[hi - 1], bit));
+
+  /* The split is in (lo, hi]. */
+  --hi;
+  size_t step = 1;
+  for (;;) {
+    if (hi - lo <= step) {
+      break;
+    }
+    if (_critbit_is_set(a[lo + step], bit)) {
+      hi = lo + step;
+      break;
+    }
+    lo += step;
+    if (hi - lo <= step) {
+      break;
+    }
+    if (!_critbit_is_set(a[hi - step], bit)) {
+      lo = hi - step;
+      break;
+    }
+    hi -= step;
+    step *= 2;
+  }
+
+  while (hi - lo > 1) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (_critbit_is_set(a[mid], bit)) {
+      hi = mid;
+    }
+    else {
+      lo = mid;
+    }
+  }
+  return hi;
+}
+
+/*
+ * Builds a subtree for a[lo..hi) and returns it. Recursion depth is limited
+ * by _CRITBIT_MAX_DEPTH.
+ */
+static inline uintptr_t _critbit_build_subtree(const struct critbit *const cb,
+    const uintptr_t *const a, const size_t lo, const size_t hi)
+{
+  assert(lo < hi);
+
+  if (hi - lo == 1) {
+    return a[lo];
+  }
+
+  /* a[lo] and a[hi - 1] differ at the smallest crit bit in the subtree. */
+  const uint8_t crit_bit = _critbit_get_crit_bit(a[lo], a[hi - 1]);
+  struct _critbit_node *const node = _critbit_alloc_node(cb->node_allocator);
+  const size_t split = _critbit_find_split(a, lo, hi, crit_bit);
+  node->next[0] = _critbit_build_subtree(cb, a, lo, split);
+  node->next[1] = _critbit_build_subtree(cb, a, split, hi);
+  _critbit_node_set_kinds(node, (split - lo > 1) | ((hi - split > 1) << 1));
+  _critbit_node_set_crit_bit(node, crit_bit);
+  _critbit_node_update_count(node);
+  return _critbit_add_tag(node, crit_bit);
+}
+
+static inline struct critbit *critbit_build_sorted(
+    const struct critbit_node_allocator *const node_allocator,
+    const uintptr_t *const a, const size_t n)
+{
+  for (size_t i = 0; i < n; ++i) {
+    assert(_critbit_is_valid_key(a[i]));
+    assert(i == 0 || a[i - 1] < a[i]);
+  }
+
+  struct critbit *const cb = critbit_create(node_allocator);
+  if (n > 0) {
+    _CRITBIT_SET_HAS_ROOT(cb, 1);
+    _critbit_slot_set(_CRITBIT_ROOT_SLOT(cb),
+        _critbit_build_subtree(cb, a, 0, n), n > 1);
+  }
+  return cb;
+}
+
+static inline void critbit_delete(struct critbit *const cb)
+{
+#if defined(CRITBIT_PERSISTENT)
+  /* Nodes may be shared with snapshots, so they can't be released at once. */
+  const int release_all_nodes = 0;
+#else
+  const int release_all_nodes = !cb->shares_node_allocator &&
+      (cb->node_allocator->release_all_nodes != NULL);
+#endif
+  if (release_all_nodes) {
+    cb->node_allocator->release_all_nodes(cb->node_allocator->ctx);
+  }
+  else if (!_CRITBIT_IS_EMPTY(cb, cb->root)) {
+    _critbit_remove_all_nodes(cb->node_allocator, cb->root,
+        _CRITBIT_ROOT_IS_NODE(cb, cb->root), 0);
+  }
+  free(cb);
+}
+
+/* The bodies of traced operations store the number of visited nodes. */
+static inline int _critbit_add(struct critbit *const cb, const uintptr_t v,
+    size_t *const visits)
+{
+  assert(_critbit_is_valid_key(v));
+  _CRITBIT_COUNT(cb, add_calls);
+
+  if (_CRITBIT_IS_EMPTY(cb, cb->root)) {
+    _CRITBIT_SET_HAS_ROOT(cb, 1);
+    _critbit_slot_set(_CRITBIT_ROOT_SLOT(cb), v, 0);
+    return 1;
+  }
+
+  struct _critbit_slot path[_CRITBIT_MAX_DEPTH + 1];
+  size_t depth = _critbit_get_leaf_path(cb, v, path);
+#if defined(CRITBIT_COUNTERS)
+  cb->counters.add_node_visits += depth;
+#endif
+  *visits = depth;
+  const uintptr_t leaf = *path[depth].v;
+  if (leaf == v) {
+    return 0;
+  }
+
+  /*
+   * Crit bits increase along the path, so the new node goes below the last
+   * node with a smaller crit bit. Scan the recorded path from the leaf up
+   * instead of descending from the root again: nodes near the leaf
+   * are still in the cache, and new crit bits are usually found there.
+   */
+  const uint8_t crit_bit = _critbit_get_crit_bit(leaf, v);
+  while (depth > 0 && _critbit_node_is_after(*path[depth - 1].v, crit_bit)) {
+    --depth;
+  }
+#if defined(CRITBIT_PERSISTENT)
+  if (depth > 0) {
+    const struct _critbit_slot parent = _critbit_own_path(cb, v,
+        *path[depth - 1].v);
+    path[depth] = _critbit_child_slot(_critbit_remove_tag(*parent.v),
+        _critbit_node_get_index(*parent.v, v));
+  }
+#endif
+  const struct _critbit_slot next = path[depth];
+  _critbit_slot_set(next, _critbit_create_node(cb, v, *next.v,
+      _critbit_slot_is_node(next), crit_bit), 1);
+  _critbit_add_path_counts(cb, v, next.v, 1);
+  return 1;
+}
+
+static inline int _critbit_remove(struct critbit *const cb,
+    const uintptr_t v, size_t *const visits)
+{
+  assert(_critbit_is_valid_key(v));
+  _CRITBIT_COUNT(cb, remove_calls);
+
+  if (_CRITBIT_IS_EMPTY(cb, cb->root)) {
+    return 0;
+  }
+
+  struct _critbit_slot prev = _CRITBIT_ROOT_SLOT(cb);
+  if (!_critbit_slot_is_node(prev)) {
+    if (cb->root == v) {
+      _critbit_store(&cb->root, 0);
+      _CRITBIT_SET_HAS_ROOT(cb, 0);
+      return 1;
+    }
+    return 0;
+  }
+
+  _CRITBIT_COUNT(cb, remove_node_visits);
+  ++*visits;
+  struct _critbit_slot next = _critbit_child_slot(_critbit_remove_tag(*prev.v),
+      _critbit_node_get_index(*prev.v, v));
+  while (_critbit_slot_is_node(next)) {
+    _CRITBIT_COUNT(cb, remove_node_visits);
+    ++*visits;
+    prev = next;
+    next = _critbit_child_slot(_critbit_remove_tag(*next.v),
+        _critbit_node_get_index(*next.v, v));
+  }
+  if (*next.v != v) {
+    return 0;
+  }
+#if defined(CRITBIT_PERSISTENT)
+  prev = _critbit_own_path(cb, v, *prev.v);
+#endif
+  _critbit_add_path_counts(cb, v, prev.v, (size_t)-1);
+  _critbit_delete_node(cb, prev, v);
+  return 1;
+}
+
+static inline int _critbit_contains(const struct critbit *const cb,
+    const uintptr_t v, size_t *const visits)
+{
+  assert(_critbit_is_valid_key(v));
+  _CRITBIT_COUNT(cb, contains_calls);
+
+  /*
+   * The same descent as in _critbit_get_leaf_path(), but each slot is loaded
+   * only once, so concurrent modifications can't be observed halfway.
+   */
+  uintptr_t next = _critbit_load(&cb->root);
+  if (_CRITBIT_IS_EMPTY(cb, next)) {
+    return 0;
+  }
+  int is_node = _CRITBIT_ROOT_IS_NODE(cb, next);
+  while (is_node) {
+    _CRITBIT_COUNT(cb, contains_node_visits);
+    ++*visits;
+    const struct _critbit_node *const node = _critbit_remove_tag(next);
+    const size_t index = _critbit_node_get_index(next, v);
+    next = _critbit_load(&node->next[index]);
+    is_node = _critbit_child_is_node(node, index, next);
+  }
+  return (next == v);
+}
+
+static inline int critbit_add(struct critbit *const cb, const uintptr_t v)
+{
+  const uint64_t start = _CRITBIT_TRACE_START(cb);
+  size_t visits = 0;
+  const int ok = _critbit_add(cb, v, &visits);
+  _CRITBIT_TRACE_END(cb, CRITBIT_TRACE_ADD, v, visits, start);
+  return ok;
+}
+
+static inline int critbit_remove(struct critbit *const cb, const uintptr_t v)
+{
+  const uint64_t start = _CRITBIT_TRACE_START(cb);
+  size_t visits = 0;
+  const int ok = _critbit_remove(cb, v, &visits);
+  _CRITBIT_TRACE_END(cb, CRITBIT_TRACE_REMOVE, v, visits, start);
+  return ok;
+}
+
+static inline int critbit_contains(const struct critbit *const cb,
+    const uintptr_t v)
+{
+  const uint64_t start = _CRITBIT_TRACE_START(cb);
+  size_t visits = 0;
+  const int found = _critbit_contains(cb, v, &visits);
+  _CRITBIT_TRACE_END(cb, CRITBIT_TRACE_CONTAINS, v, visits, start);
+  return found;
+}
+
+static inline void _critbit_visit(
+    const struct critbit_visitor *const visitor, uintptr_t v, int is_node)
+{
+  /* Nodes with right subtrees, which are waiting for a visit. */
+  const struct _critbit_node *stack[_CRITBIT_MAX_DEPTH];
+  size_t depth = 0;
+
+  for (;;) {
+    while (is_node) {
+      const struct _critbit_node *const node = _critbit_remove_tag(v);
+      assert(depth < _CRITBIT_MAX_DEPTH);
+      stack[depth++] = node;
+      v = _critbit_load(&node->next[0]);
+      is_node = _critbit_child_is_node(node, 0, v);
+    }
+    if (depth == 0) {
+      visitor->callback(visitor->ctx, v);
+      break;
+    }
+    /* Fetch the next subtree while the visitor processes the leaf. */
+    const struct _critbit_node *const node = stack[--depth];
+    const uintptr_t next = _critbit_load(&node->next[1]);
+    is_node = _critbit_child_is_node(node, 1, next);
+    if (is_node) {
+      _critbit_prefetch_node(next);
+    }
+    visitor->callback(visitor->ctx, v);
+    v = next;
+  }
+}
+
+static inline void critbit_foreach(const struct critbit *const cb,
+    const struct critbit_visitor *const visitor)
+{
+  const uintptr_t root = _critbit_load(&cb->root);
+  if (!_CRITBIT_IS_EMPTY(cb, root)) {
+    _critbit_visit(visitor, root, _CRITBIT_ROOT_IS_NODE(cb, root));
+  }
+}
+
+/* The number of keys, which are looked up simultaneously by batch functions. */
+#define _CRITBIT_BATCH_SIZE 16
+
+/*
+ * Finds leaves for n <= _CRITBIT_BATCH_SIZE keys at once. Descends one level
+ * for each key in turn and prefetches the next node for each key, so memory
+ * loads for all the keys are in flight simultaneously.
+ */
+static inline void _critbit_get_leaves(const uintptr_t root,
+    const int root_is_node, const uintptr_t *const keys, const size_t n,
+    uintptr_t *const leaves)
+{
+  assert(n <= _CRITBIT_BATCH_SIZE);
+
+  /* Bit i is set while leaves[i] is a node. */
+  uint32_t pending = 0;
+  for (size_t i = 0; i < n; ++i) {
+    assert(_critbit_is_valid_key(keys[i]));
+    leaves[i] = root;
+    if (root_is_node) {
+      pending |= ((uint32_t)1) << i;
+    }
+  }
+
+  while (pending != 0) {
+    for (size_t i = 0; i < n; ++i) {
+      if (!((pending >> i) & 1)) {
+        continue;
+      }
+      const uintptr_t tagged_node = leaves[i];
+      const struct _critbit_node *const node = _critbit_remove_tag(tagged_node);
+      const size_t index = _critbit_node_get_index(tagged_node, keys[i]);
+      const uintptr_t next = _critbit_load(&node->next[index]);
+      if (_critbit_child_is_node(node, index, next)) {
+        _critbit_prefetch_node(next);
+      }
+      else {
+        pending &= ~(((uint32_t)1) << i);
+      }
+      leaves[i] = next;
+    }
+  }
+}
+
+static inline void critbit_contains_batch(const struct critbit *const cb,
+    const uintptr_t *const keys, const size_t n, int *const out)
+{
+  const uintptr_t root = _critbit_load(&cb->root);
+  if (_CRITBIT_IS_EMPTY(cb, root)) {
+    for (size_t i = 0; i < n; ++i) {
+      out[i] = 0;
+    }
+    return;
+  }
+
+  const int root_is_node = _CRITBIT_ROOT_IS_NODE(cb, root);
+  uintptr_t leaves[_CRITBIT_BATCH_SIZE];
+  for (size_t i = 0; i < n; i += _CRITBIT_BATCH_SIZE) {
+    const size_t m = (n - i < _CRITBIT_BATCH_SIZE) ?
+        (n - i) : _CRITBIT_BATCH_SIZE;
+    _critbit_get_leaves(root, root_is_node, keys + i, m, leaves);
+    for (size_t j = 0; j < m; ++j) {
+      out[i + j] = (leaves[j] == keys[i + j]);
+    }
+  }
+}
+
+/*
+ * Adds v given the leaf nearest to v, which was found before other keys
+ * were added, e.g. by _critbit_get_leaves(). v must differ from the leaf.
+ * Descends from the root only to the place of the new node.
+ * Returns 0 without adding v if keys added since then share a longer prefix
+ * with v than the leaf, i.e. there is a node with the crit bit of v and
+ * the leaf on the path to v.
+ */
+static inline int _critbit_add_near_leaf(struct critbit *const cb,
+    const uintptr_t v, const uintptr_t leaf, size_t *const visits)
+{
+  assert(leaf != v);
+
+  const uint8_t crit_bit = _critbit_get_crit_bit(leaf, v);
+  uintptr_t parent = 0;
+  struct _critbit_slot next = _CRITBIT_ROOT_SLOT(cb);
+  while (_critbit_slot_is_node(next)) {
+    const uintptr_t tagged_node = *next.v;
+    if (_critbit_node_is_after(tagged_node, crit_bit)) {
+      break;
+    }
+    if (_critbit_node_get_crit_bit(tagged_node) == crit_bit) {
+      return 0;
+    }
+    _CRITBIT_COUNT(cb, add_node_visits);
+    ++*visits;
+    parent = tagged_node;
+    next = _critbit_child_slot(_critbit_remove_tag(tagged_node),
+        _critbit_node_get_index(tagged_node, v));
+  }
+#if defined(CRITBIT_PERSISTENT)
+  if (parent != 0) {
+    const struct _critbit_slot slot = _critbit_own_path(cb, v, parent);
+    next = _critbit_child_slot(_critbit_remove_tag(*slot.v),
+        _critbit_node_get_index(*slot.v, v));
+  }
+#else
+  (void)parent;
+#endif
+  _critbit_slot_set(next, _critbit_create_node(cb, v, *next.v,
+      _critbit_slot_is_node(next), crit_bit), 1);
+  _critbit_add_path_counts(cb, v, next.v, 1);
+  return 1;
+}
+
+#if !defined(CRITBIT_PERSISTENT)
+/* The number of the deepest path slots kept for each key of a batch. */
+#define _CRITBIT_BATCH_PATH_SIZE 4
+
+/*
+ * The tail of the path to the leaf found for a key by _critbit_get_paths().
+ * Slots and their values at the time of the descent are stored in a ring
+ * indexed by the depth of the slot.
+ */
+struct _critbit_batch_path
+{
+  size_t depth;
+  struct _critbit_slot slots[_CRITBIT_BATCH_PATH_SIZE];
+  uintptr_t values[_CRITBIT_BATCH_PATH_SIZE];
+};
+
+/* The same as _critbit_get_leaves(), but keeps tails of the paths. */
+static inline void _critbit_get_paths(const struct critbit *const cb,
+    const uintptr_t *const keys, const size_t n,
+    struct _critbit_batch_path *const paths)
+{
+  assert(n <= _CRITBIT_BATCH_SIZE);
+
+  /* Bit i is set while the path i ends at a node. */
+  uint32_t pending = 0;
+  const struct _critbit_slot root = _CRITBIT_ROOT_SLOT(cb);
+  for (size_t i = 0; i < n; ++i) {
+    assert(_critbit_is_valid_key(keys[i]));
+    paths[i].depth = 0;
+    paths[i].slots[0] = root;
+    paths[i].values[0] = *root.v;
+    if (_critbit_slot_is_node(root)) {
+      pending |= ((uint32_t)1) << i;
+    }
+  }
+
+  while (pending != 0) {
+    for (size_t i = 0; i < n; ++i) {
+      if (!((pending >> i) & 1)) {
+        continue;
+      }
+      struct _critbit_batch_path *const p = &paths[i];
+      const uintptr_t tagged_node =
+          p->values[p->depth % _CRITBIT_BATCH_PATH_SIZE];
+      const struct _critbit_slot next = _critbit_child_slot(
+          _critbit_remove_tag(tagged_node),
+          _critbit_node_get_index(tagged_node, keys[i]));
+      const uintptr_t v = _critbit_load(next.v);
+      assert(p->depth < _CRITBIT_MAX_DEPTH);
+      ++p->depth;
+      p->slots[p->depth % _CRITBIT_BATCH_PATH_SIZE] = next;
+      p->values[p->depth % _CRITBIT_BATCH_PATH_SIZE] = v;
+      if (_critbit_slot_is_node(next)) {
+        _critbit_prefetch_node(v);
+      }
+      else {
+        pending &= ~(((uint32_t)1) << i);
+      }
+    }
+  }
+}
+
+/*
+ * Adds v given the tail of the path, which was found before other keys
+ * were added. Scans the tail from the leaf up like critbit_add() does,
+ * so the new node is usually linked without descending again. Slots
+ * changed by the added keys, or a new node above the tail, make it fall
+ * back to _critbit_add_near_leaf(). Returns 0 without adding v like
+ * _critbit_add_near_leaf() does.
+ */
+static inline int _critbit_add_near_path(struct critbit *const cb,
+    const uintptr_t v, const struct _critbit_batch_path *const p,
+    size_t *const visits)
+{
+  size_t depth = p->depth;
+  const uintptr_t leaf = p->values[depth % _CRITBIT_BATCH_PATH_SIZE];
+  assert(leaf != v);
+
+  const struct _critbit_slot leaf_slot =
+      p->slots[depth % _CRITBIT_BATCH_PATH_SIZE];
+  if (*leaf_slot.v != leaf || _critbit_slot_is_node(leaf_slot)) {
+    return _critbit_add_near_leaf(cb, v, leaf, visits);
+  }
+
+  const uint8_t crit_bit = _critbit_get_crit_bit(leaf, v);
+  const size_t top = (depth >= _CRITBIT_BATCH_PATH_SIZE - 1) ?
+      depth - (_CRITBIT_BATCH_PATH_SIZE - 1) : 0;
+  for (;;) {
+    if (depth == top) {
+      if (top > 0) {
+        return _critbit_add_near_leaf(cb, v, leaf, visits);
+      }
+      break;
+    }
+    const size_t i = (depth - 1) % _CRITBIT_BATCH_PATH_SIZE;
+    const uintptr_t tagged_node = p->values[i];
+    if (*p->slots[i].v != tagged_node) {
+      return _critbit_add_near_leaf(cb, v, leaf, visits);
+    }
+    _CRITBIT_COUNT(cb, add_node_visits);
+    if (!_critbit_node_is_after(tagged_node, crit_bit)) {
+      if (_critbit_node_get_crit_bit(tagged_node) == crit_bit) {
+        return 0;
+      }
+      break;
+    }
+    --depth;
+  }
+
+  *visits = p->depth;
+  const struct _critbit_slot next = p->slots[depth % _CRITBIT_BATCH_PATH_SIZE];
+  _critbit_slot_set(next, _critbit_create_node(cb, v, *next.v,
+      _critbit_slot_is_node(next), crit_bit), 1);
+  _critbit_add_path_counts(cb, v, next.v, 1);
+  return 1;
+}
+#endif
+
+/*
+ * Nodes on the paths may be copied by critbit_add() if CRITBIT_PERSISTENT
+ * is defined, so only leaves are kept for the keys then.
+ */
+static inline size_t critbit_add_batch(struct critbit *const cb,
+    const uintptr_t *const keys, const size_t n)
+{
+#if defined(CRITBIT_PERSISTENT)
+  uintptr_t leaves[_CRITBIT_BATCH_SIZE];
+#else
+  struct _critbit_batch_path paths[_CRITBIT_BATCH_SIZE];
+#endif
+  size_t added = 0;
+  for (size_t i = 0; i < n; i += _CRITBIT_BATCH_SIZE) {
+    const size_t m = (n - i < _CRITBIT_BATCH_SIZE) ?
+        (n - i) : _CRITBIT_BATCH_SIZE;
+    if (_CRITBIT_IS_EMPTY(cb, cb->root)) {
+      for (size_t j = 0; j < m; ++j) {
+        added += critbit_add(cb, keys[i + j]);
+      }
+      continue;
+    }
+
+    /* Items are only added below, so found leaves stay in the crit-bit. */
+#if defined(CRITBIT_PERSISTENT)
+    _critbit_get_leaves(cb->root, _CRITBIT_ROOT_IS_NODE(cb, cb->root),
+        keys + i, m, leaves);
+#else
+    _critbit_get_paths(cb, keys + i, m, paths);
+#endif
+    for (size_t j = 0; j < m; ++j) {
+      const uintptr_t v = keys[i + j];
+#if defined(CRITBIT_PERSISTENT)
+      const uintptr_t leaf = leaves[j];
+#else
+      const uintptr_t leaf =
+          paths[j].values[paths[j].depth % _CRITBIT_BATCH_PATH_SIZE];
+#endif
+      if (leaf == v) {
+        _CRITBIT_COUNT(cb, add_calls);
+        continue;
+      }
+      const uint64_t start = _CRITBIT_TRACE_START(cb);
+      size_t visits = 0;
+#if defined(CRITBIT_PERSISTENT)
+      const int ok = _critbit_add_near_leaf(cb, v, leaf, &visits);
+#else
+      const int ok = _critbit_add_near_path(cb, v, &paths[j], &visits);
+#endif
+      if (ok) {
+        _CRITBIT_COUNT(cb, add_calls);
+        _CRITBIT_TRACE_END(cb, CRITBIT_TRACE_ADD, v, visits, start);
+        ++added;
+      }
+      else {
+        added += critbit_add(cb, v);
+      }
+    }
+  }
+  return added;
+}
+
+/*
+ * Returns the crit bit of the subtree v. Leaves are treated as subtrees
+ * with the crit bit following the last key bit.
+ */
+static inline uint8_t _critbit_subtree_get_crit_bit(const uintptr_t v,
+    const int is_node)
+{
+  return (is_node ? _critbit_node_get_crit_bit(v) : _CRITBIT_PTR_BITS);
+}
+
+/*
+ * Returns the leftmost (index = 0) or the rightmost (index = 1) leaf
+ * of the subtree v. Bits above the crit bit of the subtree are the same
+ * for all its leaves.
+ */
+static inline uintptr_t _critbit_subtree_get_leaf(uintptr_t v, int is_node,
+    const size_t index)
+{
+  while (is_node) {
+    const struct _critbit_node *const node = _critbit_remove_tag(v);
+    v = node->next[index];
+    is_node = _critbit_child_is_node(node, index, v);
+  }
+  return v;
+}
+
+/*
+ * Returns the first bit, where leaves of subtrees a and b differ.
+ * If it goes before crit bits of both subtrees, then the subtrees
+ * don't overlap.
+ */
+static inline uint8_t _critbit_subtrees_get_crit_bit(const uintptr_t a,
+    const int a_is_node, const uintptr_t b, const int b_is_node)
+{
+  const uintptr_t leaf_a = _critbit_subtree_get_leaf(a, a_is_node, 0);
+  const uintptr_t leaf_b = _critbit_subtree_get_leaf(b, b_is_node, 0);
+  if (leaf_a == leaf_b) {
+    return _CRITBIT_PTR_BITS;
+  }
+  return _critbit_get_crit_bit(leaf_a, leaf_b);
+}
+
+/*
+ * Creates a node with the subtree v1 at the given index and the subtree v2
+ * at the opposite index.
+ */
+static inline uintptr_t _critbit_join_subtrees(const struct critbit *const cb,
+    const uintptr_t v1, const int v1_is_node, const size_t index,
+    const uintptr_t v2, const int v2_is_node, const uint8_t crit_bit)
+{
+  struct _critbit_node *const node = _critbit_alloc_node(cb->node_allocator);
+  node->next[index] = v1;
+  node->next[index ^ 1] = v2;
+  _critbit_node_set_kinds(node, ((unsigned)v1_is_node << index) |
+      ((unsigned)v2_is_node << (index ^ 1)));
+  _critbit_node_set_crit_bit(node, crit_bit);
+  _critbit_node_update_count(node);
+  return _critbit_add_tag(node, crit_bit);
+}
+
+/*
+ * Merges the subtree b into the subtree referred by the slot. Nodes of b
+ * are either adopted or released. Recursion depth is limited
+ * by 2 * _CRITBIT_MAX_DEPTH, since each step descends in a or in b.
+ */
+static inline void _critbit_union(const struct critbit *const cb,
+    const struct _critbit_slot slot, const uintptr_t b, const int b_is_node)
+{
+  const uintptr_t a = *slot.v;
+  const int a_is_node = _critbit_slot_is_node(slot);
+  const uint8_t crit_bit_a = _critbit_subtree_get_crit_bit(a, a_is_node);
+  const uint8_t crit_bit_b = _critbit_subtree_get_crit_bit(b, b_is_node);
+  const uint8_t crit_bit = _critbit_subtrees_get_crit_bit(a, a_is_node,
+      b, b_is_node);
+
+  if (crit_bit < crit_bit_a && crit_bit < crit_bit_b) {
+    /* The subtrees don't overlap, so b is adopted as a whole. */
+    const size_t index = _critbit_get_index(
+        _critbit_subtree_get_leaf(a, a_is_node, 0), crit_bit);
+    _critbit_slot_set(slot, _critbit_join_subtrees(cb, a, a_is_node, index,
+        b, b_is_node, crit_bit), 1);
+    return;
+  }
+
+  if (crit_bit_a == crit_bit_b) {
+    if (!a_is_node) {
+      /* Both subtrees are the same key. */
+      return;
+    }
+    struct _critbit_node *const node_a = _critbit_own_slot(cb, slot);
+    struct _critbit_node *const node_b = _critbit_remove_tag(
+        _critbit_take_node(cb->node_allocator, b));
+    for (size_t i = 0; i < 2; ++i) {
+      const uintptr_t child = node_b->next[i];
+      _critbit_union(cb, _critbit_child_slot(node_a, i), child,
+          _critbit_child_is_node(node_b, i, child));
+    }
+    _critbit_node_update_count(node_a);
+    _critbit_release_node(cb->node_allocator, node_b);
+    return;
+  }
+
+  if (crit_bit_a < crit_bit_b) {
+    struct _critbit_node *const node_a = _critbit_own_slot(cb, slot);
+    const size_t index = _critbit_node_get_index(a,
+        _critbit_subtree_get_leaf(b, b_is_node, 0));
+    _critbit_union(cb, _critbit_child_slot(node_a, index), b, b_is_node);
+    _critbit_node_update_count(node_a);
+    return;
+  }
+
+  /* b splits higher, so a is merged into b, which replaces a. */
+  const uintptr_t tagged_b = _critbit_take_node(cb->node_allocator, b);
+  struct _critbit_node *const node_b = _critbit_remove_tag(tagged_b);
+  const size_t index = _critbit_node_get_index(b,
+      _critbit_subtree_get_leaf(a, a_is_node, 0));
+  _critbit_union(cb, _critbit_child_slot(node_b, index), a, a_is_node);
+  _critbit_node_update_count(node_b);
+  _critbit_slot_set(slot, tagged_b, 1);
+}
+
+/*
+ * Replaces the node referred by the slot with its only non-empty child
+ * and releases the node. Only updates the node if both children are
+ * non-empty.
+ * Returns 0 if both children are empty, i.e. the slot became empty.
+ */
+static inline int _critbit_collapse_node(const struct critbit *const cb,
+    const struct _critbit_slot slot, const int is_left_empty,
+    const int is_right_empty)
+{
+  struct _critbit_node *const node = _critbit_remove_tag(*slot.v);
+  if (!is_left_empty && !is_right_empty) {
+    _critbit_node_update_count(node);
+    return 1;
+  }
+  if (is_left_empty != is_right_empty) {
+    const size_t index = (size_t)is_left_empty;
+    const uintptr_t child = node->next[index];
+    _critbit_slot_set(slot, child, _critbit_child_is_node(node, index, child));
+  }
+  _critbit_release_node(cb->node_allocator, node);
+  return (is_left_empty != is_right_empty);
+}
+
+/*
+ * Removes items missing in the subtree b from the subtree referred
+ * by the slot. Returns 0 if the slot became empty.
+ */
+static inline int _critbit_intersect(const struct critbit *const cb,
+    const struct _critbit_slot slot, const uintptr_t b, const int b_is_node)
+{
+  const uintptr_t a = *slot.v;
+  const int a_is_node = _critbit_slot_is_node(slot);
+  const uint8_t crit_bit_a = _critbit_subtree_get_crit_bit(a, a_is_node);
+  const uint8_t crit_bit_b = _critbit_subtree_get_crit_bit(b, b_is_node);
+  const uint8_t crit_bit = _critbit_subtrees_get_crit_bit(a, a_is_node,
+      b, b_is_node);
+
+  if (crit_bit < crit_bit_a && crit_bit < crit_bit_b) {
+    _critbit_remove_all_nodes(cb->node_allocator, a, a_is_node, 1);
+    return 0;
+  }
+
+  if (crit_bit_a == crit_bit_b) {
+    if (!a_is_node) {
+      return 1;
+    }
+    const struct _critbit_node *const node_a = _critbit_own_slot(cb, slot);
+    const struct _critbit_node *const node_b = _critbit_remove_tag(b);
+    int is_empty[2];
+    for (size_t i = 0; i < 2; ++i) {
+      const uintptr_t child = node_b->next[i];
+      is_empty[i] = !_critbit_intersect(cb, _critbit_child_slot(node_a, i),
+          child, _critbit_child_is_node(node_b, i, child));
+    }
+    return _critbit_collapse_node(cb, slot, is_empty[0], is_empty[1]);
+  }
+
+  if (crit_bit_a < crit_bit_b) {
+    /* b overlaps with a single child of a, so the other child goes away. */
+    const struct _critbit_node *const node_a = _critbit_own_slot(cb, slot);
+    const size_t index = _critbit_node_get_index(a,
+        _critbit_subtree_get_leaf(b, b_is_node, 0));
+    const uintptr_t other = node_a->next[index ^ 1];
+    _critbit_remove_all_nodes(cb->node_allocator, other,
+        _critbit_child_is_node(node_a, index ^ 1, other), 1);
+    const int is_empty = !_critbit_intersect(cb,
+        _critbit_child_slot(node_a, index), b, b_is_node);
+    return _critbit_collapse_node(cb, slot, index == 1 || is_empty,
+        index == 0 || is_empty);
+  }
+
+  const struct _critbit_node *const node_b = _critbit_remove_tag(b);
+  const size_t index = _critbit_node_get_index(b,
+      _critbit_subtree_get_leaf(a, a_is_node, 0));
+  const uintptr_t child = node_b->next[index];
+  return _critbit_intersect(cb, slot, child,
+      _critbit_child_is_node(node_b, index, child));
+}
+
+/*
+ * Removes items existing in the subtree b from the subtree referred
+ * by the slot. Returns 0 if the slot became empty.
+ */
+static inline int _critbit_difference(const struct critbit *const cb,
+    const struct _critbit_slot slot, const uintptr_t b, const int b_is_node)
+{
+  const uintptr_t a = *slot.v;
+  const int a_is_node = _critbit_slot_is_node(slot);
+  const uint8_t crit_bit_a = _critbit_subtree_get_crit_bit(a, a_is_node);
+  const uint8_t crit_bit_b = _critbit_subtree_get_crit_bit(b, b_is_node);
+  const uint8_t crit_bit = _critbit_subtrees_get_crit_bit(a, a_is_node,
+      b, b_is_node);
+
+  if (crit_bit < crit_bit_a && crit_bit < crit_bit_b) {
+    return 1;
+  }
+
+  if (crit_bit_a == crit_bit_b) {
+    if (!a_is_node) {
+      return 0;
+    }
+    const struct _critbit_node *const node_a = _critbit_own_slot(cb, slot);
+    const struct _critbit_node *const node_b = _critbit_remove_tag(b);
+    int is_empty[2];
+    for (size_t i = 0; i < 2; ++i) {
+      const uintptr_t child = node_b->next[i];
+      is_empty[i] = !_critbit_difference(cb, _critbit_child_slot(node_a, i),
+          child, _critbit_child_is_node(node_b, i, child));
+    }
+    return _critbit_collapse_node(cb, slot, is_empty[0], is_empty[1]);
+  }
+
+  if (crit_bit_a < crit_bit_b) {
+    const struct _critbit_node *const node_a = _critbit_own_slot(cb, slot);
+    const size_t index = _critbit_node_get_index(a,
+        _critbit_subtree_get_leaf(b, b_is_node, 0));
+    const int is_empty = !_critbit_difference(cb,
+        _critbit_child_slot(node_a, index), b, b_is_node);
+    return _critbit_collapse_node(cb, slot, index == 0 && is_empty,
+        index == 1 && is_empty);
+  }
+
+  const struct _critbit_node *const node_b = _critbit_remove_tag(b);
+  const size_t index = _critbit_node_get_index(b,
+      _critbit_subtree_get_leaf(a, a_is_node, 0));
+  const uintptr_t child = node_b->next[index];
+  return _critbit_difference(cb, slot, child,
+      _critbit_child_is_node(node_b, index, child));
+}
+
+static inline void critbit_union(struct critbit *const dst,
+    struct critbit *const src)
+{
+  assert(dst != src);
+  assert(dst->node_allocator == src->node_allocator);
+
+  dst->shares_node_allocator = 1;
+  src->shares_node_allocator = 1;
+  if (_CRITBIT_IS_EMPTY(src, src->root)) {
+    return;
+  }
+  const int is_node = _CRITBIT_ROOT_IS_NODE(src, src->root);
+  if (_CRITBIT_IS_EMPTY(dst, dst->root)) {
+    _CRITBIT_SET_HAS_ROOT(dst, 1);
+    _critbit_slot_set(_CRITBIT_ROOT_SLOT(dst), src->root, is_node);
+  }
+  else {
+    _critbit_union(dst, _CRITBIT_ROOT_SLOT(dst), src->root, is_node);
+  }
+  _critbit_store(&src->root, 0);
+  _CRITBIT_SET_HAS_ROOT(src, 0);
+}
+
+static inline void critbit_intersect(struct critbit *const dst,
+    const struct critbit *const src)
+{
+  assert(dst != src);
+
+  if (_CRITBIT_IS_EMPTY(dst, dst->root)) {
+    return;
+  }
+  if (_CRITBIT_IS_EMPTY(src, src->root)) {
+    _critbit_remove_all_nodes(dst->node_allocator, dst->root,
+        _CRITBIT_ROOT_IS_NODE(dst, dst->root), 1);
+  }
+  else if (_critbit_intersect(dst, _CRITBIT_ROOT_SLOT(dst), src->root,
+        _CRITBIT_ROOT_IS_NODE(src, src->root))) {
+    return;
+  }
+  _critbit_store(&dst->root, 0);
+  _CRITBIT_SET_HAS_ROOT(dst, 0);
+}
+
+static inline void critbit_difference(struct critbit *const dst,
+    const struct critbit *const src)
+{
+  assert(dst != src);
+
+  if (_CRITBIT_IS_EMPTY(dst, dst->root) ||
+      _CRITBIT_IS_EMPTY(src, src->root)) {
+    return;
+  }
+  if (!_critbit_difference(dst, _CRITBIT_ROOT_SLOT(dst), src->root,
+        _CRITBIT_ROOT_IS_NODE(src, src->root))) {
+    _critbit_store(&dst->root, 0);
+    _CRITBIT_SET_HAS_ROOT(dst, 0);
+  }
+}
+
+static inline struct critbit *critbit_split_at(struct critbit *const cb,
+    const uintptr_t v)
+{
+  assert(_critbit_is_valid_key(v));
+
+  struct critbit *const right = critbit_create(cb->node_allocator);
+  right->shares_node_allocator = 1;
+  cb->shares_node_allocator = 1;
+  if (_CRITBIT_IS_EMPTY(cb, cb->root)) {
+    return right;
+  }
+
+  struct _critbit_slot path[_CRITBIT_MAX_DEPTH + 1];
+  size_t depth = _critbit_get_leaf_path(cb, v, path);
+  const uintptr_t leaf = *path[depth].v;
+
+  /*
+   * Subtrees below the crit bit of the leaf and v don't contain v's prefix,
+   * so such a subtree goes to a single half as a whole. The other nodes
+   * on the path lead to both halves.
+   */
+  if (leaf != v) {
+    const uint8_t crit_bit = _critbit_get_crit_bit(leaf, v);
+    while (depth > 0 &&
+        _critbit_node_is_after(*path[depth - 1].v, crit_bit)) {
+      --depth;
+    }
+  }
+#if defined(CRITBIT_PERSISTENT)
+  if (depth > 0) {
+    _critbit_own_path(cb, v, *path[depth - 1].v);
+    for (size_t i = 0; i < depth; ++i) {
+      path[i + 1] = _critbit_child_slot(_critbit_remove_tag(*path[i].v),
+          _critbit_node_get_index(*path[i].v, v));
+    }
+  }
+#endif
+
+  /* Subtrees with items less than v (index 0) and not less than v. */
+  uintptr_t parts[2];
+  int part_is_node[2];
+  int has_part[2] = {0, 0};
+  const size_t side = (leaf < v) ? 0 : 1;
+  parts[side] = *path[depth].v;
+  part_is_node[side] = _critbit_slot_is_node(path[depth]);
+  has_part[side] = 1;
+
+  /*
+   * Go up the path. The child of each node, which doesn't lead to v, belongs
+   * to a single half, so the node joins it with that half.
+   */
+  while (depth > 0) {
+    --depth;
+    const uintptr_t tagged_node = *path[depth].v;
+    struct _critbit_node *const node = _critbit_remove_tag(tagged_node);
+    const size_t index = _critbit_node_get_index(tagged_node, v);
+    const size_t other = index ^ 1;
+    if (has_part[other]) {
+      _critbit_slot_set(_critbit_child_slot(node, index), parts[other],
+          part_is_node[other]);
+      _critbit_node_update_count(node);
+      parts[other] = tagged_node;
+      part_is_node[other] = 1;
+    }
+    else {
+      parts[other] = node->next[other];
+      part_is_node[other] = _critbit_child_is_node(node, other,
+          parts[other]);
+      has_part[other] = 1;
+      _critbit_release_node(cb->node_allocator, node);
+    }
+  }
+
+  if (has_part[0]) {
+    _critbit_slot_set(_CRITBIT_ROOT_SLOT(cb), parts[0], part_is_node[0]);
+  }
+  else {
+    _critbit_store(&cb->root, 0);
+    _CRITBIT_SET_HAS_ROOT(cb, 0);
+  }
+  if (has_part[1]) {
+    _CRITBIT_SET_HAS_ROOT(right, 1);
+    _critbit_slot_set(_CRITBIT_ROOT_SLOT(right), parts[1], part_is_node[1]);
+  }
+  return right;
+}
+
+static inline void critbit_join(struct critbit *const dst,
+    struct critbit *const src)
+{
+  assert(dst != src);
+  assert(dst->node_allocator == src->node_allocator);
+
+  dst->shares_node_allocator = 1;
+  src->shares_node_allocator = 1;
+  if (_CRITBIT_IS_EMPTY(dst, dst->root) ||
+      _CRITBIT_IS_EMPTY(src, src->root)) {
+    critbit_union(dst, src);
+    return;
+  }
+
+  /* The lower and the upper subtrees. */
+  uintptr_t lo = dst->root;
+  int lo_is_node = _CRITBIT_ROOT_IS_NODE(dst, lo);
+  uintptr_t hi = src->root;
+  int hi_is_node = _CRITBIT_ROOT_IS_NODE(src, hi);
+  if (_critbit_subtree_get_leaf(hi, hi_is_node, 0) <
+      _critbit_subtree_get_leaf(lo, lo_is_node, 0)) {
+    const uintptr_t v = lo;
+    const int is_node = lo_is_node;
+    lo = hi;
+    lo_is_node = hi_is_node;
+    hi = v;
+    hi_is_node = is_node;
+  }
+  const uintptr_t lo_max = _critbit_subtree_get_leaf(lo, lo_is_node, 1);
+  const uintptr_t hi_min = _critbit_subtree_get_leaf(hi, hi_is_node, 0);
+  assert(lo_max < hi_min);
+
+  /*
+   * The adjacent items differ at the crit bit of the new node. Nodes above it
+   * are on the right path of lo and on the left path of hi. They are merged
+   * by crit bits, while the rest of both crit-bits remains intact.
+   */
+  const uint8_t crit_bit = _critbit_get_crit_bit(lo_max, hi_min);
+  struct _critbit_slot slot = _CRITBIT_ROOT_SLOT(dst);
+  struct _critbit_node *path[_CRITBIT_MAX_DEPTH];
+  size_t depth = 0;
+  for (;;) {
+    const uint8_t crit_bit_lo = _critbit_subtree_get_crit_bit(lo, lo_is_node);
+    const uint8_t crit_bit_hi = _critbit_subtree_get_crit_bit(hi, hi_is_node);
+    size_t index;
+    if (crit_bit_lo < crit_bit && crit_bit_lo < crit_bit_hi) {
+      /* hi goes to the right subtree of lo. */
+      _critbit_slot_set(slot, lo, 1);
+      index = 1;
+    }
+    else if (crit_bit_hi < crit_bit) {
+      /* lo goes to the left subtree of hi. */
+      _critbit_slot_set(slot, hi, 1);
+      index = 0;
+    }
+    else {
+      break;
+    }
+    struct _critbit_node *const node = _critbit_own_slot(dst, slot);
+    assert(depth < _CRITBIT_MAX_DEPTH);
+    path[depth++] = node;
+    slot = _critbit_child_slot(node, index);
+    if (index == 1) {
+      lo = *slot.v;
+      lo_is_node = _critbit_slot_is_node(slot);
+    }
+    else {
+      hi = *slot.v;
+      hi_is_node = _critbit_slot_is_node(slot);
+    }
+  }
+  _critbit_slot_set(slot, _critbit_join_subtrees(dst, lo, lo_is_node, 0,
+      hi, hi_is_node, crit_bit), 1);
+  while (depth > 0) {
+    _critbit_node_update_count(path[--depth]);
+  }
+
+  _critbit_store(&src->root, 0);
+  _CRITBIT_SET_HAS_ROOT(src, 0);
+}
+
+/*
+ * The number of top tree levels laid out in breadth-first order
+ * by critbit_compact(). 127 nodes fit a 4KB page.
+ */
+#define _CRITBIT_COMPACT_BFS_LEVELS 7
+
+/* Returns a copy of the given node, which refers to the same children. */
+static inline uintptr_t _critbit_copy_node(
+    const struct critbit_node_allocator *const a, const uintptr_t tagged_node)
+{
+  struct _critbit_node *const copy = _critbit_alloc_node(a);
+  *copy = *_critbit_remove_tag(tagged_node);
+#if defined(CRITBIT_PERSISTENT)
+  copy->refs = 1;
+#endif
+  return _critbit_add_tag(copy, _critbit_node_get_crit_bit(tagged_node));
+}
+
+/* Copies the subtree of the given node in depth-first order. */
+static inline uintptr_t _critbit_copy_subtree(
+    const struct critbit_node_allocator *const a, const uintptr_t tagged_node)
+{
+  const uintptr_t copy = _critbit_copy_node(a, tagged_node);
+  struct _critbit_node *const node = _critbit_remove_tag(copy);
+  for (size_t i = 0; i < 2; ++i) {
+    const uintptr_t child = node->next[i];
+    if (_critbit_child_is_node(node, i, child)) {
+      node->next[i] = _critbit_copy_subtree(a, child);
+    }
+  }
+  return copy;
+}
+
+struct _critbit_compact_item
+{
+  /* The original node. */
+  uintptr_t v;
+
+  /* The slot in the parent copy, which must refer to the node copy. */
+  uintptr_t *slot;
+};
+
+static inline void critbit_compact(struct critbit *const cb,
+    const struct critbit_node_allocator *const new_allocator)
+{
+  const struct critbit_node_allocator *const old_allocator =
+      cb->node_allocator;
+  const uintptr_t root = cb->root;
+  cb->node_allocator = new_allocator;
+  cb->shares_node_allocator = 0;
+  if (_CRITBIT_IS_EMPTY(cb, root) || !_CRITBIT_ROOT_IS_NODE(cb, root)) {
+    return;
+  }
+
+  /* Copy the top levels level by level. */
+  struct _critbit_compact_item items[1 << _CRITBIT_COMPACT_BFS_LEVELS];
+  struct _critbit_compact_item subtrees[1 << _CRITBIT_COMPACT_BFS_LEVELS];
+  size_t items_count = 1;
+  size_t subtrees_count = 0;
+  uintptr_t new_root;
+  items[0].v = root;
+  items[0].slot = &new_root;
+  size_t level_start = 0;
+  for (size_t level = 0; level < _CRITBIT_COMPACT_BFS_LEVELS; ++level) {
+    const size_t level_end = items_count;
+    for (size_t i = level_start; i < level_end; ++i) {
+      const uintptr_t copy = _critbit_copy_node(new_allocator, items[i].v);
+      *items[i].slot = copy;
+      struct _critbit_node *const node = _critbit_remove_tag(copy);
+      for (size_t j = 0; j < 2; ++j) {
+        if (!_critbit_child_is_node(node, j, node->next[j])) {
+          continue;
+        }
+        struct _critbit_compact_item *const item =
+            (level + 1 < _CRITBIT_COMPACT_BFS_LEVELS) ?
+            &items[items_count++] : &subtrees[subtrees_count++];
+        item->v = node->next[j];
+        item->slot = &node->next[j];
+      }
+    }
+    level_start = level_end;
+  }
+
+  /* Copy the remaining subtrees one after another. */
+  for (size_t i = 0; i < subtrees_count; ++i) {
+    *subtrees[i].slot = _critbit_copy_subtree(new_allocator, subtrees[i].v);
+  }
+  _critbit_slot_set(_CRITBIT_ROOT_SLOT(cb), new_root, 1);
+
+  /*
+   * Old nodes are released one by one, since the old allocator may serve
+   * other crit-bits. Concurrent readers may still traverse them, so they
+   * are retired if possible.
+   */
+  _critbit_remove_all_nodes(old_allocator, root, 1, 1);
+}
+
+#if defined(CRITBIT_PERSISTENT)
+static inline struct critbit *critbit_snapshot(const struct critbit *const cb)
+{
+  struct critbit *const snapshot = critbit_create(cb->node_allocator);
+  if (!_CRITBIT_IS_EMPTY(cb, cb->root)) {
+    const int is_node = _CRITBIT_ROOT_IS_NODE(cb, cb->root);
+    _critbit_ref_subtree(cb->root, is_node);
+    _CRITBIT_SET_HAS_ROOT(snapshot, 1);
+    _critbit_slot_set(_CRITBIT_ROOT_SLOT(snapshot), cb->root, is_node);
+  }
+  return snapshot;
+}
+#endif
+
+/*
+ * Pushes nodes on the path to the leftmost (index = 0) or to the rightmost
+ * (index = 1) leaf of the subtree v and positions the cursor at that leaf.
+ */
+static inline void _critbit_cursor_descend(struct critbit_cursor *const c,
+    uintptr_t v, int is_node, const size_t index)
+{
+  while (is_node) {
+    assert(c->depth < _CRITBIT_MAX_DEPTH);
+    c->path[c->depth++] = v;
+    const struct _critbit_node *const node = _critbit_remove_tag(v);
+    v = _critbit_load(&node->next[index]);
+    is_node = _critbit_child_is_node(node, index, v);
+  }
+  c->key = v;
+}
+
+/*
+ * Moves the cursor to the leftmost (index = 0) or to the rightmost (index = 1)
+ * leaf of the nearest subtree on the given side of the current path.
+ */
+static inline int _critbit_cursor_step(struct critbit_cursor *const c,
+    const size_t index)
+{
+  size_t depth = c->depth;
+  while (depth > 0) {
+    const uintptr_t tagged_node = c->path[depth - 1];
+    if (_critbit_node_get_index(tagged_node, c->key) != index) {
+      c->depth = depth;
+      const struct _critbit_node *const node = _critbit_remove_tag(tagged_node);
+      const uintptr_t child = _critbit_load(&node->next[index]);
+      _critbit_cursor_descend(c, child,
+          _critbit_child_is_node(node, index, child), index ^ 1);
+      return 1;
+    }
+    --depth;
+  }
+  return 0;
+}
+
+/*
+ * Positions the cursor at the item nearest to v from the given side:
+ * index = 1 for items greater or equal to v, index = 0 for items less or
+ * equal to v.
+ */
+static inline int _critbit_cursor_seek(struct critbit_cursor *const c,
+    const struct critbit *const cb, const uintptr_t v, const size_t index)
+{
+  assert(_critbit_is_valid_key(v));
+
+  c->cb = cb;
+  c->depth = 0;
+  uintptr_t next = _critbit_load(&cb->root);
+  if (_CRITBIT_IS_EMPTY(cb, next)) {
+    return 0;
+  }
+
+  /* The same descent as in _critbit_get_leaf_path(). */
+  int is_node = _CRITBIT_ROOT_IS_NODE(cb, next);
+  while (is_node) {
+    assert(c->depth < _CRITBIT_MAX_DEPTH);
+    c->path[c->depth++] = next;
+    const struct _critbit_node *const node = _critbit_remove_tag(next);
+    const size_t index = _critbit_node_get_index(next, v);
+    next = _critbit_load(&node->next[index]);
+    is_node = _critbit_child_is_node(node, index, next);
+  }
+  c->key = next;
+  if (next == v) {
+    return 1;
+  }
+
+  /*
+   * Cut the path at the place where v would be inserted, like
+   * critbit_add() does. All the items in the subtree below
+   * the cut are either less or greater than v.
+   */
+  const uint8_t crit_bit = _critbit_get_crit_bit(next, v);
+  size_t depth = 0;
+  while (depth < c->depth &&
+      !_critbit_node_is_after(c->path[depth], crit_bit)) {
+    ++depth;
+  }
+  const int subtree_is_node = (depth < c->depth);
+  const uintptr_t subtree = subtree_is_node ? c->path[depth] : next;
+  c->depth = depth;
+  if (_critbit_get_index(v, crit_bit) != index) {
+    /* The subtree is on the wanted side of v. */
+    _critbit_cursor_descend(c, subtree, subtree_is_node, index ^ 1);
+    return 1;
+  }
+  /* The subtree is on the opposite side of v, so step over it. */
+  return _critbit_cursor_step(c, index);
+}
+
+static inline int critbit_seek_first(struct critbit_cursor *const c,
+    const struct critbit *const cb)
+{
+  c->cb = cb;
+  c->depth = 0;
+  const uintptr_t root = _critbit_load(&cb->root);
+  if (_CRITBIT_IS_EMPTY(cb, root)) {
+    return 0;
+  }
+  _critbit_cursor_descend(c, root, _CRITBIT_ROOT_IS_NODE(cb, root), 0);
+  return 1;
+}
+
+static inline int critbit_seek_last(struct critbit_cursor *const c,
+    const struct critbit *const cb)
+{
+  c->cb = cb;
+  c->depth = 0;
+  const uintptr_t root = _critbit_load(&cb->root);
+  if (_CRITBIT_IS_EMPTY(cb, root)) {
+    return 0;
+  }
+  _critbit_cursor_descend(c, root, _CRITBIT_ROOT_IS_NODE(cb, root), 1);
+  return 1;
+}
+
+static inline int critbit_seek_ge(struct critbit_cursor *const c,
+    const struct critbit *const cb, const uintptr_t v)
+{
+  return _critbit_cursor_seek(c, cb, v, 1);
+}
+
+static inline int critbit_seek_le(struct critbit_cursor *const c,
+    const struct critbit *const cb, const uintptr_t v)
+{
+  return _critbit_cursor_seek(c, cb, v, 0);
+}
+
+static inline uintptr_t critbit_cursor_get(const struct critbit_cursor *const c)
+{
+  assert(c->cb != NULL);
+
+  return c->key;
+}
+
+static inline int critbit_cursor_next(struct critbit_cursor *const c)
+{
+  return _critbit_cursor_step(c, 1);
+}
+
+static inline int critbit_cursor_prev(struct critbit_cursor *const c)
+{
+  return _critbit_cursor_step(c, 0);
+}
+
+/*
+ * Stores the item nearest to v from the given side into result:
+ * index = 1 for items greater or equal to v, index = 0 for items less or
+ * equal to v.
+ *
+ * The descent towards v ends at the leaf sharing the longest prefix with v,
+ * which tells the cut, where v would be inserted. A single backtrack
+ * along the path passes the cut and stops at the deepest node above it,
+ * where the path turns away from the given side. The answer is the leaf
+ * nearest to v in the subtree below the cut if the subtree is on the given
+ * side of v, otherwise in the other child of that node. Unlike cursors,
+ * the path isn't kept for the final descent.
+ */
+static inline int _critbit_get_nearest(const struct critbit *const cb,
+    const uintptr_t v, const size_t index, uintptr_t *const result)
+{
+  assert(_critbit_is_valid_key(v));
+
+  uintptr_t next = _critbit_load(&cb->root);
+  if (_CRITBIT_IS_EMPTY(cb, next)) {
+    return 0;
+  }
+  uintptr_t path[_CRITBIT_MAX_DEPTH];
+  size_t depth = 0;
+  int is_node = _CRITBIT_ROOT_IS_NODE(cb, next);
+  while (is_node) {
+    assert(depth < _CRITBIT_MAX_DEPTH);
+    path[depth++] = next;
+    const struct _critbit_node *const node = _critbit_remove_tag(next);
+    const size_t i = _critbit_node_get_index(next, v);
+    next = _critbit_load(&node->next[i]);
+    is_node = _critbit_child_is_node(node, i, next);
+  }
+  if (next == v) {
+    *result = v;
+    return 1;
+  }
+
+  const uint8_t crit_bit = _critbit_get_crit_bit(next, v);
+  while (depth > 0 && _critbit_node_is_after(path[depth - 1], crit_bit)) {
+    next = path[--depth];
+    is_node = 1;
+  }
+  if (_critbit_get_index(v, crit_bit) == index) {
+    /* The subtree is on the opposite side of v, so step over it. */
+    while (depth > 0 && _critbit_node_get_index(path[depth - 1], v) == index) {
+      --depth;
+    }
+    if (depth == 0) {
+      return 0;
+    }
+    const struct _critbit_node *const node =
+        _critbit_remove_tag(path[depth - 1]);
+    next = _critbit_load(&node->next[index]);
+    is_node = _critbit_child_is_node(node, index, next);
+  }
+
+  /* Take the leaf of the subtree, which is the nearest to v. */
+  while (is_node) {
+    const struct _critbit_node *const node = _critbit_remove_tag(next);
+    next = _critbit_load(&node->next[index ^ 1]);
+    is_node = _critbit_child_is_node(node, index ^ 1, next);
+  }
+  *result = next;
+  return 1;
+}
+
+static inline int critbit_predecessor(const struct critbit *const cb,
+    const uintptr_t v, uintptr_t *const result)
+{
+  return _critbit_get_nearest(cb, v, 0, result);
+}
+
+static inline int critbit_successor(const struct critbit *const cb,
+    const uintptr_t v, uintptr_t *const result)
+{
+  return _critbit_get_nearest(cb, v, 1, result);
+}
+
+/*
+ * Items below a node share bits above its crit bit, so following the bits
+ * of v at each node never makes a more significant bit of (item ^ v) set.
+ */
+static inline int critbit_closest_xor(const struct critbit *const cb,
+    const uintptr_t v, uintptr_t *const result)
+{
+  assert(_critbit_is_valid_key(v));
+
+  uintptr_t next = _critbit_load(&cb->root);
+  if (_CRITBIT_IS_EMPTY(cb, next)) {
+    return 0;
+  }
+  int is_node = _CRITBIT_ROOT_IS_NODE(cb, next);
+  while (is_node) {
+    const struct _critbit_node *const node = _critbit_remove_tag(next);
+    const size_t i = _critbit_node_get_index(next, v);
+    next = _critbit_load(&node->next[i]);
+    is_node = _critbit_child_is_node(node, i, next);
+  }
+  *result = next;
+  return 1;
+}
+
+static inline void critbit_foreach_range(const struct critbit *const cb,
+    const uintptr_t lo, const uintptr_t hi,
+    const struct critbit_visitor *const visitor)
+{
+  if (lo >= hi) {
+    return;
+  }
+
+  /* Items are valid keys, so start at the smallest valid key not below lo. */
+  const uintptr_t start = _critbit_is_valid_key(lo) ? lo : (lo + 2) & ~1;
+  struct critbit_cursor c;
+  if (!critbit_seek_ge(&c, cb, start)) {
+    return;
+  }
+  while (c.key < hi) {
+    visitor->callback(visitor->ctx, c.key);
+    if (!critbit_cursor_next(&c)) {
+      break;
+    }
+  }
+}
+
+/* Returns the mask of the given number of the most significant bits. */
+static inline uintptr_t _critbit_get_prefix_mask(const unsigned bits)
+{
+  assert(bits <= _CRITBIT_PTR_BITS);
+
+  if (bits == 0) {
+    return 0;
+  }
+  return ~((uintptr_t)0) << (_CRITBIT_PTR_BITS - bits);
+}
+
+/*
+ * The subtree holding all the items with a prefix. parent refers
+ * to the parent node of the subtree, unless the subtree is the whole
+ * crit-bit, in which case parent.v is NULL. leaf is the smallest item.
+ */
+struct _critbit_prefix_match
+{
+  struct _critbit_slot slot;
+  struct _critbit_slot parent;
+  uintptr_t v;
+  int is_node;
+  uintptr_t leaf;
+};
+
+/*
+ * Descends from the root while crit bits are inside the prefix. All the items
+ * below share the rest of the prefix bits, so checking one of them suffices.
+ * Returns 0 if there are no items with the prefix.
+ */
+static inline int _critbit_find_prefix(const struct critbit *const cb,
+    const uintptr_t prefix, const unsigned bits,
+    struct _critbit_prefix_match *const m)
+{
+  m->slot = _CRITBIT_ROOT_SLOT(cb);
+  m->parent.v = NULL;
+  m->v = _critbit_load(m->slot.v);
+  if (_CRITBIT_IS_EMPTY(cb, m->v)) {
+    return 0;
+  }
+  m->is_node = _critbit_kinds_is_node(m->slot.kinds, m->slot.index, m->v);
+  while (m->is_node) {
+    const uint8_t crit_bit = _critbit_node_get_crit_bit(m->v);
+    if (crit_bit >= bits) {
+      break;
+    }
+    const struct _critbit_node *const node = _critbit_remove_tag(m->v);
+    m->parent = m->slot;
+    m->slot = _critbit_child_slot(node, _critbit_is_set(prefix, crit_bit));
+    m->v = _critbit_load(m->slot.v);
+    m->is_node = _critbit_child_is_node(node, m->slot.index, m->v);
+  }
+
+  uintptr_t leaf = m->v;
+  int is_node = m->is_node;
+  while (is_node) {
+    const struct _critbit_node *const node = _critbit_remove_tag(leaf);
+    leaf = _critbit_load(&node->next[0]);
+    is_node = _critbit_child_is_node(node, 0, leaf);
+  }
+  m->leaf = leaf;
+  return (((leaf ^ prefix) & _critbit_get_prefix_mask(bits)) == 0);
+}
+
+static inline int critbit_subtree_root(const struct critbit *const cb,
+    const uintptr_t prefix, const unsigned bits,
+    struct critbit_subtree *const st)
+{
+  struct _critbit_prefix_match m;
+  if (!_critbit_find_prefix(cb, prefix, bits, &m)) {
+    return 0;
+  }
+  st->shared_bits = m.is_node ? _critbit_node_get_crit_bit(m.v) :
+      _CRITBIT_PTR_BITS;
+  st->root = m.v;
+  st->root_is_node = m.is_node;
+  return 1;
+}
+
+static inline void critbit_subtree_foreach(
+    const struct critbit_subtree *const st,
+    const struct critbit_visitor *const visitor)
+{
+  _critbit_visit(visitor, st->root, st->root_is_node);
+}
+
+static inline void critbit_foreach_prefix(const struct critbit *const cb,
+    const uintptr_t prefix, const unsigned bits,
+    const struct critbit_visitor *const visitor)
+{
+  struct _critbit_prefix_match m;
+  if (_critbit_find_prefix(cb, prefix, bits, &m)) {
+    _critbit_visit(visitor, m.v, m.is_node);
+  }
+}
+
+static inline int critbit_remove_prefix(struct critbit *const cb,
+    const uintptr_t prefix, const unsigned bits)
+{
+  struct _critbit_prefix_match m;
+  if (!_critbit_find_prefix(cb, prefix, bits, &m)) {
+    return 0;
+  }
+
+  /* Unlink the subtree before releasing it, since readers may be inside. */
+  if (m.parent.v == NULL) {
+    _critbit_store(&cb->root, 0);
+    _CRITBIT_SET_HAS_ROOT(cb, 0);
+  }
+  else {
+#if defined(CRITBIT_PERSISTENT)
+    m.parent = _critbit_own_path(cb, m.leaf, *m.parent.v);
+#endif
+#if defined(CRITBIT_ORDER_STATS)
+    _critbit_add_path_counts(cb, m.leaf, m.parent.v,
+        (size_t)0 - _critbit_subtree_get_count(m.v, m.is_node));
+#endif
+    _critbit_delete_node(cb, m.parent, m.leaf);
+  }
+  _critbit_remove_all_nodes(cb->node_allocator, m.v, m.is_node, 1);
+  return 1;
+}
+
+/*
+ * The serialized crit-bit starts with a header followed by nodes in DFS
+ * order, so the left child of a node immediately follows the node.
+ * A child is either a key or a byte offset of the child node relative
+ * to its parent, depending on the kinds bits of the parent.
+ */
+/* "CRITBIT1" in little-endian byte order. */
+static const uint64_t _CRITBIT_MAPPED_MAGIC = 0x3154494254495243ULL;
+
+struct _critbit_mapped_header
+{
+  uint64_t magic;
+  uint64_t ptr_bits;
+  uint64_t nodes_count;
+
+  /* Bit 0 is set for non-empty crit-bits, bit 1 - if the root is a node. */
+  uint64_t root_kinds;
+
+  /* Either the only key or the index of the root node. */
+  uint64_t root;
+};
+
+struct _critbit_mapped_node
+{
+  uint64_t next[2];
+
+  /* The crit bit in bits 0-7 and the kinds in bits 8-9. */
+  uint64_t info;
+};
+
+static inline void _critbit_count_callback(void *const ctx, const uintptr_t v)
+{
+  (void)v;
+  ++*(size_t *)ctx;
+}
+
+/*
+ * Serializes the subtree of the given node in DFS order starting
+ * at nodes[*count]. Returns the index of the node.
+ */
+static inline size_t _critbit_serialize_subtree(
+    struct _critbit_mapped_node *const nodes, size_t *const count,
+    const uintptr_t tagged_node)
+{
+  const size_t index = (*count)++;
+  const struct _critbit_node *const node = _critbit_remove_tag(tagged_node);
+  uint64_t kinds = 0;
+  for (size_t i = 0; i < 2; ++i) {
+    const uintptr_t child = _critbit_load(&node->next[i]);
+    if (_critbit_child_is_node(node, i, child)) {
+      const size_t child_index = _critbit_serialize_subtree(nodes, count,
+          child);
+      nodes[index].next[i] = (child_index - index) * sizeof(nodes[0]);
+      kinds |= ((uint64_t)1) << i;
+    }
+    else {
+      nodes[index].next[i] = child;
+    }
+  }
+  nodes[index].info = _critbit_node_get_crit_bit(tagged_node) | (kinds << 8);
+  return index;
+}
+
+static inline size_t critbit_serialize(const struct critbit *const cb,
+    void *const buf, const size_t size)
+{
+  assert((uintptr_t)buf % sizeof(uint64_t) == 0);
+
+  size_t items_count = 0;
+  const struct critbit_visitor count_visitor = {
+    .callback = &_critbit_count_callback,
+    .ctx = &items_count,
+  };
+  critbit_foreach(cb, &count_visitor);
+  const size_t nodes_count = (items_count > 1) ? items_count - 1 : 0;
+  const size_t required_size = sizeof(struct _critbit_mapped_header) +
+      nodes_count * sizeof(struct _critbit_mapped_node);
+  if (buf == NULL || required_size > size) {
+    return required_size;
+  }
+
+  struct _critbit_mapped_header *const header = buf;
+  header->magic = _CRITBIT_MAPPED_MAGIC;
+  header->ptr_bits = _CRITBIT_PTR_BITS;
+  header->nodes_count = nodes_count;
+  header->root_kinds = 0;
+  header->root = 0;
+  const uintptr_t root = _critbit_load(&cb->root);
+  if (items_count == 1) {
+    header->root_kinds = 1;
+    header->root = root;
+  }
+  else if (items_count > 1) {
+    size_t count = 0;
+    header->root_kinds = 3;
+    header->root = _critbit_serialize_subtree(
+        (struct _critbit_mapped_node *)(header + 1), &count, root);
+    assert(count == nodes_count);
+  }
+  return required_size;
+}
+
+static inline int critbit_open_mapped(struct critbit_mapped *const m,
+    const void *const data, const size_t size)
+{
+  assert((uintptr_t)data % sizeof(uint64_t) == 0);
+
+  const struct _critbit_mapped_header *const header = data;
+  if (size < sizeof(*header) || header->magic != _CRITBIT_MAPPED_MAGIC ||
+      header->ptr_bits != _CRITBIT_PTR_BITS || header->root_kinds > 3 ||
+      header->root_kinds == 2 ||
+      header->nodes_count != (size - sizeof(*header)) /
+          sizeof(struct _critbit_mapped_node) ||
+      (size - sizeof(*header)) % sizeof(struct _critbit_mapped_node) != 0 ||
+      ((header->root_kinds & 2) && header->root >= header->nodes_count)) {
+    m->root = 0;
+    m->has_root = 0;
+    m->root_is_node = 0;
+    return 0;
+  }
+  const struct _critbit_mapped_node *const nodes =
+      (const struct _critbit_mapped_node *)(header + 1);
+  m->has_root = (header->root_kinds & 1) != 0;
+  m->root_is_node = (header->root_kinds & 2) != 0;
+  m->root = m->root_is_node ? (uintptr_t)&nodes[header->root] :
+      (uintptr_t)header->root;
+  return 1;
+}
+
+/*
+ * Mapped nodes are passed around as addresses, so child nodes are located
+ * by adding offsets without multiplications.
+ */
+static inline uint8_t _critbit_mapped_get_crit_bit(const uintptr_t node)
+{
+  return (uint8_t)((const struct _critbit_mapped_node *)node)->info;
+}
+
+/*
+ * Returns the given child of the node and sets is_node if the child
+ * is a node.
+ */
+static inline uintptr_t _critbit_mapped_get_child(const uintptr_t node,
+    const size_t index, int *const is_node)
+{
+  const struct _critbit_mapped_node *const n =
+      (const struct _critbit_mapped_node *)node;
+  const uint64_t info = n->info;
+  const uintptr_t child = (uintptr_t)n->next[index];
+  *is_node = ((info >> (8 + index)) & 1) != 0;
+  return *is_node ? node + child : child;
+}
+
+static inline int critbit_mapped_contains(const struct critbit_mapped *const m,
+    const uintptr_t v)
+{
+  assert(_critbit_is_valid_key(v));
+
+  if (!m->has_root) {
+    return 0;
+  }
+  uintptr_t next = m->root;
+  int is_node = m->root_is_node;
+  while (is_node) {
+    const size_t index = _critbit_get_index(v,
+        _critbit_mapped_get_crit_bit(next));
+    next = _critbit_mapped_get_child(next, index, &is_node);
+  }
+  return (next == v);
+}
+
+static inline void critbit_mapped_foreach(const struct critbit_mapped *const m,
+    const struct critbit_visitor *const visitor)
+{
+  if (!m->has_root) {
+    return;
+  }
+
+  /* Nodes with right subtrees, which are waiting for a visit. */
+  uintptr_t stack[_CRITBIT_MAX_DEPTH];
+  size_t depth = 0;
+
+  uintptr_t v = m->root;
+  int is_node = m->root_is_node;
+  for (;;) {
+    while (is_node) {
+      assert(depth < _CRITBIT_MAX_DEPTH);
+      stack[depth++] = v;
+      v = _critbit_mapped_get_child(v, 0, &is_node);
+    }
+    visitor->callback(visitor->ctx, v);
+    if (depth == 0) {
+      break;
+    }
+    v = _critbit_mapped_get_child(stack[--depth], 1, &is_node);
+  }
+}
+
+/*
+ * Pushes nodes on the path to the leftmost (index = 0) or to the rightmost
+ * (index = 1) leaf of the subtree v and positions the cursor at that leaf.
+ */
+static inline void _critbit_mapped_cursor_descend(
+    struct critbit_mapped_cursor *const c, uintptr_t v, int is_node,
+    const size_t index)
+{
+  while (is_node) {
+    assert(c->depth < _CRITBIT_MAX_DEPTH);
+    c->path[c->depth++] = v;
+    v = _critbit_mapped_get_child(v, index, &is_node);
+  }
+  c->key = v;
+}
+
+static inline int _critbit_mapped_cursor_step(
+    struct critbit_mapped_cursor *const c, const size_t index)
+{
+  size_t depth = c->depth;
+  while (depth > 0) {
+    const uintptr_t node = c->path[depth - 1];
+    if (_critbit_get_index(c->key, _critbit_mapped_get_crit_bit(node)) !=
+        index) {
+      c->depth = depth;
+      int is_node;
+      const uintptr_t child = _critbit_mapped_get_child(node, index, &is_node);
+      _critbit_mapped_cursor_descend(c, child, is_node, index ^ 1);
+      return 1;
+    }
+    --depth;
+  }
+  return 0;
+}
+
+/* The same as _critbit_cursor_seek(), but for mapped crit-bits. */
+static inline int _critbit_mapped_cursor_seek(
+    struct critbit_mapped_cursor *const c, const struct critbit_mapped *const m,
+    const uintptr_t v, const size_t index)
+{
+  assert(_critbit_is_valid_key(v));
+
+  c->m = m;
+  c->depth = 0;
+  if (!m->has_root) {
+    return 0;
+  }
+
+  uintptr_t next = m->root;
+  int is_node = m->root_is_node;
+  while (is_node) {
+    assert(c->depth < _CRITBIT_MAX_DEPTH);
+    c->path[c->depth++] = next;
+    const size_t child_index = _critbit_get_index(v,
+        _critbit_mapped_get_crit_bit(next));
+    next = _critbit_mapped_get_child(next, child_index, &is_node);
+  }
+  c->key = next;
+  if (next == v) {
+    return 1;
+  }
+
+  const uint8_t crit_bit = _critbit_get_crit_bit(next, v);
+  size_t depth = 0;
+  while (depth < c->depth &&
+      _critbit_mapped_get_crit_bit(c->path[depth]) <= crit_bit) {
+    ++depth;
+  }
+  const int subtree_is_node = (depth < c->depth);
+  const uintptr_t subtree = subtree_is_node ? c->path[depth] : next;
+  c->depth = depth;
+  if (_critbit_get_index(v, crit_bit) != index) {
+    _critbit_mapped_cursor_descend(c, subtree, subtree_is_node, index ^ 1);
+    return 1;
+  }
+  return _critbit_mapped_cursor_step(c, index);
+}
+
+static inline int critbit_mapped_seek_first(
+    struct critbit_mapped_cursor *const c, const struct critbit_mapped *const m)
+{
+  c->m = m;
+  c->depth = 0;
+  if (!m->has_root) {
+    return 0;
+  }
+  _critbit_mapped_cursor_descend(c, m->root, m->root_is_node, 0);
+  return 1;
+}
+
+static inline int critbit_mapped_seek_last(
+    struct critbit_mapped_cursor *const c, const struct critbit_mapped *const m)
+{
+  c->m = m;
+  c->depth = 0;
+  if (!m->has_root) {
+    return 0;
+  }
+  _critbit_mapped_cursor_descend(c, m->root, m->root_is_node, 1);
+  return 1;
+}
+
+static inline int critbit_mapped_seek_ge(struct critbit_mapped_cursor *const c,
+    const struct critbit_mapped *const m, const uintptr_t v)
+{
+  return _critbit_mapped_cursor_seek(c, m, v, 1);
+}
+
+static inline int critbit_mapped_seek_le(struct critbit_mapped_cursor *const c,
+    const struct critbit_mapped *const m, const uintptr_t v)
+{
+  return _critbit_mapped_cursor_seek(c, m, v, 0);
+}
+
+static inline uintptr_t critbit_mapped_cursor_get(
+    const struct critbit_mapped_cursor *const c)
+{
+  return c->key;
+}
+
+static inline int critbit_mapped_cursor_next(
+    struct critbit_mapped_cursor *const c)
+{
+  return _critbit_mapped_cursor_step(c, 1);
+}
+
+static inline int critbit_mapped_cursor_prev(
+    struct critbit_mapped_cursor *const c)
+{
+  return _critbit_mapped_cursor_step(c, 0);
+}
+
+static inline void critbit_get_stats(const struct critbit *const cb,
+    struct critbit_stats *const stats)
+{
+  stats->node_count = 0;
+  stats->leaf_count = 0;
+  stats->max_depth = 0;
+  stats->avg_depth = 0;
+  stats->node_bytes = 0;
+  for (size_t i = 0; i < _CRITBIT_MAX_DEPTH; ++i) {
+    stats->depth_histogram[i] = 0;
+    stats->crit_bit_histogram[i] = 0;
+  }
+  stats->depth_histogram[_CRITBIT_MAX_DEPTH] = 0;
+
+  uintptr_t v = _critbit_load(&cb->root);
+  if (_CRITBIT_IS_EMPTY(cb, v)) {
+    return;
+  }
+
+  /* Nodes with right subtrees, which are waiting for a visit. */
+  const struct _critbit_node *stack[_CRITBIT_MAX_DEPTH];
+  size_t depths[_CRITBIT_MAX_DEPTH];
+  size_t stack_size = 0;
+  size_t total_depth = 0;
+
+  int is_node = _CRITBIT_ROOT_IS_NODE(cb, v);
+  size_t depth = 0;
+  for (;;) {
+    while (is_node) {
+      const struct _critbit_node *const node = _critbit_remove_tag(v);
+      ++stats->node_count;
+      ++stats->crit_bit_histogram[_critbit_node_get_crit_bit(v)];
+      ++depth;
+      assert(stack_size < _CRITBIT_MAX_DEPTH);
+      stack[stack_size] = node;
+      depths[stack_size] = depth;
+      ++stack_size;
+      v = _critbit_load(&node->next[0]);
+      is_node = _critbit_child_is_node(node, 0, v);
+    }
+    assert(depth <= _CRITBIT_MAX_DEPTH);
+    ++stats->leaf_count;
+    ++stats->depth_histogram[depth];
+    total_depth += depth;
+    if (depth > stats->max_depth) {
+      stats->max_depth = depth;
+    }
+    if (stack_size == 0) {
+      break;
+    }
+    --stack_size;
+    const struct _critbit_node *const node = stack[stack_size];
+    v = _critbit_load(&node->next[1]);
+    is_node = _critbit_child_is_node(node, 1, v);
+    depth = depths[stack_size];
+  }
+
+  stats->node_bytes = stats->node_count * critbit_node_size();
+  if (stats->leaf_count > 0) {
+    stats->avg_depth = (double)total_depth / stats->leaf_count;
+  }
+}
+
+#if defined(CRITBIT_COUNTERS)
+static inline void critbit_get_counters(const struct critbit *const cb,
+    struct critbit_counters *const counters)
+{
+  *counters = cb->counters;
+}
+
+static inline void critbit_reset_counters(struct critbit *const cb)
+{
+  cb->counters.contains_calls = 0;
+  cb->counters.contains_node_visits = 0;
+  cb->counters.add_calls = 0;
+  cb->counters.add_node_visits = 0;
+  cb->counters.remove_calls = 0;
+  cb->counters.remove_node_visits = 0;
+}
+#endif
+
+#if defined(CRITBIT_TRACE)
+static inline uint64_t critbit_histogram_percentile(
+    const struct critbit_histogram *const h, const unsigned percent)
+{
+  assert(percent <= 100);
+  if (h->count == 0) {
+    return 0;
+  }
+
+  /* The rank of the percentile among recorded values, starting from 1. */
+  uint64_t rank = (h->count * percent + 99) / 100;
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (size_t i = 0; i < CRITBIT_HISTOGRAM_BUCKETS; ++i) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      const uint64_t bound = _critbit_histogram_get_upper_bound(i);
+      return bound < h->max ? bound : h->max;
+    }
+  }
+  return h->max;
+}
+
+static inline void critbit_tracer_init(struct critbit_tracer *const t)
+{
+  critbit_tracer_reset(t);
+  t->on_deep_path = NULL;
+  t->deep_path_threshold = _CRITBIT_MAX_DEPTH;
+  t->on_alloc_node = NULL;
+  t->on_free_node = NULL;
+  t->ctx = NULL;
+}
+
+static inline void critbit_tracer_reset(struct critbit_tracer *const t)
+{
+  memset(t->stats, 0, sizeof(t->stats));
+}
+
+static inline void critbit_set_tracer(struct critbit *const cb,
+    struct critbit_tracer *const tracer)
+{
+  cb->tracer = tracer;
+}
+
+static inline void *_critbit_traced_alloc_node(void *const ctx)
+{
+  struct critbit_traced_allocator *const ta = ctx;
+  void *const node = ta->inner->alloc_node(ta->inner->ctx);
+  if (ta->tracer->on_alloc_node != NULL) {
+    ta->tracer->on_alloc_node(ta->tracer->ctx, node);
+  }
+  return node;
+}
+
+static inline void _critbit_traced_free_node(void *const ctx, void *const node)
+{
+  struct critbit_traced_allocator *const ta = ctx;
+  if (ta->tracer->on_free_node != NULL) {
+    ta->tracer->on_free_node(ta->tracer->ctx, node);
+  }
+  ta->inner->free_node(ta->inner->ctx, node);
+}
+
+static inline void _critbit_traced_retire_node(void *const ctx,
+    void *const node)
+{
+  struct critbit_traced_allocator *const ta = ctx;
+  if (ta->tracer->on_free_node != NULL) {
+    ta->tracer->on_free_node(ta->tracer->ctx, node);
+  }
+  ta->inner->retire_node(ta->inner->ctx, node);
+}
+
+static inline void critbit_traced_allocator_init(
+    struct critbit_traced_allocator *const ta,
+    const struct critbit_node_allocator *const inner,
+    struct critbit_tracer *const tracer)
+{
+  ta->node_allocator.alloc_node = &_critbit_traced_alloc_node;
+  ta->node_allocator.free_node = &_critbit_traced_free_node;
+  ta->node_allocator.ctx = ta;
+  ta->node_allocator.release_all_nodes = NULL;
+  ta->node_allocator.retire_node = (inner->retire_node != NULL) ?
+      &_critbit_traced_retire_node : NULL;
+  ta->inner = inner;
+  ta->tracer = tracer;
+}
+#endif
+
+#if defined(CRITBIT_ORDER_STATS)
+static inline size_t critbit_size(const struct critbit *const cb)
+{
+  if (_CRITBIT_IS_EMPTY(cb, cb->root)) {
+    return 0;
+  }
+  return _critbit_subtree_get_count(cb->root,
+      _CRITBIT_ROOT_IS_NODE(cb, cb->root));
+}
+
+static inline size_t critbit_rank(const struct critbit *const cb,
+    const uintptr_t v)
+{
+  assert(_critbit_is_valid_key(v));
+
+  if (_CRITBIT_IS_EMPTY(cb, cb->root)) {
+    return 0;
+  }
+
+  /* The leaf nearest to v tells where v's path leaves the crit-bit. */
+  uintptr_t next = cb->root;
+  int is_node = _CRITBIT_ROOT_IS_NODE(cb, next);
+  while (is_node) {
+    const struct _critbit_node *const node = _critbit_remove_tag(next);
+    const size_t index = _critbit_node_get_index(next, v);
+    next = node->next[index];
+    is_node = _critbit_child_is_node(node, index, next);
+  }
+  const uintptr_t leaf = next;
+  const int is_found = (leaf == v);
+  const uint8_t crit_bit = is_found ? 0 : _critbit_get_crit_bit(leaf, v);
+
+  /* Left subtrees on v's path contain only items less than v. */
+  size_t rank = 0;
+  next = cb->root;
+  is_node = _CRITBIT_ROOT_IS_NODE(cb, next);
+  while (is_node && (is_found || !_critbit_node_is_after(next, crit_bit))) {
+    const struct _critbit_node *const node = _critbit_remove_tag(next);
+    const size_t index = _critbit_node_get_index(next, v);
+    if (index == 1) {
+      rank += _critbit_child_get_count(node, 0);
+    }
+    next = node->next[index];
+    is_node = _critbit_child_is_node(node, index, next);
+  }
+
+  /* Items of the subtree, where v's path leaves, are on the leaf's side. */
+  if (leaf < v) {
+    rank += _critbit_subtree_get_count(next, is_node);
+  }
+  return rank;
+}
+
+/*
+ * critbit_rank() for an arbitrary integer v. Items are valid keys, so items
+ * less than v are less than the smallest valid key not below v.
+ */
+static inline size_t _critbit_rank_bound(const struct critbit *const cb,
+    const uintptr_t v)
+{
+  if (_critbit_is_valid_key(v)) {
+    return critbit_rank(cb, v);
+  }
+  if (v == 0) {
+    return 0;
+  }
+  return (v + 1 == 0) ? critbit_size(cb) : critbit_rank(cb, v + 1);
+}
+
+static inline int critbit_select(const struct critbit *const cb, size_t k,
+    uintptr_t *const v)
+{
+  if (k >= critbit_size(cb)) {
+    return 0;
+  }
+
+  uintptr_t next = cb->root;
+  int is_node = _CRITBIT_ROOT_IS_NODE(cb, next);
+  while (is_node) {
+    const struct _critbit_node *const node = _critbit_remove_tag(next);
+    const size_t left_count = _critbit_child_get_count(node, 0);
+    size_t index = 0;
+    if (k >= left_count) {
+      k -= left_count;
+      index = 1;
+    }
+    next = node->next[index];
+    is_node = _critbit_child_is_node(node, index, next);
+  }
+  *v = next;
+  return 1;
+}
+
+static inline size_t critbit_count_range(const struct critbit *const cb,
+    const uintptr_t lo, const uintptr_t hi)
+{
+  if (lo >= hi) {
+    return 0;
+  }
+  return _critbit_rank_bound(cb, hi) - _critbit_rank_bound(cb, lo);
+}
+
+static inline size_t critbit_count_prefix(const struct critbit *const cb,
+    const uintptr_t prefix, const unsigned bits)
+{
+  struct _critbit_prefix_match m;
+  if (!_critbit_find_prefix(cb, prefix, bits, &m)) {
+    return 0;
+  }
+  return _critbit_subtree_get_count(m.v, m.is_node);
+}
+#endif
+
+struct critbit_map
+{
+  uintptr_t root;
+#if defined(CRITBIT_ANY_KEYS)
+  uint8_t root_kinds;
+  uint8_t has_root;
+#endif
+  void *root_value;
+  const struct critbit_node_allocator *node_allocator;
+};
+
+/*
+ * Map nodes extend crit-bit nodes with values for leaf children, so a single
+ * descent finds both the key and its value. Values for node children
+ * are unused.
+ */
+struct _critbit_map_node
+{
+  struct _critbit_node base;
+  void *values[2];
+};
+
+static inline struct _critbit_map_node *_critbit_map_remove_tag(
+    const uintptr_t tagged_node)
+{
+  return (struct _critbit_map_node *)_critbit_remove_tag(tagged_node);
+}
+
+static inline size_t critbit_map_node_size(void)
+{
+  return sizeof(struct _critbit_map_node);
+}
+
+static inline struct critbit_map *critbit_map_create(
+    const struct critbit_node_allocator *const node_allocator)
+{
+  struct critbit_map *const m = malloc(sizeof(*m));
+  m->root = 0;
+  _CRITBIT_SET_HAS_ROOT(m, 0);
+  m->root_value = NULL;
+  m->node_allocator = node_allocator;
+  return m;
+}
+
+static inline void critbit_map_delete(struct critbit_map *const m)
+{
+  if (m->node_allocator->release_all_nodes != NULL) {
+    m->node_allocator->release_all_nodes(m->node_allocator->ctx);
+  }
+  else if (!_CRITBIT_IS_EMPTY(m, m->root)) {
+    _critbit_remove_all_nodes(m->node_allocator, m->root,
+        _CRITBIT_ROOT_IS_NODE(m, m->root), 0);
+  }
+  free(m);
+}
+
+static inline int critbit_map_put(struct critbit_map *const m,
+    const uintptr_t key, void *const value)
+{
+  assert(_critbit_is_valid_key(key));
+
+  if (_CRITBIT_IS_EMPTY(m, m->root)) {
+    _CRITBIT_SET_HAS_ROOT(m, 1);
+    _critbit_slot_set(_CRITBIT_ROOT_SLOT(m), key, 0);
+    m->root_value = value;
+    return 1;
+  }
+
+  struct _critbit_slot next = _CRITBIT_ROOT_SLOT(m);
+  void **value_slot = &m->root_value;
+  while (_critbit_slot_is_node(next)) {
+    struct _critbit_map_node *const node = _critbit_map_remove_tag(*next.v);
+    const size_t index = _critbit_node_get_index(*next.v, key);
+    next = _critbit_child_slot(&node->base, index);
+    value_slot = &node->values[index];
+  }
+  if (*next.v == key) {
+    *value_slot = value;
+    return 0;
+  }
+
+  const uint8_t crit_bit = _critbit_get_crit_bit(*next.v, key);
+  next = _CRITBIT_ROOT_SLOT(m);
+  value_slot = &m->root_value;
+  while (_critbit_slot_is_node(next) &&
+      !_critbit_node_is_after(*next.v, crit_bit)) {
+    struct _critbit_map_node *const node = _critbit_map_remove_tag(*next.v);
+    const size_t index = _critbit_node_get_index(*next.v, key);
+    next = _critbit_child_slot(&node->base, index);
+    value_slot = &node->values[index];
+  }
+
+  struct _critbit_map_node *const node = (struct _critbit_map_node *)
+      _critbit_alloc_node(m->node_allocator);
+  const int is_node = _critbit_slot_is_node(next);
+  const size_t index = _critbit_get_index(key, crit_bit);
+  node->base.next[index] = key;
+  node->values[index] = value;
+  node->base.next[index ^ 1] = *next.v;
+  node->values[index ^ 1] = is_node ? NULL : *value_slot;
+  _critbit_node_set_kinds(&node->base, (unsigned)is_node << (index ^ 1));
+  _critbit_node_set_crit_bit(&node->base, crit_bit);
+  _critbit_slot_set(next, _critbit_add_tag(&node->base, crit_bit), 1);
+  return 1;
+}
+
+static inline int critbit_map_get(const struct critbit_map *const m,
+    const uintptr_t key, void **const value)
+{
+  assert(_critbit_is_valid_key(key));
+
+  if (_CRITBIT_IS_EMPTY(m, m->root)) {
+    return 0;
+  }
+
+  uintptr_t next = m->root;
+  int is_node = _CRITBIT_ROOT_IS_NODE(m, next);
+  void *const *value_slot = &m->root_value;
+  while (is_node) {
+    const struct _critbit_map_node *const node = _critbit_map_remove_tag(next);
+    const size_t index = _critbit_node_get_index(next, key);
+    next = node->base.next[index];
+    is_node = _critbit_child_is_node(&node->base, index, next);
+    value_slot = &node->values[index];
+  }
+  if (next != key) {
+    return 0;
+  }
+  *value = *value_slot;
+  return 1;
+}
+
+static inline int critbit_map_remove(struct critbit_map *const m,
+    const uintptr_t key, void **const value)
+{
+  assert(_critbit_is_valid_key(key));
+
+  if (_CRITBIT_IS_EMPTY(m, m->root)) {
+    return 0;
+  }
+
+  struct _critbit_slot prev = _CRITBIT_ROOT_SLOT(m);
+  if (!_critbit_slot_is_node(prev)) {
+    if (m->root != key) {
+      return 0;
+    }
+    if (value != NULL) {
+      *value = m->root_value;
+    }
+    m->root = 0;
+    _CRITBIT_SET_HAS_ROOT(m, 0);
+    m->root_value = NULL;
+    return 1;
+  }
+
+  void **prev_value_slot = &m->root_value;
+  struct _critbit_map_node *node = _critbit_map_remove_tag(*prev.v);
+  size_t index = _critbit_node_get_index(*prev.v, key);
+  struct _critbit_slot next = _critbit_child_slot(&node->base, index);
+  while (_critbit_slot_is_node(next)) {
+    prev = next;
+    prev_value_slot = &node->values[index];
+    node = _critbit_map_remove_tag(*next.v);
+    index = _critbit_node_get_index(*next.v, key);
+    next = _critbit_child_slot(&node->base, index);
+  }
+  if (*next.v != key) {
+    return 0;
+  }
+  if (value != NULL) {
+    *value = node->values[index];
+  }
+  const uintptr_t child = node->base.next[index ^ 1];
+  _critbit_slot_set(prev, child,
+      _critbit_child_is_node(&node->base, index ^ 1, child));
+  *prev_value_slot = node->values[index ^ 1];
+  m->node_allocator->free_node(m->node_allocator->ctx, node);
+  return 1;
+}
+
+static inline void critbit_map_foreach(const struct critbit_map *const m,
+    const struct critbit_map_visitor *const visitor)
+{
+  if (_CRITBIT_IS_EMPTY(m, m->root)) {
+    return;
+  }
+
+  /* Nodes with right subtrees, which are waiting for a visit. */
+  const struct _critbit_map_node *stack[_CRITBIT_MAX_DEPTH];
+  size_t depth = 0;
+
+  uintptr_t v = m->root;
+  int is_node = _CRITBIT_ROOT_IS_NODE(m, v);
+  void *value = m->root_value;
+  for (;;) {
+    while (is_node) {
+      const struct _critbit_map_node *const node = _critbit_map_remove_tag(v);
+      assert(depth < _CRITBIT_MAX_DEPTH);
+      stack[depth++] = node;
+      v = node->base.next[0];
+      is_node = _critbit_child_is_node(&node->base, 0, v);
+      value = node->values[0];
+    }
+    visitor->callback(visitor->ctx, v, value);
+    if (depth == 0) {
+      break;
+    }
+    const struct _critbit_map_node *const node = stack[--depth];
+    v = node->base.next[1];
+    is_node = _critbit_child_is_node(&node->base, 1, v);
+    value = node->values[1];
+  }
+}
+
+struct critbit_bytes
+{
+  uintptr_t root;
+  size_t key_size;
+  const struct critbit_node_allocator *node_allocator;
+};
+
+/*
+ * Byte string nodes store the crit bit as the index of the first byte
+ * differing between subtrees plus the inverted mask for the crit bit
+ * in that byte, as in Bernstein's crit-bit trees. Leaves are pointers
+ * to keys, while pointers to nodes are tagged with the lowest bit.
+ */
+struct _critbit_bytes_node
+{
+  uintptr_t next[2];
+  uint32_t byte;
+  uint8_t otherbits;
+};
+
+static inline uintptr_t _critbit_bytes_add_tag(
+    const struct _critbit_bytes_node *const node)
+{
+  assert(!_critbit_has_tag((uintptr_t)node));
+  return ((uintptr_t)node) | 1;
+}
+
+static inline struct _critbit_bytes_node *_critbit_bytes_remove_tag(
+    const uintptr_t v)
+{
+  assert(_critbit_has_tag(v));
+  return (struct _critbit_bytes_node *)(v & ~((uintptr_t)1));
+}
+
+static inline size_t _critbit_bytes_get_len(
+    const struct critbit_bytes *const cb, const uint8_t *const key)
+{
+  return cb->key_size != 0 ? cb->key_size : strlen((const char *)key);
+}
+
+/* Returns 1 if the crit bit is set in c, otherwise returns 0. */
+static inline size_t _critbit_bytes_get_index(const uint8_t c,
+    const uint8_t otherbits)
+{
+  return (1 + (otherbits | c)) >> 8;
+}
+
+/*
+ * Returns the index of the child to follow for the key of the given length.
+ * Bytes past the end of string keys are treated as zeros.
+ */
+static inline size_t _critbit_bytes_node_get_index(
+    const struct _critbit_bytes_node *const node, const uint8_t *const key,
+    const size_t len)
+{
+  const uint8_t c = node->byte < len ? key[node->byte] : 0;
+  return _critbit_bytes_get_index(c, node->otherbits);
+}
+
+/*
+ * Returns the index of the first byte differing between a and b. Returns n
+ * if the first n bytes are equal. Bytes are compared a word at a time.
+ */
+static inline size_t _critbit_bytes_find_diff(const uint8_t *const a,
+    const uint8_t *const b, const size_t n)
+{
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+    uint64_t x, y;
+    memcpy(&x, a + i, sizeof(x));
+    memcpy(&y, b + i, sizeof(y));
+    if (x != y) {
+      break;
+    }
+  }
+  while (i < n && a[i] == b[i]) {
+    ++i;
+  }
+  return i;
+}
+
+/*
+ * Returns the index of the first byte differing between the key k
+ * of the given length and the key stored in the crit-bit. Returns len
+ * if k is a prefix of the stored key.
+ */
+static inline size_t _critbit_bytes_find_key_diff(
+    const struct critbit_bytes *const cb, const uint8_t *const k,
+    const size_t len, const uint8_t *const stored)
+{
+  /* Constant sizes let the compiler unroll comparisons for common keys. */
+  switch (cb->key_size) {
+  case 16:
+    return _critbit_bytes_find_diff(k, stored, 16);
+  case 8:
+    return _critbit_bytes_find_diff(k, stored, 8);
+  case 0:
+    break;
+  default:
+    return _critbit_bytes_find_diff(k, stored, len);
+  }
+
+  /*
+   * The stored string differs from k at or before its terminating zero,
+   * so it cannot be overrun.
+   */
+  size_t i = 0;
+  while (k[i] == stored[i]) {
+    if (k[i] == 0) {
+      return len;
+    }
+    ++i;
+  }
+  return i;
+}
+
+static inline int _critbit_bytes_equal(const struct critbit_bytes *const cb,
+    const uint8_t *const k, const size_t len, const uint8_t *const stored)
+{
+  return _critbit_bytes_find_key_diff(cb, k, len, stored) == len &&
+      (cb->key_size != 0 || stored[len] == 0);
+}
+
+/*
+ * Returns 1 if the node crit bit goes after the crit bit at the given byte
+ * with the given otherbits.
+ */
+static inline int _critbit_bytes_node_is_after(
+    const struct _critbit_bytes_node *const node, const uint32_t byte,
+    const uint8_t otherbits)
+{
+  return node->byte > byte ||
+      (node->byte == byte && node->otherbits > otherbits);
+}
+
+static inline const uint8_t *_critbit_bytes_get_leaf(
+    const struct critbit_bytes *const cb, const uint8_t *const key,
+    const size_t len)
+{
+  uintptr_t v = cb->root;
+  while (_critbit_has_tag(v)) {
+    const struct _critbit_bytes_node *const node = _critbit_bytes_remove_tag(v);
+    v = node->next[_critbit_bytes_node_get_index(node, key, len)];
+  }
+  return (const uint8_t *)v;
+}
+
+static inline size_t critbit_bytes_node_size(void)
+{
+  return sizeof(struct _critbit_bytes_node);
+}
+
+static inline struct critbit_bytes *critbit_bytes_create(
+    const struct critbit_node_allocator *const node_allocator,
+    const size_t key_size)
+{
+  struct critbit_bytes *const cb = malloc(sizeof(*cb));
+  cb->root = 0;
+  cb->key_size = key_size;
+  cb->node_allocator = node_allocator;
+  return cb;
+}
+
+static inline void critbit_bytes_delete(struct critbit_bytes *const cb)
+{
+  const struct critbit_node_allocator *const a = cb->node_allocator;
+  if (a->release_all_nodes != NULL) {
+    a->release_all_nodes(a->ctx);
+    free(cb);
+    return;
+  }
+
+  /*
+   * The depth of byte string crit-bits isn't bounded, so rotate left subtrees
+   * to the right instead of keeping a stack of pending subtrees.
+   */
+  uintptr_t v = cb->root;
+  while (_critbit_has_tag(v)) {
+    struct _critbit_bytes_node *const node = _critbit_bytes_remove_tag(v);
+    const uintptr_t left = node->next[0];
+    if (_critbit_has_tag(left)) {
+      struct _critbit_bytes_node *const left_node =
+          _critbit_bytes_remove_tag(left);
+      node->next[0] = left_node->next[1];
+      left_node->next[1] = v;
+      v = left;
+      continue;
+    }
+    v = node->next[1];
+    a->free_node(a->ctx, node);
+  }
+  free(cb);
+}
+
+static inline int critbit_bytes_add(struct critbit_bytes *const cb,
+    const void *const key)
+{
+  assert(!_critbit_has_tag((uintptr_t)key));
+  assert(key != NULL);
+
+  const uint8_t *const k = key;
+  const size_t len = _critbit_bytes_get_len(cb, k);
+  assert(len < UINT32_MAX);
+
+  if (cb->root == 0) {
+    cb->root = (uintptr_t)key;
+    return 1;
+  }
+
+  const uint8_t *const leaf = _critbit_bytes_get_leaf(cb, k, len);
+  const size_t i = _critbit_bytes_find_key_diff(cb, k, len, leaf);
+  if (i == len && (cb->key_size != 0 || leaf[len] == 0)) {
+    return 0;
+  }
+
+  /* Leave only the highest differing bit and invert the result. */
+  unsigned x = k[i] ^ leaf[i];
+  x |= x >> 1;
+  x |= x >> 2;
+  x |= x >> 4;
+  const uint32_t byte = (uint32_t)i;
+  const uint8_t otherbits = (uint8_t)~(x & ~(x >> 1));
+
+  uintptr_t *next = &cb->root;
+  while (_critbit_has_tag(*next)) {
+    struct _critbit_bytes_node *const node = _critbit_bytes_remove_tag(*next);
+    if (_critbit_bytes_node_is_after(node, byte, otherbits)) {
+      break;
+    }
+    next = &node->next[_critbit_bytes_node_get_index(node, k, len)];
+  }
+
+  struct _critbit_bytes_node *const node = cb->node_allocator->alloc_node(
+      cb->node_allocator->ctx);
+  const size_t index = _critbit_bytes_get_index(k[i], otherbits);
+  node->next[index] = (uintptr_t)key;
+  node->next[index ^ 1] = *next;
+  node->byte = byte;
+  node->otherbits = otherbits;
+  *next = _critbit_bytes_add_tag(node);
+  return 1;
+}
+
+static inline int critbit_bytes_remove(struct critbit_bytes *const cb,
+    const void *const key)
+{
+  const uint8_t *const k = key;
+  const size_t len = _critbit_bytes_get_len(cb, k);
+
+  if (cb->root == 0) {
+    return 0;
+  }
+
+  uintptr_t *prev = NULL;
+  uintptr_t *next = &cb->root;
+  struct _critbit_bytes_node *node = NULL;
+  size_t index = 0;
+  while (_critbit_has_tag(*next)) {
+    prev = next;
+    node = _critbit_bytes_remove_tag(*next);
+    index = _critbit_bytes_node_get_index(node, k, len);
+    next = &node->next[index];
+  }
+  if (!_critbit_bytes_equal(cb, k, len, (const uint8_t *)*next)) {
+    return 0;
+  }
+  if (prev == NULL) {
+    cb->root = 0;
+    return 1;
+  }
+  *prev = node->next[index ^ 1];
+  cb->node_allocator->free_node(cb->node_allocator->ctx, node);
+  return 1;
+}
+
+static inline int critbit_bytes_contains(const struct critbit_bytes *const cb,
+    const void *const key)
+{
+  const uint8_t *const k = key;
+  const size_t len = _critbit_bytes_get_len(cb, k);
+
+  if (cb->root == 0) {
+    return 0;
+  }
+  return _critbit_bytes_equal(cb, k, len, _critbit_bytes_get_leaf(cb, k, len));
+}
+
+static inline void critbit_bytes_foreach(const struct critbit_bytes *const cb,
+    const struct critbit_bytes_visitor *const visitor)
+{
+  if (cb->root == 0) {
+    return;
+  }
+
+  /*
+   * Right subtrees, which are waiting for a visit. The depth of byte string
+   * crit-bits isn't bounded, so the stack grows on demand.
+   */
+  uintptr_t small_stack[_CRITBIT_MAX_DEPTH];
+  uintptr_t *stack = small_stack;
+  size_t stack_size = _CRITBIT_MAX_DEPTH;
+  size_t depth = 0;
+
+  uintptr_t v = cb->root;
+  for (;;) {
+    while (_critbit_has_tag(v)) {
+      const struct _critbit_bytes_node *const node =
+          _critbit_bytes_remove_tag(v);
+      if (depth == stack_size) {
+        uintptr_t *const new_stack = malloc(sizeof(*stack) * stack_size * 2);
+        memcpy(new_stack, stack, sizeof(*stack) * stack_size);
+        if (stack != small_stack) {
+          free(stack);
+        }
+        stack = new_stack;
+        stack_size *= 2;
+      }
+      stack[depth++] = node->next[1];
+      v = node->next[0];
+    }
+    visitor->callback(visitor->ctx, (const void *)v);
+    if (depth == 0) {
+      break;
+    }
+    v = stack[--depth];
+  }
+  if (stack != small_stack) {
+    free(stack);
+  }
+}
+
+struct critbit_hybrid
+{
+  uintptr_t root;
+  const struct critbit_node_allocator *node_allocator;
+  const struct critbit_node_allocator *bucket_allocator;
+};
+
+/* The number of keys in a bucket, which occupies a single cache line. */
+#define _CRITBIT_BUCKET_SIZE (64 / sizeof(uintptr_t))
+
+/*
+ * A bucket holds sorted keys followed by zeros for free entries. Pointers
+ * to buckets aren't tagged, so they are told apart from tagged pointers
+ * to nodes. All the keys in a bucket share bits up to the crit bit
+ * of the parent node.
+ */
+struct _critbit_bucket
+{
+  uintptr_t keys[_CRITBIT_BUCKET_SIZE];
+};
+
+static inline struct _critbit_bucket *_critbit_get_bucket(const uintptr_t v)
+{
+  assert(v != 0);
+  assert(!_critbit_has_tag(v));
+
+  return (struct _critbit_bucket *)v;
+}
+
+static inline size_t _critbit_bucket_get_count(
+    const struct _critbit_bucket *const b)
+{
+  size_t n = 0;
+  while (n < _CRITBIT_BUCKET_SIZE && b->keys[n] != 0) {
+    ++n;
+  }
+  return n;
+}
+
+static inline int _critbit_bucket_contains(
+    const struct _critbit_bucket *const b, const uintptr_t v)
+{
+#if defined(__SSE2__) && UINTPTR_MAX == UINT64_MAX
+  /*
+   * SSE2 lacks 64-bit compares, so a key matches if both of its 32-bit
+   * halves match. All the keys are compared without branches.
+   */
+  const __m128i key = _mm_set1_epi64x((long long)v);
+  __m128i found = _mm_setzero_si128();
+  for (size_t i = 0; i < _CRITBIT_BUCKET_SIZE; i += 2) {
+    const __m128i eq = _mm_cmpeq_epi32(
+        _mm_loadu_si128((const __m128i *)&b->keys[i]), key);
+    found = _mm_or_si128(found, _mm_and_si128(eq,
+        _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1))));
+  }
+  return (_mm_movemask_epi8(found) != 0);
+#else
+  int found = 0;
+  for (size_t i = 0; i < _CRITBIT_BUCKET_SIZE; ++i) {
+    found |= (b->keys[i] == v);
+  }
+  return found;
+#endif
+}
+
+/* Creates a bucket with n sorted keys and returns it. */
+static inline uintptr_t _critbit_hybrid_create_bucket(
+    const struct critbit_hybrid *const h, const uintptr_t *const keys,
+    const size_t n)
+{
+  assert(n > 0);
+  assert(n <= _CRITBIT_BUCKET_SIZE);
+
+  struct _critbit_bucket *const b = h->bucket_allocator->alloc_node(
+      h->bucket_allocator->ctx);
+  assert(!_critbit_has_tag((uintptr_t)b));
+  for (size_t i = 0; i < _CRITBIT_BUCKET_SIZE; ++i) {
+    b->keys[i] = (i < n) ? keys[i] : 0;
+  }
+  return (uintptr_t)b;
+}
+
+static inline uintptr_t _critbit_hybrid_create_node(
+    const struct critbit_hybrid *const h, const uintptr_t left,
+    const uintptr_t right, const uint8_t crit_bit)
+{
+  struct _critbit_node *const node = h->node_allocator->alloc_node(
+      h->node_allocator->ctx);
+  node->next[0] = left;
+  node->next[1] = right;
+  _critbit_node_set_crit_bit(node, crit_bit);
+  return _critbit_add_tag(node, crit_bit);
+}
+
+/*
+ * Adds v to the full bucket referred by slot. Splits the bucket into a node
+ * with two buckets at the highest crit bit among the bucket keys and v.
+ */
+static inline void _critbit_hybrid_split_bucket(
+    const struct critbit_hybrid *const h, uintptr_t *const slot,
+    const uintptr_t v)
+{
+  struct _critbit_bucket *const b = _critbit_get_bucket(*slot);
+  uintptr_t keys[_CRITBIT_BUCKET_SIZE + 1];
+  size_t n = 0;
+  for (size_t i = 0; i < _CRITBIT_BUCKET_SIZE; ++i) {
+    if (n == i && v < b->keys[i]) {
+      keys[n++] = v;
+    }
+    keys[n++] = b->keys[i];
+  }
+  if (n == _CRITBIT_BUCKET_SIZE) {
+    keys[n++] = v;
+  }
+
+  /* The first and the last keys differ at the highest crit bit. */
+  const uint8_t crit_bit = _critbit_get_crit_bit(keys[0], keys[n - 1]);
+  size_t split = 1;
+  while (!_critbit_is_set(keys[split], crit_bit)) {
+    ++split;
+  }
+  for (size_t i = 0; i < _CRITBIT_BUCKET_SIZE; ++i) {
+    b->keys[i] = (i < split) ? keys[i] : 0;
+  }
+  *slot = _critbit_hybrid_create_node(h, *slot,
+      _critbit_hybrid_create_bucket(h, keys + split, n - split), crit_bit);
+}
+
+static inline void _critbit_hybrid_free(const struct critbit_hybrid *const h,
+    const uintptr_t v)
+{
+  if (_critbit_has_tag(v)) {
+    h->node_allocator->free_node(h->node_allocator->ctx,
+        _critbit_remove_tag(v));
+  }
+  else {
+    h->bucket_allocator->free_node(h->bucket_allocator->ctx,
+        _critbit_get_bucket(v));
+  }
+}
+
+static inline size_t critbit_hybrid_bucket_size(void)
+{
+  return sizeof(struct _critbit_bucket);
+}
+
+static inline struct critbit_hybrid *critbit_hybrid_create(
+    const struct critbit_node_allocator *const node_allocator,
+    const struct critbit_node_allocator *const bucket_allocator)
+{
+  struct critbit_hybrid *const h = malloc(sizeof(*h));
+  h->root = 0;
+  h->node_allocator = node_allocator;
+  h->bucket_allocator = bucket_allocator;
+  return h;
+}
+
+static inline void critbit_hybrid_delete(struct critbit_hybrid *const h)
+{
+  const struct critbit_node_allocator *const nodes = h->node_allocator;
+  const struct critbit_node_allocator *const buckets = h->bucket_allocator;
+  if (nodes->release_all_nodes != NULL && buckets->release_all_nodes != NULL) {
+    nodes->release_all_nodes(nodes->ctx);
+    buckets->release_all_nodes(buckets->ctx);
+  }
+  else if (h->root != 0) {
+    /* Right subtrees, which are waiting for removal. */
+    uintptr_t stack[_CRITBIT_MAX_DEPTH];
+    size_t depth = 0;
+    uintptr_t v = h->root;
+    for (;;) {
+      while (_critbit_has_tag(v)) {
+        const struct _critbit_node *const node = _critbit_remove_tag(v);
+        assert(depth < _CRITBIT_MAX_DEPTH);
+        stack[depth++] = node->next[1];
+        const uintptr_t left = node->next[0];
+        _critbit_hybrid_free(h, v);
+        v = left;
+      }
+      _critbit_hybrid_free(h, v);
+      if (depth == 0) {
+        break;
+      }
+      v = stack[--depth];
+    }
+  }
+  free(h);
+}
+
+static inline int critbit_hybrid_add(struct critbit_hybrid *const h,
+    const uintptr_t v)
+{
+  assert(v != 0);
+  assert(_critbit_is_valid_key(v));
+
+  if (h->root == 0) {
+    h->root = _critbit_hybrid_create_bucket(h, &v, 1);
+    return 1;
+  }
+
+  /* The same single-pass descent as in critbit_add(). */
+  uintptr_t *path[_CRITBIT_MAX_DEPTH + 1];
+  size_t depth = 0;
+  path[0] = &h->root;
+  while (_critbit_has_tag(*path[depth])) {
+    const uintptr_t tagged_node = *path[depth];
+    assert(depth < _CRITBIT_MAX_DEPTH);
+    path[depth + 1] = &_critbit_remove_tag(tagged_node)->next[
+        _critbit_node_get_index(tagged_node, v)];
+    ++depth;
+  }
+  struct _critbit_bucket *const b = _critbit_get_bucket(*path[depth]);
+  if (_critbit_bucket_contains(b, v)) {
+    return 0;
+  }
+
+  const uint8_t crit_bit = _critbit_get_crit_bit(b->keys[0], v);
+  if (depth > 0 && _critbit_node_is_after(*path[depth - 1], crit_bit)) {
+    /* v differs from the bucket keys above the bucket, so add a new bucket. */
+    while (depth > 0 && _critbit_node_is_after(*path[depth - 1], crit_bit)) {
+      --depth;
+    }
+    uintptr_t *const slot = path[depth];
+    const uintptr_t bucket = _critbit_hybrid_create_bucket(h, &v, 1);
+    *slot = _critbit_get_index(v, crit_bit) ?
+        _critbit_hybrid_create_node(h, *slot, bucket, crit_bit) :
+        _critbit_hybrid_create_node(h, bucket, *slot, crit_bit);
+    return 1;
+  }
+
+  const size_t n = _critbit_bucket_get_count(b);
+  if (n == _CRITBIT_BUCKET_SIZE) {
+    _critbit_hybrid_split_bucket(h, path[depth], v);
+    return 1;
+  }
+  size_t i = n;
+  while (i > 0 && b->keys[i - 1] > v) {
+    b->keys[i] = b->keys[i - 1];
+    --i;
+  }
+  b->keys[i] = v;
+  return 1;
+}
+
+static inline int critbit_hybrid_remove(struct critbit_hybrid *const h,
+    const uintptr_t v)
+{
+  assert(v != 0);
+  assert(_critbit_is_valid_key(v));
+
+  if (h->root == 0) {
+    return 0;
+  }
+
+  uintptr_t *prev = NULL;
+  uintptr_t *next = &h->root;
+  size_t index = 0;
+  while (_critbit_has_tag(*next)) {
+    prev = next;
+    index = _critbit_node_get_index(*next, v);
+    next = &_critbit_remove_tag(*next)->next[index];
+  }
+  struct _critbit_bucket *const b = _critbit_get_bucket(*next);
+  const size_t n = _critbit_bucket_get_count(b);
+  size_t i = 0;
+  while (i < n && b->keys[i] != v) {
+    ++i;
+  }
+  if (i == n) {
+    return 0;
+  }
+  for (; i + 1 < n; ++i) {
+    b->keys[i] = b->keys[i + 1];
+  }
+  b->keys[n - 1] = 0;
+
+  if (prev == NULL) {
+    if (n == 1) {
+      _critbit_hybrid_free(h, h->root);
+      h->root = 0;
+    }
+    return 1;
+  }
+
+  /*
+   * Replace the parent node with the sibling if the bucket becomes empty.
+   * Merge the bucket with the sibling bucket if both are at most half full
+   * together, so buckets don't split and merge back on alternating adds
+   * and removals.
+   */
+  struct _critbit_node *const node = _critbit_remove_tag(*prev);
+  const uintptr_t sibling = node->next[index ^ 1];
+  if (n == 1) {
+    _critbit_hybrid_free(h, *next);
+    _critbit_hybrid_free(h, *prev);
+    *prev = sibling;
+    return 1;
+  }
+  if (_critbit_has_tag(sibling)) {
+    return 1;
+  }
+  struct _critbit_bucket *const s = _critbit_get_bucket(sibling);
+  const size_t m = _critbit_bucket_get_count(s);
+  if (n - 1 + m > _CRITBIT_BUCKET_SIZE / 2) {
+    return 1;
+  }
+  struct _critbit_bucket *const left = _critbit_get_bucket(node->next[0]);
+  struct _critbit_bucket *const right = _critbit_get_bucket(node->next[1]);
+  const size_t left_count = (left == b) ? n - 1 : m;
+  for (size_t j = 0; right->keys[j] != 0; ++j) {
+    left->keys[left_count + j] = right->keys[j];
+  }
+  _critbit_hybrid_free(h, (uintptr_t)right);
+  _critbit_hybrid_free(h, *prev);
+  *prev = (uintptr_t)left;
+  return 1;
+}
+
+static inline int critbit_hybrid_contains(const struct critbit_hybrid *const h,
+    const uintptr_t v)
+{
+  assert(v != 0);
+  assert(_critbit_is_valid_key(v));
+
+  uintptr_t next = h->root;
+  if (next == 0) {
+    return 0;
+  }
+  while (_critbit_has_tag(next)) {
+    const struct _critbit_node *const node = _critbit_remove_tag(next);
+    next = node->next[_critbit_node_get_index(next, v)];
+  }
+  return _critbit_bucket_contains(_critbit_get_bucket(next), v);
+}
+
+static inline void critbit_hybrid_foreach(const struct critbit_hybrid *const h,
+    const struct critbit_visitor *const visitor)
+{
+  if (h->root == 0) {
+    return;
+  }
+
+  /* Right subtrees, which are waiting for a visit. */
+  uintptr_t stack[_CRITBIT_MAX_DEPTH];
+  size_t depth = 0;
+
+  uintptr_t v = h->root;
+  for (;;) {
+    while (_critbit_has_tag(v)) {
+      const struct _critbit_node *const node = _critbit_remove_tag(v);
+      assert(depth < _CRITBIT_MAX_DEPTH);
+      stack[depth++] = node->next[1];
+      v = node->next[0];
+    }
+    const struct _critbit_bucket *const b = _critbit_get_bucket(v);
+    for (size_t i = 0; i < _CRITBIT_BUCKET_SIZE && b->keys[i] != 0; ++i) {
+      visitor->callback(visitor->ctx, b->keys[i]);
+    }
+    if (depth == 0) {
+      break;
+    }
+    v = stack[--depth];
+  }
+}
+
+struct critbit_wide
+{
+  uintptr_t root;
+  const struct critbit_node_allocator *node_allocators[
+      CRITBIT_WIDE_SIZE_CLASSES];
+};
+
+/* The number of key bits, which select a child of a wide node. */
+#define _CRITBIT_WIDE_BITS 4
+
+/* The maximum depth of wide crit-bits. */
+#define _CRITBIT_WIDE_MAX_DEPTH \
+  (sizeof(uintptr_t) * CHAR_BIT / _CRITBIT_WIDE_BITS)
+
+/*
+ * Wide nodes are tagged like crit-bit nodes. A node branches on key bits
+ * [shift, shift + _CRITBIT_WIDE_BITS), while all the keys in its subtree
+ * share the bits above them. Children go in ascending order of their
+ * bits, and the node has room for (2 << size_class) children.
+ */
+struct _critbit_wide_node
+{
+  uint16_t bitmap;
+  uint8_t shift;
+  uint8_t size_class;
+  uintptr_t children[];
+};
+
+static inline size_t _critbit_wide_get_capacity(const size_t size_class)
+{
+  return ((size_t)2) << size_class;
+}
+
+/* Returns the smallest size class, which fits n children. */
+static inline uint8_t _critbit_wide_get_size_class(const size_t n)
+{
+  uint8_t size_class = 0;
+  while (_critbit_wide_get_capacity(size_class) < n) {
+    ++size_class;
+  }
+  assert(size_class < CRITBIT_WIDE_SIZE_CLASSES);
+  return size_class;
+}
+
+static inline size_t _critbit_wide_popcount(const unsigned x)
+{
+#if defined(__GNUC__)
+  return (size_t)__builtin_popcount(x);
+#else
+  size_t n = 0;
+  for (unsigned y = x; y != 0; y &= y - 1) {
+    ++n;
+  }
+  return n;
+#endif
+}
+
+static inline struct _critbit_wide_node *_critbit_wide_remove_tag(
+    const uintptr_t v)
+{
+  assert(_critbit_has_tag(v));
+  return (struct _critbit_wide_node *)(v - 1);
+}
+
+static inline uintptr_t _critbit_wide_add_tag(
+    const struct _critbit_wide_node *const node)
+{
+  return (uintptr_t)node + 1;
+}
+
+/* Returns the bit of the child, which v belongs to, in the node bitmap. */
+static inline unsigned _critbit_wide_get_child_bit(
+    const struct _critbit_wide_node *const node, const uintptr_t v)
+{
+  const unsigned digit = (unsigned)(v >> node->shift) &
+      ((1u << _CRITBIT_WIDE_BITS) - 1);
+  return 1u << digit;
+}
+
+/* Returns the index of the child with the given bit in the children array. */
+static inline size_t _critbit_wide_get_child_index(
+    const struct _critbit_wide_node *const node, const unsigned bit)
+{
+  return _critbit_wide_popcount(node->bitmap & (bit - 1));
+}
+
+static inline struct _critbit_wide_node *_critbit_wide_alloc_node(
+    const struct critbit_wide *const w, const uint8_t size_class)
+{
+  const struct critbit_node_allocator *const a =
+      w->node_allocators[size_class];
+  struct _critbit_wide_node *const node = a->alloc_node(a->ctx);
+  node->size_class = size_class;
+  return node;
+}
+
+static inline void _critbit_wide_free_node(const struct critbit_wide *const w,
+    struct _critbit_wide_node *const node)
+{
+  const struct critbit_node_allocator *const a =
+      w->node_allocators[node->size_class];
+  a->free_node(a->ctx, node);
+}
+
+/*
+ * Moves children of the node into a new node of the given size class
+ * and returns the new node.
+ */
+static inline struct _critbit_wide_node *_critbit_wide_resize_node(
+    const struct critbit_wide *const w, struct _critbit_wide_node *const node,
+    const uint8_t size_class)
+{
+  struct _critbit_wide_node *const new_node =
+      _critbit_wide_alloc_node(w, size_class);
+  new_node->bitmap = node->bitmap;
+  new_node->shift = node->shift;
+  memcpy(new_node->children, node->children,
+      _critbit_wide_popcount(node->bitmap) * sizeof(node->children[0]));
+  _critbit_wide_free_node(w, node);
+  return new_node;
+}
+
+static inline void _critbit_wide_remove_all_nodes(
+    const struct critbit_wide *const w, const uintptr_t v)
+{
+  if (v == 0 || !_critbit_has_tag(v)) {
+    return;
+  }
+  struct _critbit_wide_node *const node = _critbit_wide_remove_tag(v);
+  const size_t n = _critbit_wide_popcount(node->bitmap);
+  for (size_t i = 0; i < n; ++i) {
+    _critbit_wide_remove_all_nodes(w, node->children[i]);
+  }
+  _critbit_wide_free_node(w, node);
+}
+
+static inline size_t critbit_wide_node_size(const size_t size_class)
+{
+  assert(size_class < CRITBIT_WIDE_SIZE_CLASSES);
+
+  return sizeof(struct _critbit_wide_node) +
+      _critbit_wide_get_capacity(size_class) * sizeof(uintptr_t);
+}
+
+static inline struct critbit_wide *critbit_wide_create(
+    const struct critbit_node_allocator *const *const node_allocators)
+{
+  struct critbit_wide *const w = malloc(sizeof(*w));
+  w->root = 0;
+  for (size_t i = 0; i < CRITBIT_WIDE_SIZE_CLASSES; ++i) {
+    w->node_allocators[i] = node_allocators[i];
+  }
+  return w;
+}
+
+static inline void critbit_wide_delete(struct critbit_wide *const w)
+{
+  int release_all_nodes = 1;
+  for (size_t i = 0; i < CRITBIT_WIDE_SIZE_CLASSES; ++i) {
+    release_all_nodes &= (w->node_allocators[i]->release_all_nodes != NULL);
+  }
+  if (release_all_nodes) {
+    for (size_t i = 0; i < CRITBIT_WIDE_SIZE_CLASSES; ++i) {
+      const struct critbit_node_allocator *const a = w->node_allocators[i];
+      a->release_all_nodes(a->ctx);
+    }
+  }
+  else {
+    _critbit_wide_remove_all_nodes(w, w->root);
+  }
+  free(w);
+}
+
+static inline int critbit_wide_add(struct critbit_wide *const w,
+    const uintptr_t v)
+{
+  assert(v != 0 && !_critbit_has_tag(v));
+
+  if (w->root == 0) {
+    w->root = v;
+    return 1;
+  }
+
+  /*
+   * Find a leaf, which shares the most bits with v. If the node lacks
+   * the child for v, then any child will do, since all of them share
+   * the same bits above the node.
+   */
+  uintptr_t next = w->root;
+  while (_critbit_has_tag(next)) {
+    const struct _critbit_wide_node *const node =
+        _critbit_wide_remove_tag(next);
+    const unsigned bit = _critbit_wide_get_child_bit(node, v);
+    next = (node->bitmap & bit) ?
+        node->children[_critbit_wide_get_child_index(node, bit)] :
+        node->children[0];
+  }
+  if (next == v) {
+    return 0;
+  }
+  const uint8_t crit_bit = _critbit_get_crit_bit(next, v);
+  const uint8_t shift = (uint8_t)((_CRITBIT_PTR_BITS - 1 - crit_bit) /
+      _CRITBIT_WIDE_BITS * _CRITBIT_WIDE_BITS);
+  const uintptr_t leaf = next;
+
+  uintptr_t *slot = &w->root;
+  for (;;) {
+    next = *slot;
+    struct _critbit_wide_node *node = _critbit_has_tag(next) ?
+        _critbit_wide_remove_tag(next) : NULL;
+    if (node == NULL || node->shift < shift) {
+      /* v diverges from the subtree above it, so add a node with both. */
+      struct _critbit_wide_node *const new_node =
+          _critbit_wide_alloc_node(w, 0);
+      new_node->shift = shift;
+      const unsigned subtree_bit = _critbit_wide_get_child_bit(new_node, leaf);
+      const unsigned v_bit = _critbit_wide_get_child_bit(new_node, v);
+      assert(subtree_bit != v_bit);
+      new_node->bitmap = (uint16_t)(subtree_bit | v_bit);
+      const size_t v_index = (v_bit > subtree_bit);
+      new_node->children[v_index] = v;
+      new_node->children[v_index ^ 1] = next;
+      *slot = _critbit_wide_add_tag(new_node);
+      return 1;
+    }
+    const unsigned bit = _critbit_wide_get_child_bit(node, v);
+    if (node->shift > shift) {
+      assert(node->bitmap & bit);
+      slot = &node->children[_critbit_wide_get_child_index(node, bit)];
+      continue;
+    }
+
+    /* The node lacks the child for v, so insert it. */
+    assert(!(node->bitmap & bit));
+    const size_t n = _critbit_wide_popcount(node->bitmap);
+    if (n == _critbit_wide_get_capacity(node->size_class)) {
+      node = _critbit_wide_resize_node(w, node, node->size_class + 1);
+      *slot = _critbit_wide_add_tag(node);
+    }
+    const size_t index = _critbit_wide_get_child_index(node, bit);
+    memmove(&node->children[index + 1], &node->children[index],
+        (n - index) * sizeof(node->children[0]));
+    node->children[index] = v;
+    node->bitmap |= (uint16_t)bit;
+    return 1;
+  }
+}
+
+static inline int critbit_wide_remove(struct critbit_wide *const w,
+    const uintptr_t v)
+{
+  assert(v != 0 && !_critbit_has_tag(v));
+
+  if (w->root == 0) {
+    return 0;
+  }
+
+  /* The slot referring to the parent node of the leaf. */
+  uintptr_t *parent_slot = NULL;
+  uintptr_t *slot = &w->root;
+  while (_critbit_has_tag(*slot)) {
+    struct _critbit_wide_node *const node = _critbit_wide_remove_tag(*slot);
+    const unsigned bit = _critbit_wide_get_child_bit(node, v);
+    if (!(node->bitmap & bit)) {
+      return 0;
+    }
+    parent_slot = slot;
+    slot = &node->children[_critbit_wide_get_child_index(node, bit)];
+  }
+  if (*slot != v) {
+    return 0;
+  }
+  if (parent_slot == NULL) {
+    w->root = 0;
+    return 1;
+  }
+
+  struct _critbit_wide_node *node = _critbit_wide_remove_tag(*parent_slot);
+  const unsigned bit = _critbit_wide_get_child_bit(node, v);
+  const size_t index = _critbit_wide_get_child_index(node, bit);
+  const size_t n = _critbit_wide_popcount(node->bitmap);
+  if (n == 2) {
+    /* The node becomes redundant, so replace it by the other child. */
+    *parent_slot = node->children[index ^ 1];
+    _critbit_wide_free_node(w, node);
+    return 1;
+  }
+  memmove(&node->children[index], &node->children[index + 1],
+      (n - index - 1) * sizeof(node->children[0]));
+  node->bitmap &= (uint16_t)~bit;
+
+  /* Shrink the node lazily, so alternating add and remove don't resize it. */
+  if (n - 1 <= _critbit_wide_get_capacity(node->size_class) / 4) {
+    node = _critbit_wide_resize_node(w, node,
+        _critbit_wide_get_size_class(n - 1));
+    *parent_slot = _critbit_wide_add_tag(node);
+  }
+  return 1;
+}
+
+static inline int critbit_wide_contains(const struct critbit_wide *const w,
+    const uintptr_t v)
+{
+  assert(v != 0 && !_critbit_has_tag(v));
+
+  if (w->root == 0) {
+    return 0;
+  }
+  uintptr_t next = w->root;
+  while (_critbit_has_tag(next)) {
+    const struct _critbit_wide_node *const node =
+        _critbit_wide_remove_tag(next);
+    const unsigned bit = _critbit_wide_get_child_bit(node, v);
+    if (!(node->bitmap & bit)) {
+      return 0;
+    }
+    next = node->children[_critbit_wide_get_child_index(node, bit)];
+  }
+  return (next == v);
+}
+
+static inline void critbit_wide_foreach(const struct critbit_wide *const w,
+    const struct critbit_visitor *const visitor)
+{
+  if (w->root == 0) {
+    return;
+  }
+
+  /* Nodes on the path with the indexes of the next children to visit. */
+  const struct _critbit_wide_node *nodes[_CRITBIT_WIDE_MAX_DEPTH];
+  size_t indexes[_CRITBIT_WIDE_MAX_DEPTH];
+  size_t depth = 0;
+
+  uintptr_t v = w->root;
+  for (;;) {
+    while (_critbit_has_tag(v)) {
+      const struct _critbit_wide_node *const node = _critbit_wide_remove_tag(v);
+      assert(depth < _CRITBIT_WIDE_MAX_DEPTH);
+      nodes[depth] = node;
+      indexes[depth++] = 1;
+      v = node->children[0];
+    }
+    visitor->callback(visitor->ctx, v);
+    while (depth > 0 && indexes[depth - 1] ==
+        _critbit_wide_popcount(nodes[depth - 1]->bitmap)) {
+      --depth;
+    }
+    if (depth == 0) {
+      break;
+    }
+    v = nodes[depth - 1]->children[indexes[depth - 1]++];
+  }
+}
+
+#if defined(__GNUC__)
+/*
+ * Shards are cache line-sized, so locks of distinct shards don't share
+ * cache lines.
+ */
+struct _critbit_shard
+{
+  struct critbit *cb;
+  unsigned char lock;
+  char padding[64 - sizeof(struct critbit *) - 1];
+};
+
+struct critbit_sharded
+{
+  struct _critbit_shard *shards;
+  void *memory;
+  unsigned shard_bits;
+};
+
+static inline void _critbit_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * Test-and-test-and-set spinlock. Waiters spin on plain loads, so they
+ * don't steal the cache line from the lock owner.
+ */
+static inline void _critbit_spin_lock(unsigned char *const lock)
+{
+  while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+      _critbit_cpu_relax();
+    }
+  }
+}
+
+static inline void _critbit_spin_unlock(unsigned char *const lock)
+{
+  __atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+static inline size_t _critbit_sharded_get_count(
+    const struct critbit_sharded *const sh)
+{
+  return ((size_t)1) << sh->shard_bits;
+}
+
+static inline struct _critbit_shard *_critbit_sharded_get_shard(
+    const struct critbit_sharded *const sh, const uintptr_t v)
+{
+  /* Two shifts avoid an undefined shift by _CRITBIT_PTR_BITS. */
+  const size_t i = (size_t)((v >> 1) >> (_CRITBIT_PTR_BITS - 1 -
+      sh->shard_bits));
+  return &sh->shards[i];
+}
+
+static inline struct critbit_sharded *critbit_sharded_create(
+    const struct critbit_node_allocator *const *const node_allocators,
+    const unsigned shard_bits)
+{
+  assert(shard_bits <= 16);
+
+  struct critbit_sharded *const sh = malloc(sizeof(*sh));
+  sh->shard_bits = shard_bits;
+  const size_t n = _critbit_sharded_get_count(sh);
+  sh->memory = malloc(n * sizeof(sh->shards[0]) + 64);
+  const uintptr_t offset = (uintptr_t)sh->memory % 64;
+  sh->shards = (struct _critbit_shard *)((char *)sh->memory + (64 - offset));
+  for (size_t i = 0; i < n; ++i) {
+    sh->shards[i].cb = critbit_create(node_allocators[i]);
+    sh->shards[i].lock = 0;
+  }
+  return sh;
+}
+
+static inline void critbit_sharded_delete(struct critbit_sharded *const sh)
+{
+  const size_t n = _critbit_sharded_get_count(sh);
+  for (size_t i = 0; i < n; ++i) {
+    critbit_delete(sh->shards[i].cb);
+  }
+  free(sh->memory);
+  free(sh);
+}
+
+static inline int critbit_sharded_add(struct critbit_sharded *const sh,
+    const uintptr_t v)
+{
+  struct _critbit_shard *const shard = _critbit_sharded_get_shard(sh, v);
+  _critbit_spin_lock(&shard->lock);
+  const int result = critbit_add(shard->cb, v);
+  _critbit_spin_unlock(&shard->lock);
+  return result;
+}
+
+static inline int critbit_sharded_remove(struct critbit_sharded *const sh,
+    const uintptr_t v)
+{
+  struct _critbit_shard *const shard = _critbit_sharded_get_shard(sh, v);
+  _critbit_spin_lock(&shard->lock);
+  const int result = critbit_remove(shard->cb, v);
+  _critbit_spin_unlock(&shard->lock);
+  return result;
+}
+
+static inline int critbit_sharded_contains(struct critbit_sharded *const sh,
+    const uintptr_t v)
+{
+  struct _critbit_shard *const shard = _critbit_sharded_get_shard(sh, v);
+  _critbit_spin_lock(&shard->lock);
+  const int result = critbit_contains(shard->cb, v);
+  _critbit_spin_unlock(&shard->lock);
+  return result;
+}
+
+static inline void critbit_sharded_foreach(struct critbit_sharded *const sh,
+    const struct critbit_visitor *const visitor)
+{
+  const size_t n = _critbit_sharded_get_count(sh);
+  for (size_t i = 0; i < n; ++i) {
+    struct _critbit_shard *const shard = &sh->shards[i];
+    _critbit_spin_lock(&shard->lock);
+    critbit_foreach(shard->cb, visitor);
+    _critbit_spin_unlock(&shard->lock);
+  }
+}
+
+/*
+ * Positions the cursor at the first item of the first non-empty shard
+ * starting from the shard i in the given direction: index = 1 for
+ * ascending order, index = 0 for descending order.
+ */
+static inline int _critbit_sharded_seek_from(
+    struct critbit_sharded_cursor *const c, size_t i, const size_t index)
+{
+  const size_t n = _critbit_sharded_get_count(c->sh);
+  for (;;) {
+    struct _critbit_shard *const shard = &c->sh->shards[i];
+    struct critbit_cursor cc;
+    _critbit_spin_lock(&shard->lock);
+    const int result = index ? critbit_seek_first(&cc, shard->cb) :
+        critbit_seek_last(&cc, shard->cb);
+    if (result) {
+      c->key = critbit_cursor_get(&cc);
+    }
+    _critbit_spin_unlock(&shard->lock);
+    if (result) {
+      return 1;
+    }
+    if (index ? (i + 1 == n) : (i == 0)) {
+      return 0;
+    }
+    i = index ? i + 1 : i - 1;
+  }
+}
+
+/*
+ * Positions the cursor at the item nearest to v from the given side like
+ * _critbit_cursor_seek() does. Skips v itself if is_strict is set.
+ */
+static inline int _critbit_sharded_seek(
+    struct critbit_sharded_cursor *const c, const uintptr_t v,
+    const size_t index, const int is_strict)
+{
+  struct _critbit_shard *const shard = _critbit_sharded_get_shard(c->sh, v);
+  struct critbit_cursor cc;
+  _critbit_spin_lock(&shard->lock);
+  int result = _critbit_cursor_seek(&cc, shard->cb, v, index);
+  if (result && is_strict && critbit_cursor_get(&cc) == v) {
+    result = _critbit_cursor_step(&cc, index);
+  }
+  if (result) {
+    c->key = critbit_cursor_get(&cc);
+  }
+  _critbit_spin_unlock(&shard->lock);
+  if (result) {
+    return 1;
+  }
+
+  /* There are no wanted items in the shard of v, so go to its neighbours. */
+  const size_t i = (size_t)(shard - c->sh->shards);
+  if (index ? (i + 1 == _critbit_sharded_get_count(c->sh)) : (i == 0)) {
+    return 0;
+  }
+  return _critbit_sharded_seek_from(c, index ? i + 1 : i - 1, index);
+}
+
+static inline int critbit_sharded_seek_first(
+    struct critbit_sharded_cursor *const c, struct critbit_sharded *const sh)
+{
+  c->sh = sh;
+  return _critbit_sharded_seek_from(c, 0, 1);
+}
+
+static inline int critbit_sharded_seek_last(
+    struct critbit_sharded_cursor *const c, struct critbit_sharded *const sh)
+{
+  c->sh = sh;
+  return _critbit_sharded_seek_from(c, _critbit_sharded_get_count(sh) - 1, 0);
+}
+
+static inline int critbit_sharded_seek_ge(
+    struct critbit_sharded_cursor *const c, struct critbit_sharded *const sh,
+    const uintptr_t v)
+{
+  c->sh = sh;
+  return _critbit_sharded_seek(c, v, 1, 0);
+}
+
+static inline int critbit_sharded_seek_le(
+    struct critbit_sharded_cursor *const c, struct critbit_sharded *const sh,
+    const uintptr_t v)
+{
+  c->sh = sh;
+  return _critbit_sharded_seek(c, v, 0, 0);
+}
+
+static inline uintptr_t critbit_sharded_cursor_get(
+    const struct critbit_sharded_cursor *const c)
+{
+  return c->key;
+}
+
+static inline int critbit_sharded_cursor_next(
+    struct critbit_sharded_cursor *const c)
+{
+  return _critbit_sharded_seek(c, c->key, 1, 1);
+}
+
+static inline int critbit_sharded_cursor_prev(
+    struct critbit_sharded_cursor *const c)
+{
+  return _critbit_sharded_seek(c, c->key, 0, 1);
+}
+#endif
+
+/*
+ * Define CRITBIT_PARALLEL in order to build and traverse crit-bits
+ * on multiple threads. Threads are created with pthreads for each call,
+ * so parallel functions pay off only on large crit-bits.
+ */
+#if defined(CRITBIT_PARALLEL)
+#  if !defined(__GNUC__)
+#    error "CRITBIT_PARALLEL requires GCC-compatible __atomic builtins"
+#  endif
+#  include <pthread.h>
+#  include <sched.h>  /* for sched_yield() */
+
+/* Smaller key ranges are built on the current thread. */
+static const size_t _CRITBIT_PARALLEL_MIN_KEYS = 16 * 1024;
+
+struct _critbit_build_task
+{
+  const struct critbit *cb;
+  const uintptr_t *a;
+  size_t lo;
+  size_t hi;
+  size_t threads;
+  uintptr_t subtree;
+};
+
+static inline uintptr_t _critbit_build_subtree_parallel(
+    const struct critbit *cb, const uintptr_t *a, size_t lo, size_t hi,
+    size_t threads);
+
+static inline void *_critbit_build_thread(void *const ctx)
+{
+  struct _critbit_build_task *const t = (struct _critbit_build_task *)ctx;
+  t->subtree = _critbit_build_subtree_parallel(t->cb, t->a, t->lo, t->hi,
+      t->threads);
+  return NULL;
+}
+
+/*
+ * Builds the subtree like _critbit_build_subtree() does, but builds
+ * the right subtree on a new thread. Threads are shared between subtrees
+ * in proportion to their sizes.
+ */
+static inline uintptr_t _critbit_build_subtree_parallel(
+    const struct critbit *const cb, const uintptr_t *const a,
+    const size_t lo, const size_t hi, const size_t threads)
+{
+  if (threads < 2 || hi - lo < _CRITBIT_PARALLEL_MIN_KEYS) {
+    return _critbit_build_subtree(cb, a, lo, hi);
+  }
+
+  const uint8_t crit_bit = _critbit_get_crit_bit(a[lo], a[hi - 1]);
+  struct _critbit_node *const node = _critbit_alloc_node(cb->node_allocator);
+  const size_t split = _critbit_find_split(a, lo, hi, crit_bit);
+  const size_t left_threads = (threads * (split - lo) + (hi - lo) / 2) /
+      (hi - lo);
+  if (left_threads == 0 || left_threads == threads) {
+    /* The smaller subtree doesn't deserve a thread. */
+    node->next[0] = _critbit_build_subtree_parallel(cb, a, lo, split, threads);
+    node->next[1] = _critbit_build_subtree_parallel(cb, a, split, hi, threads);
+  }
+  else {
+    struct _critbit_build_task t = {
+      .cb = cb,
+      .a = a,
+      .lo = split,
+      .hi = hi,
+      .threads = threads - left_threads,
+      .subtree = 0,
+    };
+    pthread_t thread;
+    const int is_started =
+        (pthread_create(&thread, NULL, &_critbit_build_thread, &t) == 0);
+    node->next[0] = _critbit_build_subtree_parallel(cb, a, lo, split,
+        left_threads);
+    if (is_started) {
+      pthread_join(thread, NULL);
+    }
+    else {
+      _critbit_build_thread(&t);
+    }
+    node->next[1] = t.subtree;
+  }
+  _critbit_node_set_kinds(node, (split - lo > 1) | ((hi - split > 1) << 1));
+  _critbit_node_set_crit_bit(node, crit_bit);
+  _critbit_node_update_count(node);
+  return _critbit_add_tag(node, crit_bit);
+}
+
+static inline struct critbit *critbit_build_sorted_parallel(
+    const struct critbit_node_allocator *const node_allocator,
+    const uintptr_t *const a, const size_t n, const size_t threads)
+{
+  for (size_t i = 0; i < n; ++i) {
+    assert(_critbit_is_valid_key(a[i]));
+    assert(i == 0 || a[i - 1] < a[i]);
+  }
+
+  struct critbit *const cb = critbit_create(node_allocator);
+  if (n > 0) {
+    _CRITBIT_SET_HAS_ROOT(cb, 1);
+    _critbit_slot_set(_CRITBIT_ROOT_SLOT(cb),
+        _critbit_build_subtree_parallel(cb, a, 0, n, threads), n > 1);
+  }
+  return cb;
+}
+
+/*
+ * Workers are cache line-sized, so publishing a subtree doesn't disturb
+ * other workers.
+ */
+struct _critbit_foreach_worker
+{
+  /* A node, whose subtree may be stolen by other workers, or 0. */
+  uintptr_t shared;
+  char padding[64 - sizeof(uintptr_t)];
+};
+
+struct _critbit_foreach_pool
+{
+  const struct critbit_visitor *visitor;
+  struct _critbit_foreach_worker *workers;
+  size_t threads;
+
+  /*
+   * The number of workers, which may hold unvisited subtrees. Shared
+   * subtrees belong to busy workers, so there is no work left when
+   * it drops to zero.
+   */
+  size_t busy;
+};
+
+struct _critbit_foreach_thread
+{
+  struct _critbit_foreach_pool *pool;
+  size_t index;
+};
+
+/*
+ * Visits the subtree of the given node like _critbit_visit() does.
+ * Whenever the worker has no shared subtree, it shares the topmost right
+ * subtree waiting for a visit, so thieves take large subtrees. The worker
+ * takes the shared subtree back when it runs out of its own subtrees.
+ */
+static inline void _critbit_foreach_worker_visit(
+    const struct _critbit_foreach_pool *const pool,
+    struct _critbit_foreach_worker *const w, uintptr_t v)
+{
+  const struct critbit_visitor *const visitor = pool->visitor;
+
+  /*
+   * Nodes with right subtrees, which are waiting for a visit. Right
+   * subtrees of nodes below bottom are shared.
+   */
+  const struct _critbit_node *stack[_CRITBIT_MAX_DEPTH];
+  size_t bottom = 0;
+  size_t depth = 0;
+
+  int is_node = 1;
+  for (;;) {
+    while (is_node) {
+      if (bottom < depth &&
+          __atomic_load_n(&w->shared, __ATOMIC_RELAXED) == 0) {
+        const struct _critbit_node *const top = stack[bottom];
+        const uintptr_t right = _critbit_load(&top->next[1]);
+        if (_critbit_child_is_node(top, 1, right)) {
+          __atomic_store_n(&w->shared, right, __ATOMIC_RELEASE);
+          ++bottom;
+        }
+      }
+      const struct _critbit_node *const node = _critbit_remove_tag(v);
+      assert(depth < _CRITBIT_MAX_DEPTH);
+      stack[depth++] = node;
+      v = _critbit_load(&node->next[0]);
+      is_node = _critbit_child_is_node(node, 0, v);
+    }
+    visitor->callback(visitor->ctx, v);
+    if (depth == bottom) {
+      v = __atomic_exchange_n(&w->shared, 0, __ATOMIC_ACQUIRE);
+      if (v == 0) {
+        return;
+      }
+      bottom = 0;
+      depth = 0;
+      is_node = 1;
+      continue;
+    }
+    const struct _critbit_node *const node = stack[--depth];
+    v = _critbit_load(&node->next[1]);
+    is_node = _critbit_child_is_node(node, 1, v);
+  }
+}
+
+/* Steals subtrees from other workers until there is no work left. */
+static inline void _critbit_foreach_steal(
+    struct _critbit_foreach_pool *const pool, const size_t index)
+{
+  struct _critbit_foreach_worker *const w = &pool->workers[index];
+  while (__atomic_load_n(&pool->busy, __ATOMIC_ACQUIRE) != 0) {
+    for (size_t i = 1; i < pool->threads; ++i) {
+      struct _critbit_foreach_worker *const victim =
+          &pool->workers[(index + i) % pool->threads];
+      if (__atomic_load_n(&victim->shared, __ATOMIC_RELAXED) == 0) {
+        continue;
+      }
+      /* Become busy before stealing, so the work never looks finished. */
+      __atomic_add_fetch(&pool->busy, 1, __ATOMIC_ACQ_REL);
+      const uintptr_t v = __atomic_exchange_n(&victim->shared, 0,
+          __ATOMIC_ACQUIRE);
+      if (v != 0) {
+        _critbit_foreach_worker_visit(pool, w, v);
+      }
+      __atomic_sub_fetch(&pool->busy, 1, __ATOMIC_ACQ_REL);
+    }
+    /* Give way to busy workers if there are more threads than CPUs. */
+    sched_yield();
+  }
+}
+
+static inline void *_critbit_foreach_thread(void *const ctx)
+{
+  const struct _critbit_foreach_thread *const t =
+      (const struct _critbit_foreach_thread *)ctx;
+  _critbit_foreach_steal(t->pool, t->index);
+  return NULL;
+}
+
+static inline void critbit_parallel_foreach(const struct critbit *const cb,
+    const struct critbit_visitor *const visitor, const size_t threads)
+{
+  const uintptr_t root = _critbit_load(&cb->root);
+  if (threads < 2 || _CRITBIT_IS_EMPTY(cb, root) ||
+      !_CRITBIT_ROOT_IS_NODE(cb, root)) {
+    critbit_foreach(cb, visitor);
+    return;
+  }
+
+  struct _critbit_foreach_worker *const workers =
+      malloc(sizeof(workers[0]) * threads);
+  struct _critbit_foreach_thread *const args =
+      malloc(sizeof(args[0]) * threads);
+  pthread_t *const ids = malloc(sizeof(ids[0]) * threads);
+  int *const is_started = malloc(sizeof(is_started[0]) * threads);
+  struct _critbit_foreach_pool pool = {
+    .visitor = visitor,
+    .workers = workers,
+    .threads = threads,
+    .busy = 1,
+  };
+  for (size_t i = 0; i < threads; ++i) {
+    workers[i].shared = 0;
+  }
+
+  /* The current thread is the worker 0, which starts at the root. */
+  for (size_t i = 1; i < threads; ++i) {
+    args[i].pool = &pool;
+    args[i].index = i;
+    is_started[i] = (pthread_create(&ids[i], NULL, &_critbit_foreach_thread,
+        &args[i]) == 0);
+  }
+  _critbit_foreach_worker_visit(&pool, &workers[0], root);
+  __atomic_sub_fetch(&pool.busy, 1, __ATOMIC_ACQ_REL);
+  _critbit_foreach_steal(&pool, 0);
+  for (size_t i = 1; i < threads; ++i) {
+    if (is_started[i]) {
+      pthread_join(ids[i], NULL);
+    }
+  }
+
+  free(is_started);
+  free(ids);
+  free(args);
+  free(workers);
+}
+#endif
+
+/*
+ * Array search kernels. SIMD kernels for x86 are compiled with target
+ * attributes, so they are available regardless of compiler flags and
+ * are selected at runtime according to the CPU. Define CRITBIT_NO_SIMD
+ * in order to use only scalar kernels.
+ */
+#if !defined(CRITBIT_NO_SIMD) && UINTPTR_MAX == UINT64_MAX
+#  if defined(__GNUC__) && defined(__x86_64__)
+#    define _CRITBIT_X86_SIMD
+#  elif defined(__aarch64__) && defined(__ARM_NEON)
+#    define _CRITBIT_NEON_SIMD
+#  endif
+#endif
+
+#if defined(_CRITBIT_X86_SIMD)
+#  include <immintrin.h>  /* for SSE4.2, AVX2 and AVX-512 intrinsics */
+#  define _CRITBIT_TARGET(isa) __attribute__((target(isa)))
+#elif defined(_CRITBIT_NEON_SIMD)
+#  include <arm_neon.h>  /* for NEON intrinsics */
+#endif
+
+/*
+ * The binary search in critbit_array_lower_bound() stops at a window
+ * of this many items, which are compared with v at once.
+ */
+#define _CRITBIT_ARRAY_WINDOW 32
+
+/*
+ * Narrows down the range [*base, *base + len] containing the lower bound
+ * for v to at most _CRITBIT_ARRAY_WINDOW items and returns its length.
+ * The loop has no data-dependent branches.
+ */
+static inline size_t _critbit_array_narrow(const uintptr_t *const a,
+    size_t len, const uintptr_t v, size_t *const base)
+{
+  size_t lo = 0;
+  while (len > _CRITBIT_ARRAY_WINDOW) {
+    const size_t half = len / 2;
+    lo = (a[lo + half - 1] < v) ? lo + half : lo;
+    len -= half;
+  }
+  *base = lo;
+  return len;
+}
+
+static inline size_t _critbit_array_find_scalar(const uintptr_t *const a,
+    const size_t n, const uintptr_t v)
+{
+  for (size_t i = 0; i < n; ++i) {
+    if (a[i] == v) {
+      return i;
+    }
+  }
+  return n;
+}
+
+/* Returns the number of items less than v in the array a of n items. */
+static inline size_t _critbit_array_count_less_scalar(
+    const uintptr_t *const a, const size_t n, const uintptr_t v)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i) {
+    count += (a[i] < v);
+  }
+  return count;
+}
+
+static inline size_t _critbit_array_lower_bound_scalar(
+    const uintptr_t *const a, const size_t n, const uintptr_t v)
+{
+  size_t base;
+  const size_t len = _critbit_array_narrow(a, n, v, &base);
+  return base + _critbit_array_count_less_scalar(a + base, len, v);
+}
+
+#if defined(_CRITBIT_X86_SIMD)
+/*
+ * SSE4.2 and AVX2 have only signed 64-bit compares, so both operands
+ * are biased by the sign bit before comparing.
+ */
+#define _CRITBIT_SIGN_BIT ((long long)INT64_MIN)
+
+_CRITBIT_TARGET("sse4.2")
+static inline size_t _critbit_array_find_sse42(const uintptr_t *const a,
+    const size_t n, const uintptr_t v)
+{
+  const __m128i key = _mm_set1_epi64x((long long)v);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    const __m128i eq = _mm_cmpeq_epi64(
+        _mm_loadu_si128((const __m128i *)&a[i]), key);
+    const int mask = _mm_movemask_pd(_mm_castsi128_pd(eq));
+    if (mask != 0) {
+      return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+  }
+  return i + _critbit_array_find_scalar(a + i, n - i, v);
+}
+
+_CRITBIT_TARGET("sse4.2")
+static inline size_t _critbit_array_lower_bound_sse42(
+    const uintptr_t *const a, const size_t n, const uintptr_t v)
+{
+  size_t base;
+  const size_t len = _critbit_array_narrow(a, n, v, &base);
+  const __m128i sign = _mm_set1_epi64x(_CRITBIT_SIGN_BIT);
+  const __m128i key = _mm_xor_si128(_mm_set1_epi64x((long long)v), sign);
+  __m128i count = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 2 <= len; i += 2) {
+    const __m128i x = _mm_xor_si128(
+        _mm_loadu_si128((const __m128i *)&a[base + i]), sign);
+    /* Lanes with items less than v are -1. */
+    count = _mm_sub_epi64(count, _mm_cmpgt_epi64(key, x));
+  }
+  const size_t simd_count = (size_t)_mm_cvtsi128_si64(count) +
+      (size_t)_mm_extract_epi64(count, 1);
+  return base + simd_count +
+      _critbit_array_count_less_scalar(a + base + i, len - i, v);
+}
+
+_CRITBIT_TARGET("avx2")
+static inline size_t _critbit_array_find_avx2(const uintptr_t *const a,
+    const size_t n, const uintptr_t v)
+{
+  const __m256i key = _mm256_set1_epi64x((long long)v);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256i eq = _mm256_cmpeq_epi64(
+        _mm256_loadu_si256((const __m256i *)&a[i]), key);
+    const int mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+    if (mask != 0) {
+      return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+  }
+  return i + _critbit_array_find_scalar(a + i, n - i, v);
+}
+
+_CRITBIT_TARGET("avx2")
+static inline size_t _critbit_array_lower_bound_avx2(
+    const uintptr_t *const a, const size_t n, const uintptr_t v)
+{
+  size_t base;
+  const size_t len = _critbit_array_narrow(a, n, v, &base);
+  const __m256i sign = _mm256_set1_epi64x(_CRITBIT_SIGN_BIT);
+  const __m256i key = _mm256_xor_si256(_mm256_set1_epi64x((long long)v),
+      sign);
+  __m256i count = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    const __m256i x = _mm256_xor_si256(
+        _mm256_loadu_si256((const __m256i *)&a[base + i]), sign);
+    count = _mm256_sub_epi64(count, _mm256_cmpgt_epi64(key, x));
+  }
+  const __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(count),
+      _mm256_extracti128_si256(count, 1));
+  const size_t simd_count = (size_t)_mm_cvtsi128_si64(sum) +
+      (size_t)_mm_extract_epi64(sum, 1);
+  return base + simd_count +
+      _critbit_array_count_less_scalar(a + base + i, len - i, v);
+}
+
+/* AVX-512 has unsigned compares and masked loads, so tails need no loop. */
+_CRITBIT_TARGET("avx512f")
+static inline size_t _critbit_array_find_avx512(const uintptr_t *const a,
+    const size_t n, const uintptr_t v)
+{
+  const __m512i key = _mm512_set1_epi64((long long)v);
+  for (size_t i = 0; i < n; i += 8) {
+    const __mmask8 load_mask = (n - i >= 8) ?
+        (__mmask8)0xff : (__mmask8)((1u << (n - i)) - 1);
+    const __mmask8 mask = _mm512_mask_cmpeq_epu64_mask(load_mask,
+        _mm512_maskz_loadu_epi64(load_mask, &a[i]), key);
+    if (mask != 0) {
+      return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+  }
+  return n;
+}
+
+_CRITBIT_TARGET("avx512f")
+static inline size_t _critbit_array_lower_bound_avx512(
+    const uintptr_t *const a, const size_t n, const uintptr_t v)
+{
+  size_t base;
+  const size_t len = _critbit_array_narrow(a, n, v, &base);
+  const __m512i key = _mm512_set1_epi64((long long)v);
+  size_t count = 0;
+  for (size_t i = 0; i < len; i += 8) {
+    const __mmask8 load_mask = (len - i >= 8) ?
+        (__mmask8)0xff : (__mmask8)((1u << (len - i)) - 1);
+    const __mmask8 mask = _mm512_mask_cmplt_epu64_mask(load_mask,
+        _mm512_maskz_loadu_epi64(load_mask, &a[base + i]), key);
+    count += (size_t)__builtin_popcount((unsigned)mask);
+  }
+  return base + count;
+}
+#endif
+
+#if defined(_CRITBIT_NEON_SIMD)
+static inline size_t _critbit_array_find_neon(const uintptr_t *const a,
+    const size_t n, const uintptr_t v)
+{
+  const uint64x2_t key = vdupq_n_u64(v);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    const uint64x2_t eq = vceqq_u64(vld1q_u64((const uint64_t *)&a[i]), key);
+    if (vgetq_lane_u64(eq, 0) != 0) {
+      return i;
+    }
+    if (vgetq_lane_u64(eq, 1) != 0) {
+      return i + 1;
+    }
+  }
+  return i + _critbit_array_find_scalar(a + i, n - i, v);
+}
+
+static inline size_t _critbit_array_lower_bound_neon(
+    const uintptr_t *const a, const size_t n, const uintptr_t v)
+{
+  size_t base;
+  const size_t len = _critbit_array_narrow(a, n, v, &base);
+  const uint64x2_t key = vdupq_n_u64(v);
+  uint64x2_t count = vdupq_n_u64(0);
+  size_t i = 0;
+  for (; i + 2 <= len; i += 2) {
+    const uint64x2_t x = vld1q_u64((const uint64_t *)&a[base + i]);
+    /* Lanes with items less than v are all ones, i.e. -1. */
+    count = vsubq_u64(count, vcltq_u64(x, key));
+  }
+  return base + (size_t)vaddvq_u64(count) +
+      _critbit_array_count_less_scalar(a + base + i, len - i, v);
+}
+#endif
+
+/* Array search kernels for an instruction set. */
+struct _critbit_array_kernels
+{
+  const char *isa;
+  int (*is_supported)(void);
+  size_t (*find)(const uintptr_t *a, size_t n, uintptr_t v);
+  size_t (*lower_bound)(const uintptr_t *a, size_t n, uintptr_t v);
+};
+
+static inline int _critbit_is_supported_always(void)
+{
+  return 1;
+}
+
+#if defined(_CRITBIT_X86_SIMD)
+static inline int _critbit_is_supported_sse42(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.2");
+}
+
+static inline int _critbit_is_supported_avx2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+static inline int _critbit_is_supported_avx512(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx512f");
+}
+#endif
+
+/* Kernels from the widest to the narrowest instruction set. */
+static const struct _critbit_array_kernels _CRITBIT_ARRAY_KERNELS[] = {
+#if defined(_CRITBIT_X86_SIMD)
+  {
+    "avx512", &_critbit_is_supported_avx512, &_critbit_array_find_avx512,
+    &_critbit_array_lower_bound_avx512,
+  },
+  {
+    "avx2", &_critbit_is_supported_avx2, &_critbit_array_find_avx2,
+    &_critbit_array_lower_bound_avx2,
+  },
+  {
+    "sse4.2", &_critbit_is_supported_sse42, &_critbit_array_find_sse42,
+    &_critbit_array_lower_bound_sse42,
+  },
+#elif defined(_CRITBIT_NEON_SIMD)
+  {
+    "neon", &_critbit_is_supported_always, &_critbit_array_find_neon,
+    &_critbit_array_lower_bound_neon,
+  },
+#endif
+  {
+    "scalar", &_critbit_is_supported_always, &_critbit_array_find_scalar,
+    &_critbit_array_lower_bound_scalar,
+  },
+};
+
+#define _CRITBIT_ARRAY_KERNELS_COUNT \
+    (sizeof(_CRITBIT_ARRAY_KERNELS) / sizeof(_CRITBIT_ARRAY_KERNELS[0]))
+
+/*
+ * Returns kernels for the widest instruction set supported by the CPU.
+ * The choice is cached after the first call. Concurrent first calls store
+ * the same value, so relaxed atomics are enough.
+ */
+static inline const struct _critbit_array_kernels *_critbit_get_array_kernels(
+    void)
+{
+#if defined(_CRITBIT_X86_SIMD)
+  static const struct _critbit_array_kernels *kernels = NULL;
+  const struct _critbit_array_kernels *k = __atomic_load_n(&kernels,
+      __ATOMIC_RELAXED);
+  if (k != NULL) {
+    return k;
+  }
+  k = &_CRITBIT_ARRAY_KERNELS[_CRITBIT_ARRAY_KERNELS_COUNT - 1];
+  for (size_t i = 0; i < _CRITBIT_ARRAY_KERNELS_COUNT; ++i) {
+    if (_CRITBIT_ARRAY_KERNELS[i].is_supported()) {
+      k = &_CRITBIT_ARRAY_KERNELS[i];
+      break;
+    }
+  }
+  __atomic_store_n(&kernels, k, __ATOMIC_RELAXED);
+  return k;
+#else
+  /* The first kernels are always supported. */
+  return &_CRITBIT_ARRAY_KERNELS[0];
+#endif
+}
+
+static inline size_t critbit_array_find(const uintptr_t *const a,
+    const size_t n, const uintptr_t v)
+{
+  return _critbit_get_array_kernels()->find(a, n, v);
+}
+
+static inline size_t critbit_array_lower_bound(const uintptr_t *const a,
+    const size_t n, const uintptr_t v)
+{
+  return _critbit_get_array_kernels()->lower_bound(a, n, v);
+}
+
+static inline const char *critbit_array_get_isa(void)
+{
+  return _critbit_get_array_kernels()->isa;
+}
+
+static const size_t _CRITBIT_CACHE_LINE_SIZE = 64;
+static const size_t _CRITBIT_SLAB_SIZE = 64 * 1024;
+
+/*
+ * Each slab starts with a cache line holding the slab header, while nodes
+ * occupy the rest of the slab.
+ */
+struct _critbit_slab
+{
+  struct _critbit_slab *next;
+  void *memory;
+};
+
+/* Released nodes are linked via their first bytes. */
+struct _critbit_free_node
+{
+  struct _critbit_free_node *next;
+};
+
+static inline void _critbit_slab_allocator_add_slab(
+    struct critbit_slab_allocator *const s)
+{
+  char *const memory = malloc(_CRITBIT_SLAB_SIZE + _CRITBIT_CACHE_LINE_SIZE);
+  const uintptr_t offset = (uintptr_t)memory % _CRITBIT_CACHE_LINE_SIZE;
+  char *const start = memory + (_CRITBIT_CACHE_LINE_SIZE - offset);
+  assert((uintptr_t)start % _CRITBIT_CACHE_LINE_SIZE == 0);
+
+  struct _critbit_slab *const slab = (struct _critbit_slab *)start;
+  slab->next = s->slabs;
+  slab->memory = memory;
+  s->slabs = slab;
+  s->next_node = start + _CRITBIT_CACHE_LINE_SIZE;
+  s->slab_free_bytes = _CRITBIT_SLAB_SIZE - _CRITBIT_CACHE_LINE_SIZE;
+}
+
+static inline void *_critbit_slab_alloc_node(void *const ctx)
+{
+  struct critbit_slab_allocator *const s = ctx;
+
+  struct _critbit_free_node *const free_node = s->free_nodes;
+  if (free_node != NULL) {
+    s->free_nodes = free_node->next;
+    return free_node;
+  }
+
+  if (s->slab_free_bytes < s->node_size) {
+    _critbit_slab_allocator_add_slab(s);
+  }
+  void *const node = s->next_node;
+  s->next_node += s->node_size;
+  s->slab_free_bytes -= s->node_size;
+  return node;
+}
+
+static inline void _critbit_slab_free_node(void *const ctx, void *const node)
+{
+  struct critbit_slab_allocator *const s = ctx;
+  struct _critbit_free_node *const free_node = node;
+
+  free_node->next = s->free_nodes;
+  s->free_nodes = free_node;
+}
+
+static inline void _critbit_slab_release_all_nodes(void *const ctx)
+{
+  struct critbit_slab_allocator *const s = ctx;
+
+  struct _critbit_slab *slab = s->slabs;
+  while (slab != NULL) {
+    struct _critbit_slab *const next = slab->next;
+    free(slab->memory);
+    slab = next;
+  }
+  s->slabs = NULL;
+  s->free_nodes = NULL;
+  s->next_node = NULL;
+  s->slab_free_bytes = 0;
+}
+
+static inline void critbit_slab_allocator_init(
+    struct critbit_slab_allocator *const s, const size_t node_size)
+{
+  assert(node_size >= sizeof(struct _critbit_free_node));
+  assert(node_size <= _CRITBIT_SLAB_SIZE - _CRITBIT_CACHE_LINE_SIZE);
+
+  s->node_allocator.alloc_node = &_critbit_slab_alloc_node;
+  s->node_allocator.free_node = &_critbit_slab_free_node;
+  s->node_allocator.ctx = s;
+  s->node_allocator.release_all_nodes = NULL;
+  s->node_allocator.retire_node = NULL;
+  s->slabs = NULL;
+  s->free_nodes = NULL;
+  s->next_node = NULL;
+  s->slab_free_bytes = 0;
+
+  /* Keep nodes properly aligned for pointers. */
+  const size_t alignment = sizeof(void *);
+  s->node_size = (node_size + alignment - 1) / alignment * alignment;
+}
+
+static inline void critbit_slab_allocator_set_exclusive(
+    struct critbit_slab_allocator *const s)
+{
+  s->node_allocator.release_all_nodes = &_critbit_slab_release_all_nodes;
+}
+
+static inline void critbit_slab_allocator_destroy(
+    struct critbit_slab_allocator *const s)
 {
-  _critbit_visit(visitor, cb->root);
+  _critbit_slab_release_all_nodes(s);
 }
 
 #endif
@@ -0,0 +1,885 @@
+#ifndef CRITBIT_HPP
+#define CRITBIT_HPP
+
+/*
+ * Header-only crit-bit template for C++11, which doesn't depend on critbit.h.
+ *
+ * critbits::critbit<Key, Allocator> is a sorted set of keys with an interface
+ * similar to std::set. Node allocation goes through Allocator and visitors
+ * are template arguments, so both are inlined by the compiler instead
+ * of being called via function pointers like struct critbit_node_allocator
+ * and struct critbit_visitor callbacks. Nodes are laid out like
+ * CRITBIT_ANY_KEYS nodes, so keys may take any value including zero.
+ *
+ * Usage:
+ *
+ *   critbits::critbit<std::uint64_t> cb;
+ *   cb.insert(42);
+ *   for (const std::uint64_t v : cb) {
+ *     ...
+ *   }
+ *
+ * Unlike std::set, any modification invalidates all the iterators.
+ */
+
+#include <cassert>
+#include <cstddef>  /* for std::size_t */
+#include <cstdint>  /* for std::uint*_t */
+#include <iterator>
+#include <limits>
+#include <memory>  /* for std::allocator */
+#include <type_traits>
+#include <utility>  /* for std::move/std::swap */
+
+namespace critbits {
+
+/*
+ * Maps keys to unsigned integers of bits width, which compare in the same
+ * order as keys. Specialize it in order to use custom keys. bits must equal
+ * std::numeric_limits<bits_type>::digits. bool keys aren't supported.
+ */
+template <typename Key, typename Enable = void>
+struct key_traits;
+
+template <typename Key>
+struct key_traits<Key,
+    typename std::enable_if<std::is_unsigned<Key>::value &&
+        !std::is_same<Key, bool>::value>::type>
+{
+  typedef Key bits_type;
+  static constexpr unsigned bits = std::numeric_limits<bits_type>::digits;
+
+  static constexpr bits_type to_bits(const Key k)
+  {
+    return k;
+  }
+
+  static constexpr Key from_bits(const bits_type b)
+  {
+    return b;
+  }
+};
+
+/* Flipping the sign bit orders negative keys before non-negative ones. */
+template <typename Key>
+struct key_traits<Key, typename std::enable_if<std::is_integral<Key>::value &&
+    std::is_signed<Key>::value>::type>
+{
+  typedef typename std::make_unsigned<Key>::type bits_type;
+  static constexpr unsigned bits = std::numeric_limits<bits_type>::digits;
+
+  static constexpr bits_type to_bits(const Key k)
+  {
+    return static_cast<bits_type>(static_cast<bits_type>(k) ^ sign_bit());
+  }
+
+  static constexpr Key from_bits(const bits_type b)
+  {
+    return static_cast<Key>(static_cast<bits_type>(b ^ sign_bit()));
+  }
+
+private:
+  static constexpr bits_type sign_bit()
+  {
+    return static_cast<bits_type>(static_cast<bits_type>(1) << (bits - 1));
+  }
+};
+
+/* Pointers are ordered by their addresses. */
+template <typename T>
+struct key_traits<T *>
+{
+  typedef std::uintptr_t bits_type;
+  static constexpr unsigned bits = std::numeric_limits<bits_type>::digits;
+
+  static bits_type to_bits(T *const p)
+  {
+    return reinterpret_cast<bits_type>(p);
+  }
+
+  static T *from_bits(const bits_type b)
+  {
+    return reinterpret_cast<T *>(b);
+  }
+};
+
+namespace detail {
+
+/* Returns the number of leading zero bits in x, which must be non-zero. */
+template <typename Bits>
+inline unsigned count_leading_zeros(const Bits x)
+{
+  static_assert(std::is_unsigned<Bits>::value, "Bits must be unsigned");
+  static const unsigned bits = std::numeric_limits<Bits>::digits;
+  assert(x != 0);
+
+#if defined(__GNUC__)
+  if (bits <= std::numeric_limits<unsigned long long>::digits) {
+    return static_cast<unsigned>(__builtin_clzll(x)) -
+        (std::numeric_limits<unsigned long long>::digits - bits);
+  }
+#endif
+  unsigned n = 0;
+  while (((x >> (bits - 1 - n)) & 1) == 0) {
+    ++n;
+  }
+  return n;
+}
+
+}  /* namespace detail */
+
+template <typename Key, typename Allocator = std::allocator<Key> >
+class critbit
+{
+public:
+  typedef Key key_type;
+  typedef Key value_type;
+  typedef std::size_t size_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef Allocator allocator_type;
+  typedef key_traits<Key> traits_type;
+
+  class const_iterator;
+  typedef const_iterator iterator;
+  typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+  typedef const_reverse_iterator reverse_iterator;
+  class node_type;
+
+private:
+  typedef typename traits_type::bits_type bits_type;
+  static constexpr unsigned key_bits = traits_type::bits;
+  static_assert(key_bits <= 256, "crit bits must fit uint8_t");
+  static_assert(key_bits == std::numeric_limits<bits_type>::digits,
+      "key_traits::bits must match the width of bits_type");
+
+  struct node;
+
+  union slot
+  {
+    node *child;
+    bits_type key;
+  };
+
+  /* Bit i of kinds is set if next[i] is a node. */
+  struct node
+  {
+    slot next[2];
+    std::uint8_t crit_bit;
+    std::uint8_t kinds;
+  };
+
+  typedef typename std::allocator_traits<Allocator>::template
+      rebind_alloc<node> node_allocator;
+  typedef std::allocator_traits<node_allocator> node_alloc_traits;
+  static_assert(std::is_same<typename node_alloc_traits::pointer,
+      node *>::value, "fancy pointers aren't supported");
+
+  /* A location, which refers to a subtree, like struct _critbit_slot. */
+  struct slot_ref
+  {
+    slot *v;
+    std::uint8_t *kinds;
+    unsigned index;
+
+    bool is_node() const
+    {
+      return ((*kinds >> index) & 1) != 0;
+    }
+
+    void set(const slot s, const bool s_is_node)
+    {
+      *v = s;
+      const unsigned mask = 1u << index;
+      *kinds = static_cast<std::uint8_t>((*kinds & ~mask) |
+          (s_is_node ? mask : 0));
+    }
+  };
+
+public:
+  /*
+   * Iterators store the path from the root like struct critbit_cursor,
+   * so they don't need parent pointers in nodes. They return keys
+   * by value, since leaves hold key bits instead of keys.
+   */
+  class const_iterator
+  {
+  public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef Key value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Key *pointer;
+    typedef Key reference;
+
+    const_iterator() : tree_(nullptr), depth_(0), at_end_(true), bits_()
+    {
+    }
+
+    reference operator*() const
+    {
+      assert(!at_end_);
+      return traits_type::from_bits(bits_);
+    }
+
+    const_iterator &operator++()
+    {
+      step(1);
+      return *this;
+    }
+
+    const_iterator operator++(int)
+    {
+      const_iterator it = *this;
+      step(1);
+      return it;
+    }
+
+    /* Decrementing end() moves to the largest item. */
+    const_iterator &operator--()
+    {
+      step(0);
+      return *this;
+    }
+
+    const_iterator operator--(int)
+    {
+      const_iterator it = *this;
+      step(0);
+      return it;
+    }
+
+    friend bool operator==(const const_iterator &a, const const_iterator &b)
+    {
+      return a.tree_ == b.tree_ && a.at_end_ == b.at_end_ &&
+          (a.at_end_ || a.bits_ == b.bits_);
+    }
+
+    friend bool operator!=(const const_iterator &a, const const_iterator &b)
+    {
+      return !(a == b);
+    }
+
+  private:
+    friend class critbit;
+
+    explicit const_iterator(const critbit *const tree) : tree_(tree),
+        depth_(0), at_end_(true), bits_()
+    {
+    }
+
+    /* Descends from the subtree s to its leaf along the given side. */
+    void descend(slot s, bool is_node, const unsigned side)
+    {
+      while (is_node) {
+        const node *const n = s.child;
+        assert(depth_ < key_bits);
+        path_[depth_++] = n;
+        s = n->next[side];
+        is_node = ((n->kinds >> side) & 1) != 0;
+      }
+      bits_ = s.key;
+      at_end_ = false;
+    }
+
+    /* Moves to the next item if dir is 1, otherwise to the previous one. */
+    void step(const unsigned dir)
+    {
+      assert(tree_ != nullptr);
+      if (at_end_) {
+        assert(dir == 0 && tree_->size_ > 0);
+        depth_ = 0;
+        descend(tree_->root_, tree_->root_is_node(), 1);
+        return;
+      }
+      while (depth_ > 0) {
+        const node *const n = path_[depth_ - 1];
+        if (get_bit(bits_, n->crit_bit) != dir) {
+          descend(n->next[dir], ((n->kinds >> dir) & 1) != 0, dir ^ 1);
+          return;
+        }
+        --depth_;
+      }
+      assert(dir == 1);
+      at_end_ = true;
+    }
+
+    const critbit *tree_;
+    const node *path_[key_bits];
+    unsigned depth_;
+    bool at_end_;
+    bits_type bits_;
+  };
+
+  /*
+   * Owns an extracted key together with the node, which was released
+   * by its removal, so inserting it into a crit-bit with an equal
+   * allocator doesn't allocate memory.
+   */
+  class node_type
+  {
+  public:
+    node_type() : node_(nullptr), key_(), has_value_(false), alloc_()
+    {
+    }
+
+    node_type(node_type &&other) noexcept : node_(other.node_),
+        key_(other.key_), has_value_(other.has_value_),
+        alloc_(std::move(other.alloc_))
+    {
+      other.node_ = nullptr;
+      other.has_value_ = false;
+    }
+
+    node_type &operator=(node_type &&other) noexcept
+    {
+      if (this != &other) {
+        release();
+        node_ = other.node_;
+        key_ = other.key_;
+        has_value_ = other.has_value_;
+        alloc_ = std::move(other.alloc_);
+        other.node_ = nullptr;
+        other.has_value_ = false;
+      }
+      return *this;
+    }
+
+    node_type(const node_type &) = delete;
+    node_type &operator=(const node_type &) = delete;
+
+    ~node_type()
+    {
+      release();
+    }
+
+    bool empty() const noexcept
+    {
+      return !has_value_;
+    }
+
+    explicit operator bool() const noexcept
+    {
+      return has_value_;
+    }
+
+    /* The key may be changed before the node is inserted. */
+    Key &value()
+    {
+      assert(has_value_);
+      return key_;
+    }
+
+    const Key &value() const
+    {
+      assert(has_value_);
+      return key_;
+    }
+
+    allocator_type get_allocator() const
+    {
+      return allocator_type(alloc_);
+    }
+
+  private:
+    friend class critbit;
+
+    void release()
+    {
+      if (node_ != nullptr) {
+        node_alloc_traits::deallocate(alloc_, node_, 1);
+        node_ = nullptr;
+      }
+      has_value_ = false;
+    }
+
+    /* NULL if the key was the only item of its crit-bit. */
+    node *node_;
+    Key key_;
+    bool has_value_;
+    node_allocator alloc_;
+  };
+
+  critbit() : root_(), root_kinds_(0), size_(0), alloc_()
+  {
+  }
+
+  explicit critbit(const Allocator &alloc) : root_(), root_kinds_(0),
+      size_(0), alloc_(alloc)
+  {
+  }
+
+  /*
+   * Copies items one by one, so a failed allocation can't leave
+   * a half-built tree behind.
+   */
+  critbit(const critbit &other) : critbit(Allocator(
+      node_alloc_traits::select_on_container_copy_construction(other.alloc_)))
+  {
+    other.for_each([this](const Key &key) {
+      insert(key);
+    });
+  }
+
+  critbit(critbit &&other) noexcept : root_(other.root_),
+      root_kinds_(other.root_kinds_), size_(other.size_),
+      alloc_(std::move(other.alloc_))
+  {
+    other.root_kinds_ = 0;
+    other.size_ = 0;
+  }
+
+  critbit &operator=(const critbit &other)
+  {
+    if (this != &other) {
+      critbit copy(other);
+      swap(copy);
+    }
+    return *this;
+  }
+
+  critbit &operator=(critbit &&other) noexcept
+  {
+    if (this != &other) {
+      clear();
+      root_ = other.root_;
+      root_kinds_ = other.root_kinds_;
+      size_ = other.size_;
+      alloc_ = std::move(other.alloc_);
+      other.root_kinds_ = 0;
+      other.size_ = 0;
+    }
+    return *this;
+  }
+
+  ~critbit()
+  {
+    clear();
+  }
+
+  allocator_type get_allocator() const
+  {
+    return allocator_type(alloc_);
+  }
+
+  bool empty() const noexcept
+  {
+    return size_ == 0;
+  }
+
+  size_type size() const noexcept
+  {
+    return size_;
+  }
+
+  /* Releases all the nodes iteratively with a stack bounded by key bits. */
+  void clear() noexcept
+  {
+    if (root_is_node()) {
+      node *stack[key_bits];
+      std::size_t depth = 0;
+      node *n = root_.child;
+      for (;;) {
+        node *const left = ((n->kinds & 1) != 0) ? n->next[0].child : nullptr;
+        if ((n->kinds & 2) != 0) {
+          assert(depth < key_bits);
+          stack[depth++] = n->next[1].child;
+        }
+        node_alloc_traits::deallocate(alloc_, n, 1);
+        if (left != nullptr) {
+          n = left;
+        }
+        else if (depth > 0) {
+          n = stack[--depth];
+        }
+        else {
+          break;
+        }
+      }
+    }
+    root_kinds_ = 0;
+    size_ = 0;
+  }
+
+  void swap(critbit &other) noexcept
+  {
+    using std::swap;
+    swap(root_, other.root_);
+    swap(root_kinds_, other.root_kinds_);
+    swap(size_, other.size_);
+    swap(alloc_, other.alloc_);
+  }
+
+  /* Adds key. Returns true on success, false if key already exists. */
+  bool insert(const Key &key)
+  {
+    node *spare = nullptr;
+    return insert_bits(traits_type::to_bits(key), spare);
+  }
+
+  /*
+   * Inserts the key owned by nh reusing its node. nh becomes empty
+   * on success and keeps its key otherwise. nh must come from
+   * a crit-bit with an equal allocator.
+   */
+  bool insert(node_type &&nh)
+  {
+    if (nh.empty()) {
+      return false;
+    }
+    assert(nh.alloc_ == alloc_);
+    node *spare = nh.node_;
+    if (!insert_bits(traits_type::to_bits(nh.key_), spare)) {
+      return false;
+    }
+
+    /* The node isn't needed if the crit-bit was empty. */
+    nh.node_ = spare;
+    nh.release();
+    return true;
+  }
+
+  /* Removes key. Returns the number of removed items, i.e. 0 or 1. */
+  size_type erase(const Key &key)
+  {
+    node *released;
+    if (!erase_bits(traits_type::to_bits(key), released)) {
+      return 0;
+    }
+    if (released != nullptr) {
+      node_alloc_traits::deallocate(alloc_, released, 1);
+    }
+    return 1;
+  }
+
+  /*
+   * Removes key and returns it together with its node. Returns an empty
+   * node handle if key doesn't exist.
+   */
+  node_type extract(const Key &key)
+  {
+    node_type nh;
+    if (erase_bits(traits_type::to_bits(key), nh.node_)) {
+      nh.key_ = key;
+      nh.has_value_ = true;
+      nh.alloc_ = alloc_;
+    }
+    return nh;
+  }
+
+  node_type extract(const const_iterator pos)
+  {
+    assert(pos.tree_ == this && !pos.at_end_);
+    return extract(*pos);
+  }
+
+  bool contains(const Key &key) const
+  {
+    if (size_ == 0) {
+      return false;
+    }
+    const bits_type k = traits_type::to_bits(key);
+    slot s = root_;
+    bool is_node = root_is_node();
+    while (is_node) {
+      const node *const n = s.child;
+      const unsigned index = get_bit(k, n->crit_bit);
+      s = n->next[index];
+      is_node = ((n->kinds >> index) & 1) != 0;
+    }
+    return s.key == k;
+  }
+
+  size_type count(const Key &key) const
+  {
+    return contains(key) ? 1 : 0;
+  }
+
+  const_iterator find(const Key &key) const
+  {
+    const_iterator it(this);
+    if (size_ == 0) {
+      return it;
+    }
+    const bits_type k = traits_type::to_bits(key);
+    slot s = root_;
+    bool is_node = root_is_node();
+    while (is_node) {
+      const node *const n = s.child;
+      it.path_[it.depth_++] = n;
+      const unsigned index = get_bit(k, n->crit_bit);
+      s = n->next[index];
+      is_node = ((n->kinds >> index) & 1) != 0;
+    }
+    if (s.key == k) {
+      it.descend(s, false, 0);
+    }
+    return it;
+  }
+
+  /* Returns an iterator to the first item, which isn't less than key. */
+  const_iterator lower_bound(const Key &key) const
+  {
+    return seek(traits_type::to_bits(key), false);
+  }
+
+  /* Returns an iterator to the first item, which is greater than key. */
+  const_iterator upper_bound(const Key &key) const
+  {
+    return seek(traits_type::to_bits(key), true);
+  }
+
+  const_iterator begin() const
+  {
+    const_iterator it(this);
+    if (size_ > 0) {
+      it.descend(root_, root_is_node(), 0);
+    }
+    return it;
+  }
+
+  const_iterator end() const
+  {
+    return const_iterator(this);
+  }
+
+  const_iterator cbegin() const
+  {
+    return begin();
+  }
+
+  const_iterator cend() const
+  {
+    return end();
+  }
+
+  const_reverse_iterator rbegin() const
+  {
+    return const_reverse_iterator(end());
+  }
+
+  const_reverse_iterator rend() const
+  {
+    return const_reverse_iterator(begin());
+  }
+
+  /*
+   * Calls visitor(key) for each item in ascending order. The visitor is
+   * inlined, so this is faster than iterating.
+   * Do not modify crit-bit in visitor!
+   */
+  template <typename Visitor>
+  void for_each(Visitor &&visitor) const
+  {
+    if (size_ == 0) {
+      return;
+    }
+
+    /* Nodes with right subtrees, which are waiting for a visit. */
+    const node *stack[key_bits];
+    std::size_t depth = 0;
+    slot s = root_;
+    bool is_node = root_is_node();
+    for (;;) {
+      while (is_node) {
+        const node *const n = s.child;
+        assert(depth < key_bits);
+        stack[depth++] = n;
+        s = n->next[0];
+        is_node = (n->kinds & 1) != 0;
+      }
+      visitor(traits_type::from_bits(s.key));
+      if (depth == 0) {
+        break;
+      }
+      const node *const n = stack[--depth];
+      s = n->next[1];
+      is_node = (n->kinds & 2) != 0;
+    }
+  }
+
+private:
+  static unsigned get_bit(const bits_type k, const unsigned crit_bit)
+  {
+    assert(crit_bit < key_bits);
+    return static_cast<unsigned>((k >> (key_bits - 1 - crit_bit)) & 1);
+  }
+
+  bool root_is_node() const
+  {
+    return (root_kinds_ & 1) != 0;
+  }
+
+  slot_ref root_ref()
+  {
+    slot_ref ref = {&root_, &root_kinds_, 0};
+    return ref;
+  }
+
+  static slot_ref child_ref(node *const n, const unsigned index)
+  {
+    slot_ref ref = {&n->next[index], &n->kinds, index};
+    return ref;
+  }
+
+  /*
+   * Adds k. The new node is taken from spare, which is cleared then,
+   * unless spare is NULL. Returns false if k already exists.
+   */
+  bool insert_bits(const bits_type k, node *&spare)
+  {
+    if (size_ == 0) {
+      root_.key = k;
+      root_kinds_ = 0;
+      size_ = 1;
+      return true;
+    }
+
+    slot s = root_;
+    bool is_node = root_is_node();
+    while (is_node) {
+      const node *const n = s.child;
+      const unsigned index = get_bit(k, n->crit_bit);
+      s = n->next[index];
+      is_node = ((n->kinds >> index) & 1) != 0;
+    }
+    if (s.key == k) {
+      return false;
+    }
+
+    /* The new node goes above the first node with a greater crit bit. */
+    const unsigned crit_bit = detail::count_leading_zeros(
+        static_cast<bits_type>(s.key ^ k));
+    slot_ref ref = root_ref();
+    while (ref.is_node()) {
+      node *const n = ref.v->child;
+      if (n->crit_bit > crit_bit) {
+        break;
+      }
+      ref = child_ref(n, get_bit(k, n->crit_bit));
+    }
+
+    node *n = spare;
+    if (n != nullptr) {
+      spare = nullptr;
+    }
+    else {
+      n = node_alloc_traits::allocate(alloc_, 1);
+    }
+    const unsigned index = get_bit(k, crit_bit);
+    n->crit_bit = static_cast<std::uint8_t>(crit_bit);
+    n->next[index].key = k;
+    n->next[index ^ 1] = *ref.v;
+    n->kinds = static_cast<std::uint8_t>(
+        (ref.is_node() ? 1u : 0u) << (index ^ 1));
+    slot child;
+    child.child = n;
+    ref.set(child, true);
+    ++size_;
+    return true;
+  }
+
+  /*
+   * Removes k and stores the unlinked node into released, unless k was
+   * the only item. Returns false if k doesn't exist.
+   */
+  bool erase_bits(const bits_type k, node *&released)
+  {
+    released = nullptr;
+    if (size_ == 0) {
+      return false;
+    }
+
+    slot_ref prev = {nullptr, nullptr, 0};
+    slot_ref ref = root_ref();
+    while (ref.is_node()) {
+      prev = ref;
+      node *const n = ref.v->child;
+      ref = child_ref(n, get_bit(k, n->crit_bit));
+    }
+    if (ref.v->key != k) {
+      return false;
+    }
+
+    if (prev.v == nullptr) {
+      root_kinds_ = 0;
+    }
+    else {
+      node *const parent = prev.v->child;
+      const unsigned sibling = ref.index ^ 1;
+      prev.set(parent->next[sibling], ((parent->kinds >> sibling) & 1) != 0);
+      released = parent;
+    }
+    --size_;
+    return true;
+  }
+
+  /*
+   * Returns an iterator to the first item greater than k if is_strict
+   * is set, otherwise to the first item greater or equal to k.
+   */
+  const_iterator seek(const bits_type k, const bool is_strict) const
+  {
+    const_iterator it(this);
+    if (size_ == 0) {
+      return it;
+    }
+
+    slot s = root_;
+    bool is_node = root_is_node();
+    while (is_node) {
+      const node *const n = s.child;
+      const unsigned index = get_bit(k, n->crit_bit);
+      s = n->next[index];
+      is_node = ((n->kinds >> index) & 1) != 0;
+    }
+    const bits_type leaf = s.key;
+    const unsigned crit_bit = (leaf == k) ? key_bits :
+        detail::count_leading_zeros(static_cast<bits_type>(leaf ^ k));
+
+    /*
+     * Items in the subtree below nodes with smaller crit bits share their
+     * prefix with k, so they all are either smaller or greater than k.
+     */
+    s = root_;
+    is_node = root_is_node();
+    while (is_node && s.child->crit_bit < crit_bit) {
+      const node *const n = s.child;
+      it.path_[it.depth_++] = n;
+      const unsigned index = get_bit(k, n->crit_bit);
+      s = n->next[index];
+      is_node = ((n->kinds >> index) & 1) != 0;
+    }
+    if (leaf == k) {
+      it.descend(s, false, 0);
+      if (is_strict) {
+        ++it;
+      }
+    }
+    else if (get_bit(k, crit_bit) == 0) {
+      it.descend(s, is_node, 0);
+    }
+    else {
+      it.descend(s, is_node, 1);
+      ++it;
+    }
+    return it;
+  }
+
+  slot root_;
+  std::uint8_t root_kinds_;
+  size_type size_;
+  node_allocator alloc_;
+};
+
+template <typename Key, typename Allocator>
+constexpr unsigned critbit<Key, Allocator>::key_bits;
+
+template <typename Key, typename Allocator>
+inline void swap(critbit<Key, Allocator> &a, critbit<Key, Allocator> &b)
+    noexcept
+{
+  a.swap(b);
+}
+
+}  /* namespace critbits */
+
+#endif
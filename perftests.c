@@ -1,3 +1,6 @@
+/* For clock_gettime() and syscall(). */
+#define _GNU_SOURCE
+
 #include "critbit.h"
 
 #include <assert.h>
@@ -5,11 +8,32 @@
 #include <stdint.h>  /* for uint*_t */
 #include <stdio.h>
 #include <stdlib.h>  /* for malloc()/free() */
-#include <time.h>    /* for clock() */
+#include <string.h>  /* for memset() */
+#include <time.h>    /* for clock_gettime() */
+
+#include <pthread.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Tests measure wall time with a monotonic clock. CPU time returned
+ * by clock() has too coarse resolution and doesn't add up for threads.
+ */
+static uint64_t get_ns(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000 + (uint64_t)t.tv_nsec;
+}
 
 static double get_time(void)
 {
-  return (double)clock() / CLOCKS_PER_SEC;
+  return get_ns() / 1e9;
 }
 
 static void print_performance(const double t, const size_t m)
@@ -38,84 +62,842 @@ static void sort_callback(void *const ctx, const uintptr_t v)
   data->a[data->offset++] = v;
 }
 
-struct free_list
+static size_t critbit_sort(uintptr_t *const a, const size_t n)
 {
-  struct free_list *next;
-};
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  struct critbit *const cb = critbit_create(&s.node_allocator);
+
+  size_t m = n;
+  for (size_t i = 0; i < n; ++i) {
+    if (!critbit_add(cb, a[i])) {
+      --m;
+    }
+  }
+
+  struct sort_data data = {
+    .a = a,
+    .offset = 0,
+  };
+  const struct critbit_visitor sort_visitor = {
+    .callback = &sort_callback,
+    .ctx = &data,
+  };
+  critbit_foreach(cb, &sort_visitor);
+  assert(data.offset == m);
+
+  critbit_delete(cb);
+  critbit_slab_allocator_destroy(&s);
+  return data.offset;
+}
 
-struct node_storage
+static const char *get_crit_bit_impl(void)
 {
-  char *node_arena;
-  size_t next_index;
-};
+#if defined(_CRITBIT_CLZ)
+  return "clz";
+#else
+  return "loop";
+#endif
+}
 
-static void *alloc_critbit_node(void *const ctx)
+static void test_crit_bit(const size_t m)
 {
-  struct node_storage *const s = (struct node_storage *)ctx;
-  void *const node = s->node_arena + (s->next_index * critbit_node_size());
-  ++(s->next_index);
-  return node;
+  static const size_t N = 1024;
+
+  printf("test_crit_bit(m=%zu)\n", m);
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * (N + 1));
+  srand(0);
+  init_array(a, N + 1);
+  for (size_t i = 0; i < N; ++i) {
+    if (a[i] == a[i + 1]) {
+      a[i + 1] += 2;
+    }
+  }
+
+  size_t sum = 0;
+  double start = get_time();
+  for (size_t i = 0; i < m / N; ++i) {
+    for (size_t j = 0; j < N; ++j) {
+      sum += _critbit_scan_first_set_bit(a[j] ^ a[j + 1]);
+    }
+  }
+  double end = get_time();
+  printf("  loop");
+  print_performance(end - start, m);
+
+  start = get_time();
+  for (size_t i = 0; i < m / N; ++i) {
+    for (size_t j = 0; j < N; ++j) {
+      sum -= _critbit_get_crit_bit(a[j], a[j + 1]);
+    }
+  }
+  end = get_time();
+  printf("  %s", get_crit_bit_impl());
+  print_performance(end - start, m);
+  assert(sum == 0);
+
+  free(a);
 }
 
-static void free_critbit_node(void *const ctx, void *const node)
+static void test_insert(const size_t n, const size_t m)
 {
-  (void)ctx;
-  (void)node;
-  /* do nothing */
+  printf("test_insert(n=%zu, m=%zu, crit_bit=%s)", n, m, get_crit_bit_impl());
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+
+  double total_time = 0;
+  srand(0);
+  for (size_t i = 0; i < m / n; ++i) {
+    init_array(a, n);
+    struct critbit_slab_allocator s;
+    critbit_slab_allocator_init(&s, critbit_node_size());
+    struct critbit *const cb = critbit_create(&s.node_allocator);
+    double start = get_time();
+    for (size_t j = 0; j < n; ++j) {
+      critbit_add(cb, a[j]);
+    }
+    double end = get_time();
+    total_time += end - start;
+    critbit_delete(cb);
+    critbit_slab_allocator_destroy(&s);
+  }
+  print_performance(total_time, m);
+
+  free(a);
 }
 
-static struct node_storage *create_node_storage(const size_t n)
+static const char *get_node_layout(void)
 {
-  const size_t node_size = critbit_node_size();
-  assert(node_size <= SIZE_MAX / (n - 1));
-  void *const node_arena = malloc(node_size * (n - 1));
+#if defined(CRITBIT_NODE_MASK)
+  return "mask";
+#elif defined(CRITBIT_COMPACT_NODES)
+  return "compact";
+#else
+  return "crit_bit";
+#endif
+}
 
-  struct node_storage *const s = malloc(sizeof(*s));
-  s->node_arena = node_arena;
-  s->next_index = 0;
-  return s;
+static void test_contains(const size_t n, const size_t m)
+{
+  printf("test_contains(n=%zu, m=%zu, layout=%s, node_size=%zu)", n, m,
+      get_node_layout(), critbit_node_size());
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  struct critbit *const cb = critbit_create(&s.node_allocator);
+
+  srand(0);
+  init_array(a, n);
+  for (size_t i = 0; i < n; ++i) {
+    critbit_add(cb, a[i]);
+  }
+
+  size_t found = 0;
+  double start = get_time();
+  for (size_t i = 0; i < m / n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      found += critbit_contains(cb, a[j]);
+    }
+  }
+  double end = get_time();
+  assert(found == (m / n) * n);
+  print_performance(end - start, m);
+
+  critbit_delete(cb);
+  critbit_slab_allocator_destroy(&s);
+  free(a);
 }
 
-static void delete_node_storage(struct node_storage *const s)
+static void test_compact(const size_t n, const size_t m)
 {
-  free(s->node_arena);
-  free(s);
+  printf("test_compact(n=%zu, m=%zu)\n", n, m);
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  struct critbit *const cb = critbit_create(&s.node_allocator);
+
+  /* Random churn scatters nodes over slabs via the free list. */
+  srand(0);
+  init_array(a, n);
+  for (size_t i = 0; i < n; ++i) {
+    critbit_add(cb, a[i]);
+  }
+  for (size_t i = 0; i < 4 * n; ++i) {
+    const size_t j = (size_t)rand() % n;
+    critbit_remove(cb, a[j]);
+    do {
+      a[j] = rand() * 2;
+    } while (a[j] == 0);
+    critbit_add(cb, a[j]);
+  }
+
+  struct critbit_slab_allocator compact_s;
+  critbit_slab_allocator_init(&compact_s, critbit_node_size());
+  double compact_time = 0;
+  for (int is_compact = 0; is_compact < 2; ++is_compact) {
+    if (is_compact) {
+      const double start = get_time();
+      critbit_compact(cb, &compact_s.node_allocator);
+      compact_time = get_time() - start;
+    }
+    size_t found = 0;
+    const double start = get_time();
+    for (size_t i = 0; i < m / n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        found += critbit_contains(cb, a[j]);
+      }
+    }
+    const double end = get_time();
+    printf(is_compact ? "  contains after compaction"
+        : "  contains after churn");
+    print_performance(end - start, m);
+  }
+  printf("  compact");
+  print_performance(compact_time, n);
+
+  critbit_delete(cb);
+  critbit_slab_allocator_destroy(&compact_s);
+  critbit_slab_allocator_destroy(&s);
+  free(a);
 }
 
-static size_t critbit_sort(uintptr_t *const a, const size_t n)
+static void test_mapped_contains(const size_t n, const size_t m)
 {
-  struct node_storage *const s = create_node_storage(n);
+  printf("test_mapped_contains(n=%zu, m=%zu)", n, m);
 
-  const struct critbit_node_allocator node_allocator = {
-    .alloc_node = &alloc_critbit_node,
-    .free_node = &free_critbit_node,
-    .ctx = s,
-  };
-  struct critbit *const cb = critbit_create(&node_allocator);
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  struct critbit *const cb = critbit_create(&s.node_allocator);
 
-  size_t m = n;
+  srand(0);
+  init_array(a, n);
   for (size_t i = 0; i < n; ++i) {
-    if (!critbit_add(cb, a[i])) {
-      --m;
+    critbit_add(cb, a[i]);
+  }
+  const size_t size = critbit_serialize(cb, NULL, 0);
+  void *const buf = malloc(size);
+  critbit_serialize(cb, buf, size);
+  critbit_delete(cb);
+  critbit_slab_allocator_destroy(&s);
+  struct critbit_mapped mapped;
+  if (!critbit_open_mapped(&mapped, buf, size)) {
+    printf(": can't open the serialized crit-bit\n");
+    free(buf);
+    free(a);
+    return;
+  }
+
+  size_t found = 0;
+  double start = get_time();
+  for (size_t i = 0; i < m / n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      found += critbit_mapped_contains(&mapped, a[j]);
     }
   }
+  double end = get_time();
+  assert(found == (m / n) * n);
+  print_performance(end - start, m);
 
-  struct sort_data data = {
+  free(buf);
+  free(a);
+}
+
+static void test_hybrid_contains(const size_t n, const size_t m)
+{
+  printf("test_hybrid_contains(n=%zu, m=%zu, bucket_size=%zu)", n, m,
+      critbit_hybrid_bucket_size());
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  struct critbit_slab_allocator nodes;
+  struct critbit_slab_allocator buckets;
+  critbit_slab_allocator_init(&nodes, critbit_node_size());
+  critbit_slab_allocator_init(&buckets, critbit_hybrid_bucket_size());
+  struct critbit_hybrid *const h = critbit_hybrid_create(
+      &nodes.node_allocator, &buckets.node_allocator);
+
+  srand(0);
+  init_array(a, n);
+  for (size_t i = 0; i < n; ++i) {
+    critbit_hybrid_add(h, a[i]);
+  }
+
+  size_t found = 0;
+  double start = get_time();
+  for (size_t i = 0; i < m / n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      found += critbit_hybrid_contains(h, a[j]);
+    }
+  }
+  double end = get_time();
+  assert(found == (m / n) * n);
+  print_performance(end - start, m);
+
+  critbit_hybrid_delete(h);
+  critbit_slab_allocator_destroy(&nodes);
+  critbit_slab_allocator_destroy(&buckets);
+  free(a);
+}
+
+static void test_wide_contains(const size_t n, const size_t m)
+{
+  printf("test_wide_contains(n=%zu, m=%zu, bits=%d)", n, m,
+      _CRITBIT_WIDE_BITS);
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  struct critbit_slab_allocator slabs[CRITBIT_WIDE_SIZE_CLASSES];
+  const struct critbit_node_allocator *node_allocators[
+      CRITBIT_WIDE_SIZE_CLASSES];
+  for (size_t i = 0; i < CRITBIT_WIDE_SIZE_CLASSES; ++i) {
+    critbit_slab_allocator_init(&slabs[i], critbit_wide_node_size(i));
+    node_allocators[i] = &slabs[i].node_allocator;
+  }
+  struct critbit_wide *const w = critbit_wide_create(node_allocators);
+
+  srand(0);
+  init_array(a, n);
+  for (size_t i = 0; i < n; ++i) {
+    critbit_wide_add(w, a[i]);
+  }
+
+  size_t found = 0;
+  double start = get_time();
+  for (size_t i = 0; i < m / n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      found += critbit_wide_contains(w, a[j]);
+    }
+  }
+  double end = get_time();
+  assert(found == (m / n) * n);
+  print_performance(end - start, m);
+
+  critbit_wide_delete(w);
+  for (size_t i = 0; i < CRITBIT_WIDE_SIZE_CLASSES; ++i) {
+    critbit_slab_allocator_destroy(&slabs[i]);
+  }
+  free(a);
+}
+
+struct sharded_insert_data
+{
+  struct critbit_sharded *sh;
+  size_t m;
+  size_t thread;
+};
+
+static void *sharded_inserter(void *const ctx)
+{
+  const struct sharded_insert_data *const data =
+      (const struct sharded_insert_data *)ctx;
+  /* Xorshift scatters keys over the whole key space and all the shards. */
+  uint64_t x = data->thread + 1;
+  for (size_t i = 0; i < data->m; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    critbit_sharded_add(data->sh, (uintptr_t)x << 1);
+  }
+  return NULL;
+}
+
+static void test_sharded_insert(const size_t threads, const unsigned shard_bits,
+    const size_t m)
+{
+  printf("test_sharded_insert(threads=%zu, shard_bits=%u, m=%zu)", threads,
+      shard_bits, m);
+
+  const size_t shards_count = ((size_t)1) << shard_bits;
+  struct critbit_slab_allocator *const slabs =
+      malloc(sizeof(slabs[0]) * shards_count);
+  const struct critbit_node_allocator **const node_allocators =
+      malloc(sizeof(node_allocators[0]) * shards_count);
+  for (size_t i = 0; i < shards_count; ++i) {
+    critbit_slab_allocator_init(&slabs[i], critbit_node_size());
+    node_allocators[i] = &slabs[i].node_allocator;
+  }
+  struct critbit_sharded *const sh = critbit_sharded_create(node_allocators,
+      shard_bits);
+
+  pthread_t *const inserters = malloc(sizeof(inserters[0]) * threads);
+  struct sharded_insert_data *const data = malloc(sizeof(data[0]) * threads);
+  double start = get_time();
+  for (size_t i = 0; i < threads; ++i) {
+    data[i].sh = sh;
+    data[i].m = m / threads;
+    data[i].thread = i;
+    pthread_create(&inserters[i], NULL, &sharded_inserter, &data[i]);
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    pthread_join(inserters[i], NULL);
+  }
+  double end = get_time();
+  print_performance(end - start, m);
+
+  critbit_sharded_delete(sh);
+  for (size_t i = 0; i < shards_count; ++i) {
+    critbit_slab_allocator_destroy(&slabs[i]);
+  }
+  free(data);
+  free(inserters);
+  free(node_allocators);
+  free(slabs);
+}
+
+static void test_array_search(const size_t n, const size_t m)
+{
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  uintptr_t *const keys = malloc(sizeof(keys[0]) * n);
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  struct critbit *const cb = critbit_create(&s.node_allocator);
+
+  srand(0);
+  init_array(keys, n);
+  for (size_t i = 0; i < n; ++i) {
+    critbit_add(cb, keys[i]);
+  }
+  struct sort_data sort_data = {
     .a = a,
     .offset = 0,
   };
-  const struct critbit_visitor sort_visitor = {
+  const struct critbit_visitor visitor = {
     .callback = &sort_callback,
-    .ctx = &data,
+    .ctx = &sort_data,
   };
-  critbit_foreach(cb, &sort_visitor);
-  assert(data.offset == m);
+  critbit_foreach(cb, &visitor);
+  const size_t len = sort_data.offset;
+
+  for (size_t k = 0; k < _CRITBIT_ARRAY_KERNELS_COUNT; ++k) {
+    const struct _critbit_array_kernels *const kernels =
+        &_CRITBIT_ARRAY_KERNELS[k];
+    if (!kernels->is_supported()) {
+      continue;
+    }
+
+    printf("test_array_find(n=%zu, m=%zu, isa=%s)", n, m, kernels->isa);
+    size_t found = 0;
+    double start = get_time();
+    for (size_t i = 0; i < m / len; ++i) {
+      for (size_t j = 0; j < len; ++j) {
+        found += (kernels->find(a, len, keys[j]) < len);
+      }
+    }
+    double end = get_time();
+    assert(found == (m / len) * len);
+    print_performance(end - start, m);
+
+    printf("test_array_lower_bound(n=%zu, m=%zu, isa=%s)", n, m,
+        kernels->isa);
+    found = 0;
+    start = get_time();
+    for (size_t i = 0; i < m / len; ++i) {
+      for (size_t j = 0; j < len; ++j) {
+        found += (kernels->lower_bound(a, len, keys[j]) < len);
+      }
+    }
+    end = get_time();
+    assert(found == (m / len) * len);
+    print_performance(end - start, m);
+  }
 
   critbit_delete(cb);
-  delete_node_storage(s);
-  return data.offset;
+  critbit_slab_allocator_destroy(&s);
+  free(keys);
+  free(a);
 }
 
+static void test_contains_batch(const size_t n, const size_t m)
+{
+  printf("test_contains_batch(n=%zu, m=%zu)\n", n, m);
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  int *const out = malloc(sizeof(out[0]) * n);
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  struct critbit *const cb = critbit_create(&s.node_allocator);
+
+  srand(0);
+  init_array(a, n);
+  double start = get_time();
+  for (size_t i = 0; i < n; ++i) {
+    critbit_add(cb, a[i]);
+  }
+  double end = get_time();
+  printf("  add");
+  print_performance(end - start, n);
+
+  critbit_delete(cb);
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  struct critbit *const batch_cb = critbit_create(&s.node_allocator);
+  start = get_time();
+  critbit_add_batch(batch_cb, a, n);
+  end = get_time();
+  printf("  add_batch");
+  print_performance(end - start, n);
+
+  size_t found = 0;
+  start = get_time();
+  for (size_t i = 0; i < m / n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      found += critbit_contains(batch_cb, a[j]);
+    }
+  }
+  end = get_time();
+  printf("  contains");
+  print_performance(end - start, m);
+
+  start = get_time();
+  for (size_t i = 0; i < m / n; ++i) {
+    critbit_contains_batch(batch_cb, a, n, out);
+    for (size_t j = 0; j < n; ++j) {
+      found -= out[j];
+    }
+  }
+  end = get_time();
+  printf("  contains_batch");
+  print_performance(end - start, m);
+  assert(found == 0);
+
+  critbit_delete(batch_cb);
+  critbit_slab_allocator_destroy(&s);
+  free(out);
+  free(a);
+}
+
+static int compare_items(const void *const a, const void *const b)
+{
+  const uintptr_t x = *(const uintptr_t *)a;
+  const uintptr_t y = *(const uintptr_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void test_build_sorted(const size_t n, const size_t m)
+{
+  printf("test_build_sorted(n=%zu, m=%zu)\n", n, m);
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  srand(0);
+  init_array(a, n);
+  qsort(a, n, sizeof(a[0]), &compare_items);
+  size_t k = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (k == 0 || a[k - 1] != a[i]) {
+      a[k++] = a[i];
+    }
+  }
+
+  double add_time = 0;
+  double build_time = 0;
+  for (size_t i = 0; i < m / n; ++i) {
+    struct critbit_slab_allocator s;
+    critbit_slab_allocator_init(&s, critbit_node_size());
+    double start = get_time();
+    struct critbit *cb = critbit_create(&s.node_allocator);
+    for (size_t j = 0; j < k; ++j) {
+      critbit_add(cb, a[j]);
+    }
+    double end = get_time();
+    add_time += end - start;
+    critbit_delete(cb);
+
+    start = get_time();
+    cb = critbit_build_sorted(&s.node_allocator, a, k);
+    end = get_time();
+    build_time += end - start;
+    critbit_delete(cb);
+    critbit_slab_allocator_destroy(&s);
+  }
+  printf("  add");
+  print_performance(add_time, m);
+  printf("  build_sorted");
+  print_performance(build_time, m);
+
+  free(a);
+}
+
+/*
+ * Measures set operations on crit-bits, which overlap in every third block
+ * of block_size sequential keys, while other blocks belong to one of them.
+ */
+static void test_set_algebra(const size_t n, const size_t block_size,
+    const size_t m)
+{
+  printf("test_set_algebra(n=%zu, block_size=%zu, m=%zu)\n", n, block_size,
+      m);
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  uintptr_t *const b = malloc(sizeof(b[0]) * n);
+  size_t a_n = 0;
+  size_t b_n = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const size_t block = i / block_size;
+    if (block % 3 != 2) {
+      a[a_n++] = (i + 1) * 2;
+    }
+    if (block % 3 != 0) {
+      b[b_n++] = (i + 1) * 2;
+    }
+  }
+
+  double union_time = 0;
+  double intersect_time = 0;
+  double difference_time = 0;
+  for (size_t i = 0; i < m / n; ++i) {
+    struct critbit_slab_allocator s;
+    critbit_slab_allocator_init(&s, critbit_node_size());
+    /* The allocator is shared by two crit-bits. */
+    s.node_allocator.release_all_nodes = NULL;
+
+    struct critbit *x = critbit_build_sorted(&s.node_allocator, a, a_n);
+    struct critbit *y = critbit_build_sorted(&s.node_allocator, b, b_n);
+    double start = get_time();
+    critbit_union(x, y);
+    double end = get_time();
+    union_time += end - start;
+    critbit_delete(y);
+
+    y = critbit_build_sorted(&s.node_allocator, b, b_n);
+    start = get_time();
+    critbit_intersect(x, y);
+    end = get_time();
+    intersect_time += end - start;
+    critbit_delete(x);
+
+    x = critbit_build_sorted(&s.node_allocator, a, a_n);
+    start = get_time();
+    critbit_difference(x, y);
+    end = get_time();
+    difference_time += end - start;
+    critbit_delete(x);
+    critbit_delete(y);
+
+    critbit_slab_allocator_destroy(&s);
+  }
+  printf("  union");
+  print_performance(union_time, m);
+  printf("  intersect");
+  print_performance(intersect_time, m);
+  printf("  difference");
+  print_performance(difference_time, m);
+
+  free(b);
+  free(a);
+}
+
+static void test_split_join(const size_t n, const size_t m)
+{
+  printf("test_split_join(n=%zu, m=%zu)", n, m);
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  /* The allocator is shared by two crit-bits. */
+  s.node_allocator.release_all_nodes = NULL;
+  struct critbit *const cb = critbit_create(&s.node_allocator);
+
+  srand(0);
+  init_array(a, n);
+  for (size_t i = 0; i < n; ++i) {
+    critbit_add(cb, a[i]);
+  }
+
+  double start = get_time();
+  for (size_t i = 0; i < m; ++i) {
+    struct critbit *const right = critbit_split_at(cb, a[i % n]);
+    critbit_join(cb, right);
+    critbit_delete(right);
+  }
+  double end = get_time();
+  print_performance(end - start, m);
+
+  critbit_delete(cb);
+  critbit_slab_allocator_destroy(&s);
+  free(a);
+}
+
+/*
+ * Removes regions of region_size consecutive keys either with
+ * critbit_remove_prefix() or key by key.
+ */
+static void test_remove_prefix(const size_t n, const size_t region_size)
+{
+  printf("test_remove_prefix(n=%zu, region_size=%zu)\n", n, region_size);
+
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  struct critbit *const cb = critbit_create(&s.node_allocator);
+
+  /* Key steps are 16 bytes, so regions are aligned to region_size * 16. */
+  unsigned bits = _CRITBIT_PTR_BITS - 4;
+  for (size_t i = region_size; i > 1; i /= 2) {
+    --bits;
+  }
+
+  double times[2];
+  for (int by_prefix = 0; by_prefix <= 1; ++by_prefix) {
+    for (size_t i = 0; i < n; ++i) {
+      critbit_add(cb, (i + 1) * 16);
+    }
+    double start = get_time();
+    for (size_t i = 0; i <= n; i += region_size) {
+      if (by_prefix) {
+        critbit_remove_prefix(cb, i * 16, bits);
+      }
+      else {
+        for (size_t j = i; j < i + region_size; ++j) {
+          critbit_remove(cb, (j + 1) * 16);
+        }
+      }
+    }
+    double end = get_time();
+    times[by_prefix] = end - start;
+    const int rv = critbit_remove_prefix(cb, 0, 0);
+    assert(rv == 0);
+    (void)rv;
+  }
+  printf("  remove");
+  print_performance(times[0], n);
+  printf("  remove_prefix");
+  print_performance(times[1], n);
+
+  critbit_delete(cb);
+  critbit_slab_allocator_destroy(&s);
+}
+
+/* Maps interior pointers to 64-byte objects, which contain them. */
+static void test_predecessor(const size_t n, const size_t m)
+{
+  printf("test_predecessor(n=%zu, m=%zu)\n", n, m);
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  struct critbit *const cb = critbit_create(&s.node_allocator);
+
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    critbit_add(cb, (i + 1) * 64);
+    a[i] = ((size_t)rand() % n + 1) * 64 + (size_t)rand() % 32 * 2;
+  }
+
+  double times[2];
+  for (int by_cursor = 0; by_cursor <= 1; ++by_cursor) {
+    uintptr_t sum = 0;
+    double start = get_time();
+    for (size_t i = 0; i < m / n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        uintptr_t v = 0;
+        int rv;
+        if (by_cursor) {
+          struct critbit_cursor c;
+          rv = critbit_seek_le(&c, cb, a[j]);
+          if (rv) {
+            v = critbit_cursor_get(&c);
+          }
+        }
+        else {
+          rv = critbit_predecessor(cb, a[j], &v);
+        }
+        assert(rv);
+        sum += a[j] - v;
+      }
+    }
+    double end = get_time();
+    times[by_cursor] = end - start;
+    assert(sum < (m / n) * n * 64);
+  }
+  printf("  seek_le");
+  print_performance(times[1], m);
+  printf("  predecessor");
+  print_performance(times[0], m);
+
+  critbit_delete(cb);
+  critbit_slab_allocator_destroy(&s);
+  free(a);
+}
+
+#if defined(CRITBIT_ORDER_STATS)
+static void test_rank_select(const size_t n, const size_t m)
+{
+  printf("test_rank_select(n=%zu, m=%zu)\n", n, m);
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  struct critbit *const cb = critbit_create(&s.node_allocator);
+
+  srand(0);
+  init_array(a, n);
+  for (size_t i = 0; i < n; ++i) {
+    critbit_add(cb, a[i]);
+  }
+  const size_t size = critbit_size(cb);
+
+  size_t sum = 0;
+  double start = get_time();
+  for (size_t i = 0; i < m; ++i) {
+    sum += critbit_rank(cb, a[i % n]);
+  }
+  double end = get_time();
+  printf("  rank");
+  print_performance(end - start, m);
+
+  start = get_time();
+  for (size_t i = 0; i < m; ++i) {
+    uintptr_t v = 0;
+    critbit_select(cb, i % size, &v);
+    sum += v;
+  }
+  end = get_time();
+  printf("  select");
+  print_performance(end - start, m);
+  /* Prevent the compiler from optimizing out the loops. */
+  assert(sum != 1);
+
+  critbit_delete(cb);
+  critbit_slab_allocator_destroy(&s);
+  free(a);
+}
+#endif
+
+#if defined(CRITBIT_PERSISTENT)
+/*
+ * Measures insertion while a snapshot is taken after every interval
+ * insertions, so each interval starts with all the nodes shared.
+ */
+static void test_snapshot_insert(const size_t n, const size_t interval)
+{
+  printf("test_snapshot_insert(n=%zu, interval=%zu)", n, interval);
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  struct critbit *const cb = critbit_create(&s.node_allocator);
+  struct critbit *snapshot = critbit_snapshot(cb);
+
+  srand(0);
+  init_array(a, n);
+  double start = get_time();
+  for (size_t i = 0; i < n; ++i) {
+    if (i % interval == 0) {
+      critbit_delete(snapshot);
+      snapshot = critbit_snapshot(cb);
+    }
+    critbit_add(cb, a[i]);
+  }
+  double end = get_time();
+  print_performance(end - start, n);
+
+  critbit_delete(snapshot);
+  critbit_delete(cb);
+  critbit_slab_allocator_destroy(&s);
+  free(a);
+}
+#endif
+
 static void test_sort(const size_t n, const size_t m)
 {
   printf("test_sort(n=%zu, m=%zu)", n, m);
@@ -136,15 +918,583 @@ static void test_sort(const size_t n, const size_t m)
   free(a);
 }
 
+#if defined(CRITBIT_PARALLEL)
+/* Slab allocators aren't thread-safe, so parallel tests use malloc(). */
+static void *alloc_parallel_node(void *const ctx)
+{
+  (void)ctx;
+  return malloc(critbit_node_size());
+}
+
+static void free_parallel_node(void *const ctx, void *const node)
+{
+  (void)ctx;
+  free(node);
+}
+
+static void parallel_callback(void *const ctx, const uintptr_t v)
+{
+  (void)ctx;
+  (void)v;
+}
+
+static void test_parallel(const size_t n, const size_t threads,
+    const size_t m)
+{
+  printf("test_parallel(n=%zu, threads=%zu, m=%zu)\n", n, threads, m);
+
+  const struct critbit_node_allocator node_allocator = {
+    .alloc_node = &alloc_parallel_node,
+    .free_node = &free_parallel_node,
+    .ctx = NULL,
+    .release_all_nodes = NULL,
+    .retire_node = NULL,
+  };
+  const struct critbit_visitor visitor = {
+    .callback = &parallel_callback,
+    .ctx = NULL,
+  };
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  for (size_t i = 0; i < n; ++i) {
+    a[i] = (i + 1) * 2;
+  }
+
+  double build_time = 0;
+  double foreach_time = 0;
+  for (size_t i = 0; i < m / n; ++i) {
+    double start = get_time();
+    struct critbit *const cb = critbit_build_sorted_parallel(&node_allocator,
+        a, n, threads);
+    double end = get_time();
+    build_time += end - start;
+
+    start = get_time();
+    critbit_parallel_foreach(cb, &visitor, threads);
+    end = get_time();
+    foreach_time += end - start;
+    critbit_delete(cb);
+  }
+  printf("  build_sorted_parallel");
+  print_performance(build_time, m);
+  printf("  parallel_foreach");
+  print_performance(foreach_time, m);
+
+  free(a);
+}
+#endif
+
+/*
+ * Benchmark suite.
+ *
+ * Each workload is timed in batches of BENCH_BATCH operations, so
+ * the clock overhead stays small while the ns/op distribution over
+ * batches still shows percentiles. Hardware counters are read via
+ * perf_event on Linux when the kernel allows it.
+ */
+
+#define BENCH_BATCH 256
+
+enum bench_keys
+{
+  /* Ascending keys with a malloc-like 16 byte stride. */
+  BENCH_KEYS_SEQUENTIAL,
+
+  /* Uniformly distributed keys over the whole uintptr_t range. */
+  BENCH_KEYS_RANDOM,
+
+  /* Pointers bumped within a few far apart arenas in random order. */
+  BENCH_KEYS_CLUSTERED,
+};
+
+#define BENCH_ARENAS 16
+
+static const char *get_bench_keys_name(const enum bench_keys keys)
+{
+  switch (keys) {
+  case BENCH_KEYS_SEQUENTIAL:
+    return "sequential";
+  case BENCH_KEYS_RANDOM:
+    return "random";
+  default:
+    return "clustered";
+  }
+}
+
+/* rand() has only 31 bits on most platforms, so use xorshift instead. */
+static uint64_t xorshift64(uint64_t *const state)
+{
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return x;
+}
+
+static void init_bench_keys(uintptr_t *const a, const size_t n,
+    const enum bench_keys keys, uint64_t *const state)
+{
+  uintptr_t arenas[BENCH_ARENAS];
+  for (size_t i = 0; i < BENCH_ARENAS; ++i) {
+    arenas[i] = (uintptr_t)xorshift64(state) & (UINTPTR_MAX >> 4) &
+        ~(uintptr_t)0xfffff;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    const uint64_t r = xorshift64(state);
+    switch (keys) {
+    case BENCH_KEYS_SEQUENTIAL:
+      a[i] = (uintptr_t)(i + 1) * 16;
+      break;
+    case BENCH_KEYS_RANDOM:
+      a[i] = (uintptr_t)r & ~(uintptr_t)1;
+      if (a[i] == 0) {
+        a[i] = 2;
+      }
+      break;
+    default:
+      arenas[r % BENCH_ARENAS] += 16 * (1 + (r >> 32) % 4);
+      a[i] = arenas[r % BENCH_ARENAS];
+      break;
+    }
+  }
+}
+
+static void shuffle_keys(uintptr_t *const a, const size_t n,
+    uint64_t *const state)
+{
+  for (size_t i = n; i > 1; --i) {
+    const size_t j = xorshift64(state) % i;
+    const uintptr_t tmp = a[i - 1];
+    a[i - 1] = a[j];
+    a[j] = tmp;
+  }
+}
+
+#if defined(__linux__)
+#define BENCH_EVENTS 2
+
+static const struct
+{
+  uint32_t type;
+  uint64_t config;
+  const char *name;
+} bench_events[BENCH_EVENTS] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache_misses" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch_misses" },
+};
+#else
+#define BENCH_EVENTS 0
+#endif
+
+/*
+ * Collects ns/op of every batch and hardware counters of a workload.
+ * Counters, which can't be opened, e.g. in containers or VMs, are skipped.
+ */
+struct bench_stats
+{
+  double *samples;
+  size_t samples_count;
+  uint64_t ops;
+  uint64_t total_ns;
+#if BENCH_EVENTS > 0
+  int fds[BENCH_EVENTS];
+#endif
+};
+
+static void bench_stats_init(struct bench_stats *const s, const size_t m)
+{
+  s->samples = malloc(sizeof(s->samples[0]) * (m / BENCH_BATCH + 1));
+  s->samples_count = 0;
+  s->ops = 0;
+  s->total_ns = 0;
+#if BENCH_EVENTS > 0
+  for (size_t i = 0; i < BENCH_EVENTS; ++i) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = bench_events[i].type;
+    attr.config = bench_events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    s->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (s->fds[i] != -1) {
+      ioctl(s->fds[i], PERF_EVENT_IOC_RESET, 0);
+    }
+  }
+#endif
+}
+
+static void bench_stats_start(struct bench_stats *const s)
+{
+#if BENCH_EVENTS > 0
+  for (size_t i = 0; i < BENCH_EVENTS; ++i) {
+    if (s->fds[i] != -1) {
+      ioctl(s->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#else
+  (void)s;
+#endif
+}
+
+static void bench_stats_stop(struct bench_stats *const s)
+{
+#if BENCH_EVENTS > 0
+  for (size_t i = 0; i < BENCH_EVENTS; ++i) {
+    if (s->fds[i] != -1) {
+      ioctl(s->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+#else
+  (void)s;
+#endif
+}
+
+static void bench_stats_add(struct bench_stats *const s, const uint64_t ns,
+    const size_t ops)
+{
+  s->samples[s->samples_count++] = (double)ns / ops;
+  s->ops += ops;
+  s->total_ns += ns;
+}
+
+static int compare_samples(const void *const a, const void *const b)
+{
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double get_percentile(const struct bench_stats *const s,
+    const unsigned percent)
+{
+  assert(s->samples_count > 0);
+  return s->samples[(s->samples_count - 1) * percent / 100];
+}
+
+/* Prints the stats and releases their resources. */
+static void bench_stats_print(struct bench_stats *const s,
+    const char *const name)
+{
+  qsort(s->samples, s->samples_count, sizeof(s->samples[0]),
+      &compare_samples);
+  printf("  %s: %.1lf ns/op, p50=%.1lf p90=%.1lf p99=%.1lf", name,
+      (double)s->total_ns / s->ops, get_percentile(s, 50),
+      get_percentile(s, 90), get_percentile(s, 99));
+#if BENCH_EVENTS > 0
+  for (size_t i = 0; i < BENCH_EVENTS; ++i) {
+    uint64_t count;
+    if (s->fds[i] != -1) {
+      if (read(s->fds[i], &count, sizeof(count)) == sizeof(count)) {
+        printf(" %s/op=%.3lf", bench_events[i].name, (double)count / s->ops);
+      }
+      close(s->fds[i]);
+    }
+  }
+#endif
+  printf("\n");
+  free(s->samples);
+}
+
+/*
+ * Keys for a benchmark over a crit-bit with n items. Keys with even
+ * indexes are in the crit-bit, keys with odd indexes are misses
+ * interleaved with them.
+ */
+struct bench_data
+{
+  uintptr_t *keys;
+  uintptr_t *hits;
+  uintptr_t *misses;
+  struct critbit_slab_allocator s;
+  struct critbit *cb;
+};
+
+static void bench_data_init(struct bench_data *const d, const size_t n,
+    const enum bench_keys keys)
+{
+  uint64_t state = 88172645463325252ull;
+  d->keys = malloc(sizeof(d->keys[0]) * 2 * n);
+  d->hits = malloc(sizeof(d->hits[0]) * n);
+  d->misses = malloc(sizeof(d->misses[0]) * n);
+  init_bench_keys(d->keys, 2 * n, keys, &state);
+  critbit_slab_allocator_init(&d->s, critbit_node_size());
+  d->cb = critbit_create(&d->s.node_allocator);
+  for (size_t i = 0; i < n; ++i) {
+    d->hits[i] = d->keys[2 * i];
+    d->misses[i] = d->keys[2 * i + 1];
+    critbit_add(d->cb, d->hits[i]);
+  }
+
+  /* Lookup order doesn't follow insertion order. */
+  shuffle_keys(d->hits, n, &state);
+  shuffle_keys(d->misses, n, &state);
+}
+
+static void bench_data_destroy(struct bench_data *const d)
+{
+  critbit_delete(d->cb);
+  critbit_slab_allocator_destroy(&d->s);
+  free(d->misses);
+  free(d->hits);
+  free(d->keys);
+}
+
+static void bench_contains(const size_t n, const enum bench_keys keys,
+    const size_t m)
+{
+  printf("bench_contains(n=%zu, keys=%s, m=%zu)\n", n,
+      get_bench_keys_name(keys), m);
+  assert(n % BENCH_BATCH == 0);
+
+  struct bench_data d;
+  bench_data_init(&d, n, keys);
+
+  const uintptr_t *const lookups[2] = {d.hits, d.misses};
+  const char *const names[2] = {"hit", "miss"};
+  for (size_t k = 0; k < 2; ++k) {
+    const uintptr_t *const a = lookups[k];
+    struct bench_stats s;
+    bench_stats_init(&s, m);
+    size_t found = 0;
+    bench_stats_start(&s);
+    for (size_t i = 0; i < m / n; ++i) {
+      for (size_t j = 0; j < n; j += BENCH_BATCH) {
+        const uint64_t start = get_ns();
+        for (size_t q = j; q < j + BENCH_BATCH; ++q) {
+          found += critbit_contains(d.cb, a[q]);
+        }
+        bench_stats_add(&s, get_ns() - start, BENCH_BATCH);
+      }
+    }
+    bench_stats_stop(&s);
+    /* Random and clustered keys may have duplicates. */
+    assert(k == 1 || keys != BENCH_KEYS_SEQUENTIAL ||
+        found == (m / n) * n);
+    assert(k == 0 || keys != BENCH_KEYS_SEQUENTIAL || found == 0);
+    bench_stats_print(&s, names[k]);
+  }
+
+  bench_data_destroy(&d);
+}
+
+static void bench_add_remove(const size_t n, const enum bench_keys keys,
+    const size_t m)
+{
+  printf("bench_add_remove(n=%zu, keys=%s, m=%zu)\n", n,
+      get_bench_keys_name(keys), m);
+  assert(n % BENCH_BATCH == 0);
+
+  struct bench_data d;
+  bench_data_init(&d, n, keys);
+
+  /* Every round removes all the items in random order and adds them back. */
+  struct bench_stats add_stats;
+  struct bench_stats remove_stats;
+  bench_stats_init(&add_stats, m);
+  bench_stats_init(&remove_stats, m);
+  for (size_t i = 0; i < m / n; ++i) {
+    bench_stats_start(&remove_stats);
+    for (size_t j = 0; j < n; j += BENCH_BATCH) {
+      const uint64_t start = get_ns();
+      for (size_t q = j; q < j + BENCH_BATCH; ++q) {
+        critbit_remove(d.cb, d.hits[q]);
+      }
+      bench_stats_add(&remove_stats, get_ns() - start, BENCH_BATCH);
+    }
+    bench_stats_stop(&remove_stats);
+    assert(_CRITBIT_IS_EMPTY(d.cb, d.cb->root));
+
+    bench_stats_start(&add_stats);
+    for (size_t j = 0; j < n; j += BENCH_BATCH) {
+      const uint64_t start = get_ns();
+      for (size_t q = j; q < j + BENCH_BATCH; ++q) {
+        critbit_add(d.cb, d.hits[q]);
+      }
+      bench_stats_add(&add_stats, get_ns() - start, BENCH_BATCH);
+    }
+    bench_stats_stop(&add_stats);
+  }
+  bench_stats_print(&remove_stats, "remove");
+  bench_stats_print(&add_stats, "add");
+
+  bench_data_destroy(&d);
+}
+
+/*
+ * Runs contains for read_percent of operations and toggles a key
+ * otherwise, so the crit-bit keeps about n items. Keys are drawn from
+ * both hits and misses, so half of reads miss.
+ */
+static void bench_mixed(const size_t n, const enum bench_keys keys,
+    const unsigned read_percent, const size_t m)
+{
+  printf("bench_mixed(n=%zu, keys=%s, read_percent=%u, m=%zu)\n", n,
+      get_bench_keys_name(keys), read_percent, m);
+  assert(n % BENCH_BATCH == 0);
+  assert(m % BENCH_BATCH == 0);
+
+  struct bench_data d;
+  bench_data_init(&d, n, keys);
+
+  /* Operations are prepared upfront to keep the generator out of timing. */
+  uint64_t state = 2463534242ull;
+  uintptr_t *const ops = malloc(sizeof(ops[0]) * m);
+  unsigned char *const is_write = malloc(m);
+  for (size_t i = 0; i < m; ++i) {
+    const uint64_t r = xorshift64(&state);
+    ops[i] = d.keys[r % (2 * n)];
+    is_write[i] = ((r >> 40) % 100 >= read_percent);
+  }
+
+  struct bench_stats s;
+  bench_stats_init(&s, m);
+  size_t found = 0;
+  bench_stats_start(&s);
+  for (size_t i = 0; i < m; i += BENCH_BATCH) {
+    const uint64_t start = get_ns();
+    for (size_t j = i; j < i + BENCH_BATCH; ++j) {
+      if (!is_write[j]) {
+        found += critbit_contains(d.cb, ops[j]);
+      }
+      else if (!critbit_remove(d.cb, ops[j])) {
+        critbit_add(d.cb, ops[j]);
+      }
+    }
+    bench_stats_add(&s, get_ns() - start, BENCH_BATCH);
+  }
+  bench_stats_stop(&s);
+  bench_stats_print(&s, "mixed");
+  assert(found <= m);
+
+  free(is_write);
+  free(ops);
+  bench_data_destroy(&d);
+}
+
+/*
+ * Runs every workload over crit-bits from L1-resident sizes up to sizes
+ * far beyond the last level cache.
+ */
+static void bench_suite(const size_t max_n, const size_t m)
+{
+  static const enum bench_keys all_keys[] = {
+    BENCH_KEYS_SEQUENTIAL,
+    BENCH_KEYS_RANDOM,
+    BENCH_KEYS_CLUSTERED,
+  };
+
+  for (size_t n = 1024; n <= max_n; n *= 16) {
+    for (size_t i = 0; i < sizeof(all_keys) / sizeof(all_keys[0]); ++i) {
+      bench_contains(n, all_keys[i], m);
+      bench_add_remove(n, all_keys[i], m);
+      bench_mixed(n, all_keys[i], 95, m);
+      bench_mixed(n, all_keys[i], 50, m);
+    }
+  }
+}
+
 int main(void)
 {
   static const size_t MAX_N = 4 * 1024 * 1024;
 
+  test_crit_bit(16 * MAX_N);
+
+  for (size_t i = 0; i < 20; i += 4) {
+    const size_t n = MAX_N >> i;
+    test_insert(n, MAX_N);
+  }
+
+  for (size_t i = 0; i < 20; i += 4) {
+    const size_t n = MAX_N >> i;
+    test_contains(n, 4 * MAX_N);
+  }
+
+  for (size_t i = 0; i < 20; i += 4) {
+    const size_t n = MAX_N >> i;
+    test_compact(n, 4 * MAX_N);
+  }
+
+  for (size_t i = 0; i < 20; i += 4) {
+    const size_t n = MAX_N >> i;
+    test_mapped_contains(n, 4 * MAX_N);
+  }
+
+  for (size_t i = 0; i < 20; i += 4) {
+    const size_t n = MAX_N >> i;
+    test_hybrid_contains(n, 4 * MAX_N);
+  }
+
+  for (size_t i = 0; i < 20; i += 4) {
+    const size_t n = MAX_N >> i;
+    test_wide_contains(n, 4 * MAX_N);
+  }
+
+  /* A single shard has a single lock shared by all the writers. */
+  for (size_t threads = 1; threads <= 8; threads *= 2) {
+    test_sharded_insert(threads, 0, MAX_N);
+    test_sharded_insert(threads, 6, MAX_N);
+  }
+
+  /* The linear search is too slow for large arrays. */
+  for (size_t n = 8; n <= 128; n *= 2) {
+    test_array_search(n, MAX_N);
+  }
+
+  for (size_t i = 0; i < 20; i += 4) {
+    const size_t n = MAX_N >> i;
+    test_build_sorted(n, MAX_N);
+  }
+
+  for (size_t block_size = 1; block_size <= 4096; block_size *= 16) {
+    test_set_algebra(MAX_N, block_size, 4 * MAX_N);
+  }
+
+  for (size_t i = 0; i < 20; i += 4) {
+    const size_t n = MAX_N >> i;
+    test_split_join(n, MAX_N);
+  }
+
+  for (size_t region_size = 1; region_size <= 4096; region_size *= 16) {
+    test_remove_prefix(MAX_N, region_size);
+  }
+
+  for (size_t i = 0; i < 20; i += 4) {
+    const size_t n = MAX_N >> i;
+    test_predecessor(n, 4 * MAX_N);
+  }
+
+#if defined(CRITBIT_ORDER_STATS)
+  for (size_t i = 0; i < 20; i += 4) {
+    const size_t n = MAX_N >> i;
+    test_rank_select(n, MAX_N);
+  }
+#endif
+
+#if defined(CRITBIT_PERSISTENT)
+  for (size_t interval = 1; interval <= MAX_N; interval *= 16) {
+    test_snapshot_insert(MAX_N, interval);
+  }
+#endif
+
+  /* The crit-bit exceeds the size of the last level cache on most CPUs. */
+  test_contains_batch(8 * MAX_N, 8 * MAX_N);
+  test_contains_batch(MAX_N >> 8, 8 * MAX_N);
+
   for (size_t i = 0; i < 20; ++i) {
     const size_t n = MAX_N >> i;
     test_sort(n, MAX_N);
   }
 
+#if defined(CRITBIT_PARALLEL)
+  for (size_t threads = 1; threads <= 8; threads *= 2) {
+    test_parallel(4 * MAX_N, threads, 8 * MAX_N);
+  }
+#endif
+
+  bench_suite(MAX_N, MAX_N);
+
   return 0;
 }
 
@@ -1,10 +1,14 @@
 #include "critbit.h"
 
 #include <assert.h>
+#include <limits.h>  /* for CHAR_BIT */
 #include <stddef.h>  /* for size_t */
 #include <stdint.h>  /* for uint*_t */
 #include <stdio.h>
 #include <stdlib.h>  /* for malloc()/free() */
+#include <string.h>  /* for memcmp()/memset()/strcmp() */
+
+#include <pthread.h>
 
 
 static void *alloc_critbit_node(void *const ctx)
@@ -13,6 +17,12 @@ static void *alloc_critbit_node(void *const ctx)
   return malloc(critbit_node_size());
 }
 
+static void *alloc_critbit_bytes_node(void *const ctx)
+{
+  assert(ctx == NULL);
+  return malloc(critbit_bytes_node_size());
+}
+
 static void free_critbit_node(void *const ctx, void *const node)
 {
   assert(ctx == NULL);
@@ -31,16 +41,25 @@ static void check_order_callback(void *const ctx, const uintptr_t v)
   data->prev_v = v;
 }
 
-static void test_critbit(const size_t n)
+struct count_data
 {
-  printf("test_critbit(n=%zu) ", n);
+  size_t n;
+};
 
-  const struct critbit_node_allocator node_allocator = {
-    .alloc_node = &alloc_critbit_node,
-    .free_node = &free_critbit_node,
-    .ctx = NULL,
-  };
-  struct critbit *const cb = critbit_create(&node_allocator);
+static void count_callback(void *const ctx, const uintptr_t v)
+{
+  struct count_data *const data = (struct count_data *)ctx;
+  (void)v;
+  ++data->n;
+}
+
+static void test_critbit(const size_t n,
+    const struct critbit_node_allocator *const node_allocator,
+    const char *const allocator_name)
+{
+  printf("test_critbit(n=%zu, allocator=%s) ", n, allocator_name);
+
+  struct critbit *const cb = critbit_create(node_allocator);
   uintptr_t v;
   int rv;
 
@@ -110,11 +129,2653 @@ static void test_critbit(const size_t n)
   printf("OK\n");
 }
 
-int main(void)
+static void test_deep_critbit(
+    const struct critbit_node_allocator *const node_allocator)
 {
-  static const size_t N = 128 * 1024;
+  static const size_t KEY_BITS = sizeof(uintptr_t) * CHAR_BIT;
+
+  printf("test_deep_critbit(depth=%zu) ", KEY_BITS - 2);
+
+  struct critbit *const cb = critbit_create(node_allocator);
+
+  struct check_order_data data = {
+    .prev_v = 0,
+  };
+  const struct critbit_visitor check_order_visitor = {
+    .callback = &check_order_callback,
+    .ctx = &data,
+  };
+  critbit_foreach(cb, &check_order_visitor);
+  assert(data.prev_v == 0);
+
+  /* Each key shares all but one bit with the previous key. */
+  for (size_t i = 1; i < KEY_BITS; ++i) {
+    const int rv = critbit_add(cb, ((uintptr_t)1) << i);
+    assert(rv);
+    (void)rv;
+  }
+  critbit_foreach(cb, &check_order_visitor);
+  assert(data.prev_v == ((uintptr_t)1) << (KEY_BITS - 1));
+
+  critbit_delete(cb);
+
+  printf("OK\n");
+}
+
+struct collect_data
+{
+  uintptr_t *a;
+  size_t n;
+};
+
+static void collect_callback(void *const ctx, const uintptr_t v)
+{
+  struct collect_data *const data = (struct collect_data *)ctx;
+  data->a[data->n++] = v;
+}
+
+/* Returns the index of the first item in a, which is greater or equal to v. */
+static size_t lower_bound(const uintptr_t *const a, const size_t n,
+    const uintptr_t v)
+{
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (a[mid] < v) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static void test_cursor(const size_t n,
+    const struct critbit_node_allocator *const node_allocator)
+{
+  printf("test_cursor(n=%zu) ", n);
+
+  struct critbit *const cb = critbit_create(node_allocator);
+  struct critbit_cursor c;
+  uintptr_t v;
+  int rv;
+
+  rv = critbit_seek_first(&c, cb);
+  assert(!rv);
+  rv = critbit_seek_ge(&c, cb, 2);
+  assert(!rv);
+
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      v = rand() * 2;
+    } while (v == 0);
+    critbit_add(cb, v);
+  }
+
+  struct collect_data data = {
+    .a = malloc(sizeof(data.a[0]) * n),
+    .n = 0,
+  };
+  const struct critbit_visitor collect_visitor = {
+    .callback = &collect_callback,
+    .ctx = &data,
+  };
+  critbit_foreach(cb, &collect_visitor);
+
+  rv = critbit_seek_first(&c, cb);
+  assert(rv);
+  for (size_t i = 0; i < data.n; ++i) {
+    assert(critbit_cursor_get(&c) == data.a[i]);
+    rv = critbit_cursor_next(&c);
+    assert(rv == (i + 1 < data.n));
+  }
+  rv = critbit_seek_last(&c, cb);
+  assert(rv);
+  for (size_t i = data.n; i > 0; --i) {
+    assert(critbit_cursor_get(&c) == data.a[i - 1]);
+    rv = critbit_cursor_prev(&c);
+    assert(rv == (i > 1));
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      v = rand() * 2;
+    } while (v == 0);
+    const size_t k = lower_bound(data.a, data.n, v);
+
+    rv = critbit_seek_ge(&c, cb, v);
+    assert(rv == (k < data.n));
+    if (rv) {
+      assert(critbit_cursor_get(&c) == data.a[k]);
+    }
+
+    rv = critbit_seek_le(&c, cb, v);
+    if (k < data.n && data.a[k] == v) {
+      assert(rv);
+      assert(critbit_cursor_get(&c) == v);
+    }
+    else {
+      assert(rv == (k > 0));
+      if (rv) {
+        assert(critbit_cursor_get(&c) == data.a[k - 1]);
+        rv = critbit_cursor_next(&c);
+        assert(rv == (k < data.n));
+      }
+    }
+  }
+
+  struct collect_data range_data = {
+    .a = malloc(sizeof(range_data.a[0]) * n),
+    .n = 0,
+  };
+  const struct critbit_visitor range_visitor = {
+    .callback = &collect_callback,
+    .ctx = &range_data,
+  };
+  for (size_t i = 0; i < 100; ++i) {
+    const size_t lo = rand() % data.n;
+    const size_t hi = lo + rand() % (data.n - lo);
+    range_data.n = 0;
+    critbit_foreach_range(cb, data.a[lo], data.a[hi], &range_visitor);
+    assert(range_data.n == hi - lo);
+    for (size_t j = 0; j < range_data.n; ++j) {
+      assert(range_data.a[j] == data.a[lo + j]);
+    }
+
+    /* Odd bounds between items select the same items. */
+    range_data.n = 0;
+    critbit_foreach_range(cb, data.a[lo] - 1, data.a[hi] - 1,
+        &range_visitor);
+    assert(range_data.n == hi - lo);
+  }
+  range_data.n = 0;
+  critbit_foreach_range(cb, 0, UINTPTR_MAX, &range_visitor);
+  assert(range_data.n == data.n);
+  range_data.n = 0;
+  critbit_foreach_range(cb, UINTPTR_MAX - 2, UINTPTR_MAX, &range_visitor);
+  assert(range_data.n == 0);
+
+  free(range_data.a);
+  free(data.a);
+  critbit_delete(cb);
+
+  printf("OK\n");
+}
+
+/* Checks nearest items to v against the sorted items a. */
+static void check_nearest(const struct critbit *const cb, const uintptr_t *a,
+    const size_t n, const uintptr_t v)
+{
+  const size_t k = lower_bound(a, n, v);
+  uintptr_t result;
+  int rv;
+
+  rv = critbit_successor(cb, v, &result);
+  assert(rv == (k < n));
+  assert(!rv || result == a[k]);
+
+  rv = critbit_predecessor(cb, v, &result);
+  if (k < n && a[k] == v) {
+    assert(rv && result == v);
+  }
+  else {
+    assert(rv == (k > 0));
+    assert(!rv || result == a[k - 1]);
+  }
+  (void)rv;
+}
+
+static void test_nearest(const size_t n,
+    const struct critbit_node_allocator *const node_allocator)
+{
+  printf("test_nearest(n=%zu) ", n);
+
+  struct critbit *const cb = critbit_create(node_allocator);
+  uintptr_t v;
+  int rv;
+
+  rv = critbit_predecessor(cb, 2, &v);
+  assert(!rv);
+  rv = critbit_successor(cb, 2, &v);
+  assert(!rv);
+  rv = critbit_closest_xor(cb, 2, &v);
+  assert(!rv);
+
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      v = (uintptr_t)rand() * 4;
+    } while (v == 0);
+    critbit_add(cb, v);
+  }
+
+  struct collect_data data = {
+    .a = malloc(sizeof(data.a[0]) * n),
+    .n = 0,
+  };
+  const struct critbit_visitor collect_visitor = {
+    .callback = &collect_callback,
+    .ctx = &data,
+  };
+  critbit_foreach(cb, &collect_visitor);
+
+  /* Items and their neighbours, which aren't in the crit-bit. */
+  for (size_t i = 0; i < data.n; ++i) {
+    check_nearest(cb, data.a, data.n, data.a[i]);
+    check_nearest(cb, data.a, data.n, data.a[i] + 2);
+    if (data.a[i] > 2) {
+      check_nearest(cb, data.a, data.n, data.a[i] - 2);
+    }
+  }
+  check_nearest(cb, data.a, data.n, 2);
+  check_nearest(cb, data.a, data.n, ~(uintptr_t)1);
+
+  for (size_t i = 0; i < 100; ++i) {
+    do {
+      v = (uintptr_t)rand() * 2;
+    } while (v == 0);
+    check_nearest(cb, data.a, data.n, v);
+
+    uintptr_t closest = data.a[0];
+    for (size_t j = 1; j < data.n; ++j) {
+      if ((data.a[j] ^ v) < (closest ^ v)) {
+        closest = data.a[j];
+      }
+    }
+    rv = critbit_closest_xor(cb, v, &v);
+    assert(rv && v == closest);
+  }
+  (void)rv;
+
+  free(data.a);
+  critbit_delete(cb);
+
+  printf("OK\n");
+}
+
+static void test_batch(const size_t n,
+    const struct critbit_node_allocator *const node_allocator)
+{
+  printf("test_batch(n=%zu) ", n);
+
+  struct critbit *const cb = critbit_create(node_allocator);
+  uintptr_t *const keys = calloc(n, sizeof(keys[0]));
+  int *const out = malloc(sizeof(out[0]) * n);
+
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      keys[i] = rand() * 2;
+    } while (keys[i] == 0);
+  }
+
+  critbit_contains_batch(cb, keys, n, out);
+  for (size_t i = 0; i < n; ++i) {
+    assert(!out[i]);
+  }
+
+  /* Add every other key, so the batch below contains both hits and misses. */
+  size_t added = 0;
+  for (size_t i = 0; i < n; i += 2) {
+    added += critbit_add(cb, keys[i]);
+  }
+  critbit_contains_batch(cb, keys, n, out);
+  for (size_t i = 0; i < n; ++i) {
+    assert(out[i] == critbit_contains(cb, keys[i]));
+  }
+
+  added += critbit_add_batch(cb, keys, n);
+  for (size_t i = 0; i < n; ++i) {
+    assert(critbit_contains(cb, keys[i]));
+  }
+  struct count_data data = {
+    .n = 0,
+  };
+  const struct critbit_visitor count_visitor = {
+    .callback = &count_callback,
+    .ctx = &data,
+  };
+  critbit_foreach(cb, &count_visitor);
+  assert(data.n == added);
+  added = critbit_add_batch(cb, keys, n);
+  assert(added == 0);
+  critbit_delete(cb);
+
+  /*
+   * Batch keys share longer prefixes with each other than with the only
+   * item, so leaves found for them become stale while the batch is added.
+   * Duplicate keys are added once.
+   */
+  static const uintptr_t base = ((uintptr_t)1) << 20;
+  struct critbit *const cb2 = critbit_create(node_allocator);
+  critbit_add(cb2, base);
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = base + ((i < n / 2) ? i : n - 1 - i) * 2 + 2;
+  }
+  added = critbit_add_batch(cb2, keys, n);
+  assert(added == (n + 1) / 2);
+  for (size_t i = 0; i < n; ++i) {
+    assert(critbit_contains(cb2, keys[i]));
+  }
+  struct check_order_data order_data = {
+    .prev_v = 0,
+  };
+  const struct critbit_visitor check_order_visitor = {
+    .callback = &check_order_callback,
+    .ctx = &order_data,
+  };
+  critbit_foreach(cb2, &check_order_visitor);
+  assert(order_data.prev_v == base + (n + 1) / 2 * 2);
+  critbit_delete(cb2);
+
+  free(out);
+  free(keys);
+
+  printf("OK\n");
+}
+
+static void test_build_sorted(const size_t n,
+    const struct critbit_node_allocator *const node_allocator)
+{
+  printf("test_build_sorted(n=%zu) ", n);
+
+  struct critbit *cb = critbit_build_sorted(node_allocator, NULL, 0);
+  assert(!critbit_contains(cb, 2));
+  critbit_delete(cb);
+
+  /* Collect sorted unique items via a crit-bit built with critbit_add(). */
+  cb = critbit_create(node_allocator);
+  uintptr_t v;
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      v = rand() * 2;
+    } while (v == 0);
+    critbit_add(cb, v);
+  }
+  struct collect_data data = {
+    .a = malloc(sizeof(data.a[0]) * n),
+    .n = 0,
+  };
+  const struct critbit_visitor collect_visitor = {
+    .callback = &collect_callback,
+    .ctx = &data,
+  };
+  critbit_foreach(cb, &collect_visitor);
+  critbit_delete(cb);
+
+  for (size_t m = 1; m <= data.n; m = (m < 16) ? m + 1 : m * 4) {
+    cb = critbit_build_sorted(node_allocator, data.a, m);
+    struct collect_data built_data = {
+      .a = malloc(sizeof(built_data.a[0]) * m),
+      .n = 0,
+    };
+    const struct critbit_visitor built_visitor = {
+      .callback = &collect_callback,
+      .ctx = &built_data,
+    };
+    critbit_foreach(cb, &built_visitor);
+    assert(built_data.n == m);
+    for (size_t i = 0; i < m; ++i) {
+      assert(built_data.a[i] == data.a[i]);
+      assert(critbit_contains(cb, data.a[i]));
+    }
+    free(built_data.a);
+
+    /* The crit-bit must remain modifiable. */
+    for (size_t i = 0; i < m; i += 2) {
+      const int rv = critbit_remove(cb, data.a[i]);
+      assert(rv);
+      (void)rv;
+    }
+    for (size_t i = 0; i < m; ++i) {
+      assert(critbit_contains(cb, data.a[i]) == (int)(i % 2));
+    }
+    critbit_delete(cb);
+  }
+
+  free(data.a);
+
+  printf("OK\n");
+}
+
+#if defined(CRITBIT_PARALLEL)
+struct parallel_visit_data
+{
+  const uintptr_t *a;
+  size_t n;
+  unsigned char *visits;
+};
+
+static void parallel_visit_callback(void *const ctx, const uintptr_t v)
+{
+  struct parallel_visit_data *const data = (struct parallel_visit_data *)ctx;
+  const size_t i = lower_bound(data->a, data->n, v);
+  assert(i < data->n && data->a[i] == v);
+  __atomic_add_fetch(&data->visits[i], 1, __ATOMIC_RELAXED);
+}
+
+static void test_parallel(const size_t n,
+    const struct critbit_node_allocator *const node_allocator)
+{
+  printf("test_parallel(n=%zu) ", n);
+
+  /* Dense keys followed by sparse keys make a skewed tree. */
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  for (size_t i = 0; i < n; ++i) {
+    a[i] = (i < n / 2) ? (i + 1) * 2 :
+        a[i - 1] + (((uintptr_t)1 << 20) + rand()) * 2;
+  }
+  struct parallel_visit_data data = {
+    .a = a,
+    .n = 0,
+    .visits = malloc(n),
+  };
+  const struct critbit_visitor visitor = {
+    .callback = &parallel_visit_callback,
+    .ctx = &data,
+  };
+
+  for (size_t m = 0; m <= n; m = (m < 4) ? m + 1 : m * 16) {
+    for (size_t threads = 1; threads <= 8; threads += 3) {
+      struct critbit *const cb = critbit_build_sorted_parallel(node_allocator,
+          a, m, threads);
+      struct collect_data built_data = {
+        .a = malloc(sizeof(built_data.a[0]) * (m + 1)),
+        .n = 0,
+      };
+      const struct critbit_visitor built_visitor = {
+        .callback = &collect_callback,
+        .ctx = &built_data,
+      };
+      critbit_foreach(cb, &built_visitor);
+      assert(built_data.n == m);
+      for (size_t i = 0; i < m; ++i) {
+        assert(built_data.a[i] == a[i]);
+      }
+      free(built_data.a);
+#if defined(CRITBIT_ORDER_STATS)
+      assert(critbit_size(cb) == m);
+#endif
+
+      /* Each item must be visited exactly once for any number of threads. */
+      for (size_t visitors = 1; visitors <= 8; visitors *= 2) {
+        data.n = m;
+        memset(data.visits, 0, m);
+        critbit_parallel_foreach(cb, &visitor, visitors);
+        for (size_t i = 0; i < m; ++i) {
+          assert(data.visits[i] == 1);
+        }
+      }
+      critbit_delete(cb);
+    }
+  }
+
+  free(data.visits);
+  free(a);
+
+  printf("OK\n");
+}
+#endif
+
+/* Returns whether the i-th key belongs to the set for the given pattern. */
+static int is_in_set(const int pattern, const size_t i, const size_t set)
+{
+  switch (pattern) {
+    case 0:
+      return rand() % 2;
+    case 1:
+      /* Large disjoint blocks. */
+      return ((i / 1000) % 2 == set);
+    case 2:
+      /* Blocks, which partially overlap. */
+      return ((i / 1000) % 3 != set);
+    case 3:
+      /* Interleaved keys. */
+      return (i % 2 == set);
+    default:
+      /* The second set is empty. */
+      return (set == 0);
+  }
+}
+
+static struct critbit *build_set(
+    const struct critbit_node_allocator *const node_allocator,
+    const uintptr_t *const keys, const char *const flags, const size_t n,
+    const char flag)
+{
+  struct critbit *const cb = critbit_create(node_allocator);
+  for (size_t i = 0; i < n; ++i) {
+    if (flags[i] & flag) {
+      critbit_add(cb, keys[i]);
+    }
+  }
+  return cb;
+}
+
+/*
+ * Checks that cb contains only the i-th keys, which have the bit
+ * (1 << flags[i]) set in the mask.
+ */
+static void check_set(const struct critbit *const cb,
+    const uintptr_t *const keys, const char *const flags, const size_t n,
+    const unsigned mask)
+{
+  struct collect_data data = {
+    .a = malloc(sizeof(data.a[0]) * n),
+    .n = 0,
+  };
+  const struct critbit_visitor collect_visitor = {
+    .callback = &collect_callback,
+    .ctx = &data,
+  };
+  critbit_foreach(cb, &collect_visitor);
+  size_t j = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const int expected = (mask >> flags[i]) & 1;
+    if (expected) {
+      assert(j < data.n);
+      assert(data.a[j] == keys[i]);
+      ++j;
+    }
+    assert(critbit_contains(cb, keys[i]) == expected);
+  }
+  assert(j == data.n);
+  (void)keys;
+  free(data.a);
+}
+
+static void test_set_algebra(const size_t n,
+    const struct critbit_node_allocator *const node_allocator)
+{
+  printf("test_set_algebra(n=%zu) ", n);
+
+  /* Sorted keys with random low bits. */
+  uintptr_t *const keys = malloc(sizeof(keys[0]) * n);
+  char *const flags = malloc(n);
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = ((((uintptr_t)i + 1) << 12) | ((uintptr_t)rand() & 0xfff)) * 2;
+  }
+
+  for (int pattern = 0; pattern < 5; ++pattern) {
+    for (size_t i = 0; i < n; ++i) {
+      flags[i] = (char)(is_in_set(pattern, i, 0) |
+          (is_in_set(pattern, i, 1) << 1));
+    }
+
+    /* Flags 1, 2 and 3 mean that a key is in a, in b or in both. */
+    struct critbit *a = build_set(node_allocator, keys, flags, n, 1);
+    struct critbit *b = build_set(node_allocator, keys, flags, n, 2);
+    critbit_union(a, b);
+    check_set(a, keys, flags, n, 0xe);
+    check_set(b, keys, flags, n, 0);
+    critbit_union(b, a);
+    check_set(a, keys, flags, n, 0);
+    check_set(b, keys, flags, n, 0xe);
+    critbit_delete(a);
+    critbit_delete(b);
+
+    a = build_set(node_allocator, keys, flags, n, 1);
+    b = build_set(node_allocator, keys, flags, n, 2);
+    critbit_intersect(a, b);
+    check_set(a, keys, flags, n, 0x8);
+    /* b is a superset of a now, so the difference is empty. */
+    critbit_difference(a, b);
+    check_set(a, keys, flags, n, 0);
+    critbit_add(a, keys[0]);
+    assert(critbit_contains(a, keys[0]));
+    critbit_delete(a);
+    critbit_delete(b);
+
+    a = build_set(node_allocator, keys, flags, n, 1);
+    b = build_set(node_allocator, keys, flags, n, 2);
+    critbit_difference(a, b);
+    check_set(a, keys, flags, n, 0x2);
+    /* a and b don't intersect now. */
+    critbit_intersect(b, a);
+    check_set(b, keys, flags, n, 0);
+    critbit_delete(a);
+    critbit_delete(b);
+  }
+
+  free(flags);
+  free(keys);
+
+  printf("OK\n");
+}
+
+/* Checks that cb contains exactly a[lo..hi). */
+static void check_range(const struct critbit *const cb,
+    const uintptr_t *const a, const size_t lo, const size_t hi)
+{
+  struct collect_data data = {
+    .a = malloc(sizeof(data.a[0]) * (hi - lo + 1)),
+    .n = 0,
+  };
+  const struct critbit_visitor collect_visitor = {
+    .callback = &collect_callback,
+    .ctx = &data,
+  };
+  critbit_foreach(cb, &collect_visitor);
+  assert(data.n == hi - lo);
+  for (size_t i = lo; i < hi; ++i) {
+    assert(data.a[i - lo] == a[i]);
+  }
+  (void)a;
+  free(data.a);
+}
+
+static void test_split_join(const size_t n,
+    const struct critbit_node_allocator *const node_allocator)
+{
+  printf("test_split_join(n=%zu) ", n);
+
+  struct critbit *cb = critbit_create(node_allocator);
+  struct critbit *right = critbit_split_at(cb, 2);
+  critbit_join(cb, right);
+  critbit_delete(right);
+
+  uintptr_t v;
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      v = rand() * 2;
+    } while (v == 0);
+    critbit_add(cb, v);
+  }
+  struct collect_data data = {
+    .a = malloc(sizeof(data.a[0]) * n),
+    .n = 0,
+  };
+  const struct critbit_visitor collect_visitor = {
+    .callback = &collect_callback,
+    .ctx = &data,
+  };
+  critbit_foreach(cb, &collect_visitor);
+
+  /* Split at existing items, at missing items and outside the range. */
+  for (size_t i = 0; i <= data.n; i += 1 + data.n / 100) {
+    for (int delta = -2; delta <= 2; delta += 2) {
+      v = (i < data.n) ? data.a[i] + delta : data.a[data.n - 1] + 2;
+      if (v == 0) {
+        continue;
+      }
+      const size_t split = lower_bound(data.a, data.n, v);
+      right = critbit_split_at(cb, v);
+      check_range(cb, data.a, 0, split);
+      check_range(right, data.a, split, data.n);
+
+      if (delta == 0) {
+        critbit_join(right, cb);
+        check_range(cb, data.a, 0, 0);
+        critbit_join(cb, right);
+      }
+      else {
+        critbit_join(cb, right);
+      }
+      check_range(cb, data.a, 0, data.n);
+      check_range(right, data.a, 0, 0);
+      critbit_delete(right);
+    }
+  }
+
+  /* Keep splitting off the upper half. */
+  size_t hi = data.n;
+  while (hi > 0) {
+    const size_t mid = hi / 2;
+    right = critbit_split_at(cb, data.a[mid]);
+    check_range(cb, data.a, 0, mid);
+    check_range(right, data.a, mid, hi);
+    critbit_delete(right);
+    hi = mid;
+  }
+
+  critbit_delete(cb);
+  free(data.a);
+
+  printf("OK\n");
+}
+
+/* Checks the mapped crit-bit against the sorted unique items a[0..n). */
+static void check_mapped(const struct critbit_mapped *const m,
+    const uintptr_t *const a, const size_t n)
+{
+  struct collect_data data = {
+    .a = malloc(sizeof(data.a[0]) * (n + 1)),
+    .n = 0,
+  };
+  const struct critbit_visitor collect_visitor = {
+    .callback = &collect_callback,
+    .ctx = &data,
+  };
+  critbit_mapped_foreach(m, &collect_visitor);
+  assert(data.n == n);
+  for (size_t i = 0; i < n; ++i) {
+    assert(data.a[i] == a[i]);
+  }
+  free(data.a);
+
+  struct critbit_mapped_cursor c;
+  int rv;
+  rv = critbit_mapped_seek_first(&c, m);
+  assert(rv == (n > 0));
+  for (size_t i = 0; i < n; ++i) {
+    assert(critbit_mapped_cursor_get(&c) == a[i]);
+    rv = critbit_mapped_cursor_next(&c);
+    assert(rv == (i + 1 < n));
+  }
+  rv = critbit_mapped_seek_last(&c, m);
+  assert(rv == (n > 0));
+  for (size_t i = n; i > 0; --i) {
+    assert(critbit_mapped_cursor_get(&c) == a[i - 1]);
+    rv = critbit_mapped_cursor_prev(&c);
+    assert(rv == (i > 1));
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    rv = critbit_mapped_contains(m, a[i]);
+    assert(rv);
+
+    /* Items lie far apart, so their neighbours aren't items. */
+    const uintptr_t v = a[i] + 2;
+    rv = critbit_mapped_contains(m, v);
+    assert(!rv);
+    rv = critbit_mapped_seek_ge(&c, m, v);
+    assert(rv == (i + 1 < n));
+    assert(!rv || critbit_mapped_cursor_get(&c) == a[i + 1]);
+    rv = critbit_mapped_seek_le(&c, m, v);
+    assert(rv && critbit_mapped_cursor_get(&c) == a[i]);
+    rv = critbit_mapped_seek_ge(&c, m, a[i]);
+    assert(rv && critbit_mapped_cursor_get(&c) == a[i]);
+  }
+  (void)rv;
+}
+
+static void test_serialize(const size_t n,
+    const struct critbit_node_allocator *const node_allocator)
+{
+  printf("test_serialize(n=%zu) ", n);
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * n);
+  for (size_t i = 0; i < n; ++i) {
+    a[i] = ((uintptr_t)rand() + 1) * 8 + (i == 0 ? 0 : a[i - 1]);
+  }
+
+  for (size_t m = 0; m <= n; m = (m < 4) ? m + 1 : m * 8) {
+    struct critbit *const cb = critbit_build_sorted(node_allocator, a, m);
+    const size_t size = critbit_serialize(cb, NULL, 0);
+    uint64_t *const buf = malloc(size);
+    size_t rv = critbit_serialize(cb, buf, size - 1);
+    assert(rv == size);
+    rv = critbit_serialize(cb, buf, size);
+    assert(rv == size);
+    (void)rv;
+    critbit_delete(cb);
+
+    /* The serialized crit-bit doesn't depend on its address. */
+    uint64_t *const copy = malloc(size);
+    memcpy(copy, buf, size);
+    free(buf);
+    struct critbit_mapped mapped;
+    int ok = critbit_open_mapped(&mapped, copy, size);
+    assert(ok);
+    check_mapped(&mapped, a, m);
+
+    ok = critbit_open_mapped(&mapped, copy, size - 8);
+    assert(!ok);
+    check_mapped(&mapped, a, 0);
+    copy[0] ^= 1;
+    ok = critbit_open_mapped(&mapped, copy, size);
+    assert(!ok);
+    copy[0] ^= 1;
+
+    /* The root node index must be within the nodes. */
+    if (m > 1) {
+      struct _critbit_mapped_header *const header =
+          (struct _critbit_mapped_header *)copy;
+      header->root = header->nodes_count;
+      ok = critbit_open_mapped(&mapped, copy, size);
+      assert(!ok);
+      header->root_kinds = 2;
+      header->root = 0;
+      ok = critbit_open_mapped(&mapped, copy, size);
+      assert(!ok);
+    }
+    (void)ok;
+    free(copy);
+  }
+
+  free(a);
+
+  printf("OK\n");
+}
+
+static void test_compact(const size_t n,
+    const struct critbit_node_allocator *const node_allocator)
+{
+  printf("test_compact(n=%zu) ", n);
+
+  struct critbit *const cb = critbit_create(node_allocator);
+  critbit_compact(cb, node_allocator);
+  check_range(cb, NULL, 0, 0);
+  critbit_add(cb, 2);
+  critbit_compact(cb, node_allocator);
+  const uintptr_t single = 2;
+  check_range(cb, &single, 0, 1);
+  critbit_remove(cb, 2);
+
+  /* Churn scatters nodes over the heap. */
+  uintptr_t v;
+  srand(0);
+  for (size_t i = 0; i < 4 * n; ++i) {
+    do {
+      v = rand() % (2 * n) * 2;
+    } while (v == 0);
+    if (!critbit_add(cb, v)) {
+      critbit_remove(cb, v);
+    }
+  }
+  struct collect_data data = {
+    .a = malloc(sizeof(data.a[0]) * 2 * n),
+    .n = 0,
+  };
+  const struct critbit_visitor collect_visitor = {
+    .callback = &collect_callback,
+    .ctx = &data,
+  };
+  critbit_foreach(cb, &collect_visitor);
+  struct critbit_stats stats;
+  critbit_get_stats(cb, &stats);
+#if defined(CRITBIT_PERSISTENT)
+  struct critbit *const snapshot = critbit_snapshot(cb);
+#endif
+
+  struct critbit_slab_allocator slabs[2];
+  for (size_t i = 0; i < 2; ++i) {
+    critbit_slab_allocator_init(&slabs[i], critbit_node_size());
+    critbit_compact(cb, &slabs[i].node_allocator);
+    check_range(cb, data.a, 0, data.n);
+
+    /* Compaction preserves the shape of the tree. */
+    struct critbit_stats compact_stats;
+    critbit_get_stats(cb, &compact_stats);
+    assert(compact_stats.node_count == stats.node_count);
+    assert(compact_stats.max_depth == stats.max_depth);
+    for (size_t j = 0; j <= _CRITBIT_MAX_DEPTH; ++j) {
+      assert(compact_stats.depth_histogram[j] == stats.depth_histogram[j]);
+    }
+#if defined(CRITBIT_ORDER_STATS)
+    assert(critbit_size(cb) == data.n);
+#endif
+  }
+  /* The first slab doesn't hold nodes of cb anymore. */
+  critbit_slab_allocator_destroy(&slabs[0]);
+
+  /* The compacted crit-bit remains modifiable. */
+  for (size_t i = 0; i < data.n; i += 2) {
+    const int rv = critbit_remove(cb, data.a[i]);
+    assert(rv);
+    (void)rv;
+  }
+  for (size_t i = 0; i < data.n; ++i) {
+    assert(critbit_contains(cb, data.a[i]) == (int)(i % 2));
+  }
+#if defined(CRITBIT_PERSISTENT)
+  check_range(snapshot, data.a, 0, data.n);
+  critbit_delete(snapshot);
+#endif
+
+  critbit_delete(cb);
+  critbit_slab_allocator_destroy(&slabs[1]);
+  free(data.a);
+
+  printf("OK\n");
+}
+
+#if defined(CRITBIT_PERSISTENT)
+static void *alloc_counted_node(void *const ctx)
+{
+  ++*(size_t *)ctx;
+  return malloc(critbit_node_size());
+}
+
+static void free_counted_node(void *const ctx, void *const node)
+{
+  --*(size_t *)ctx;
+  free(node);
+}
+
+/* Returns sorted items of cb. The caller must free data.a. */
+static struct collect_data collect_items(const struct critbit *const cb,
+    const size_t max_n)
+{
+  struct collect_data data = {
+    .a = malloc(sizeof(data.a[0]) * max_n),
+    .n = 0,
+  };
+  const struct critbit_visitor collect_visitor = {
+    .callback = &collect_callback,
+    .ctx = &data,
+  };
+  critbit_foreach(cb, &collect_visitor);
+  return data;
+}
+
+static void test_persistent(const size_t n)
+{
+  printf("test_persistent(n=%zu) ", n);
+
+  size_t node_count = 0;
+  const struct critbit_node_allocator node_allocator = {
+    .alloc_node = &alloc_counted_node,
+    .free_node = &free_counted_node,
+    .ctx = &node_count,
+  };
+  struct critbit *const cb = critbit_create(&node_allocator);
+  struct critbit *s0 = critbit_snapshot(cb);
+  uintptr_t v;
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      v = rand() * 2;
+    } while (v == 0);
+    critbit_add(cb, v);
+  }
+  check_range(s0, NULL, 0, 0);
+  critbit_delete(s0);
+
+  /* Snapshots don't copy nodes. */
+  const size_t max_n = 2 * n + 1;
+  const struct collect_data data1 = collect_items(cb, max_n);
+  assert(node_count == data1.n - 1);
+  struct critbit *const s1 = critbit_snapshot(cb);
+  assert(node_count == data1.n - 1);
+
+  for (size_t i = 0; i < data1.n; i += 2) {
+    critbit_remove(cb, data1.a[i]);
+  }
+  for (size_t i = 0; i < n / 2; ++i) {
+    critbit_add(cb, (uintptr_t)rand() * 2 + 2);
+  }
+  check_range(s1, data1.a, 0, data1.n);
+  const struct collect_data data2 = collect_items(cb, max_n);
+  struct critbit *const s2 = critbit_snapshot(cb);
+
+  /* Snapshots may be modified without affecting the original. */
+  for (size_t i = 0; i < data2.n; i += 3) {
+    critbit_remove(s2, data2.a[i]);
+  }
+  check_range(cb, data2.a, 0, data2.n);
+  critbit_add(s1, data2.a[data2.n / 2] + 1000002);
+  critbit_remove(s1, data1.a[data1.n / 2]);
+  const struct collect_data data3 = collect_items(s1, max_n);
+  const struct collect_data data4 = collect_items(s2, max_n);
+
+  /* Structural operations copy shared nodes too. */
+  struct critbit *const s3 = critbit_snapshot(cb);
+  struct critbit *tmp = critbit_snapshot(s1);
+  critbit_union(cb, tmp);
+  critbit_delete(tmp);
+  critbit_intersect(cb, s2);
+  check_range(s2, data4.a, 0, data4.n);
+  struct critbit *const s4 = critbit_snapshot(cb);
+  critbit_difference(cb, s1);
+  tmp = critbit_split_at(s1, data3.a[data3.n / 3]);
+  critbit_join(tmp, s1);
+  critbit_join(s1, tmp);
+  critbit_delete(tmp);
+  check_range(s1, data3.a, 0, data3.n);
+  check_range(s2, data4.a, 0, data4.n);
+  check_range(s3, data2.a, 0, data2.n);
+  critbit_delete(s1);
+  critbit_delete(s2);
+  critbit_delete(s3);
+  critbit_delete(s4);
+
+  /* Nodes, which aren't shared, are modified in place. */
+  const struct collect_data data5 = collect_items(cb, max_n);
+  assert(data5.n == 0 || node_count == data5.n - 1);
+  if (data5.n > 0) {
+    critbit_remove(cb, data5.a[0]);
+    assert(node_count + 2 == data5.n);
+  }
+  critbit_delete(cb);
+  assert(node_count == 0);
+
+  free(data1.a);
+  free(data2.a);
+  free(data3.a);
+  free(data4.a);
+  free(data5.a);
+
+  printf("OK\n");
+}
+#endif
+
+/*
+ * Retired nodes are collected in a list and released after all the readers
+ * finish. Real applications would release them at the end of a grace period.
+ */
+struct retired_nodes
+{
+  void **nodes;
+  size_t n;
+  size_t capacity;
+#if defined(CRITBIT_CONCURRENT)
+  pthread_mutex_t mutex;
+#endif
+};
+
+static void retire_critbit_node(void *const ctx, void *const node)
+{
+  struct retired_nodes *const r = (struct retired_nodes *)ctx;
+#if defined(CRITBIT_CONCURRENT)
+  pthread_mutex_lock(&r->mutex);
+#endif
+  if (r->n == r->capacity) {
+    r->capacity = (r->capacity == 0) ? 16 : r->capacity * 2;
+    r->nodes = realloc(r->nodes, sizeof(r->nodes[0]) * r->capacity);
+  }
+  r->nodes[r->n++] = node;
+#if defined(CRITBIT_CONCURRENT)
+  pthread_mutex_unlock(&r->mutex);
+#endif
+}
+
+static void *alloc_critbit_node_ctx(void *const ctx)
+{
+  (void)ctx;
+  return malloc(critbit_node_size());
+}
+
+static void free_critbit_node_ctx(void *const ctx, void *const node)
+{
+  (void)ctx;
+  free(node);
+}
+
+static void release_retired_nodes(struct retired_nodes *const r)
+{
+  for (size_t i = 0; i < r->n; ++i) {
+    free(r->nodes[i]);
+  }
+  r->n = 0;
+}
+
+static void test_retire_node(const size_t n)
+{
+  printf("test_retire_node(n=%zu) ", n);
+
+  struct retired_nodes r = {
+    .nodes = NULL,
+    .n = 0,
+    .capacity = 0,
+  };
+#if defined(CRITBIT_CONCURRENT)
+  pthread_mutex_init(&r.mutex, NULL);
+#endif
+  const struct critbit_node_allocator node_allocator = {
+    .alloc_node = &alloc_critbit_node_ctx,
+    .free_node = &free_critbit_node_ctx,
+    .ctx = &r,
+    .retire_node = &retire_critbit_node,
+  };
+  struct critbit *const cb = critbit_create(&node_allocator);
+
+  for (size_t i = 1; i <= n; ++i) {
+    critbit_add(cb, i * 2);
+  }
+  /* Removing the last item doesn't delete any nodes. */
+  for (size_t i = 1; i <= n; ++i) {
+    const int rv = critbit_remove(cb, i * 2);
+    assert(rv);
+    (void)rv;
+    assert(r.n == ((i < n) ? i : n - 1));
+  }
+  release_retired_nodes(&r);
+
+  critbit_delete(cb);
+  free(r.nodes);
+#if defined(CRITBIT_CONCURRENT)
+  pthread_mutex_destroy(&r.mutex);
+#endif
+
+  printf("OK\n");
+}
+
+#if defined(CRITBIT_CONCURRENT)
+struct concurrent_data
+{
+  struct critbit *cb;
+  size_t n;
+  int stop;
+};
+
+/* Checks that even items are always visible while a writer churns odd ones. */
+static void *concurrent_reader(void *const ctx)
+{
+  struct concurrent_data *const data = (struct concurrent_data *)ctx;
+  while (!__atomic_load_n(&data->stop, __ATOMIC_ACQUIRE)) {
+    for (size_t i = 0; i < data->n; i += 2) {
+      const int rv = critbit_contains(data->cb, (i + 1) * 2);
+      assert(rv);
+      (void)rv;
+    }
+  }
+  return NULL;
+}
+
+static void test_concurrent(const size_t n)
+{
+  static const size_t READERS = 4;
+
+  printf("test_concurrent(n=%zu, readers=%zu) ", n, READERS);
+
+  struct retired_nodes r = {
+    .nodes = NULL,
+    .n = 0,
+    .capacity = 0,
+  };
+  pthread_mutex_init(&r.mutex, NULL);
+  const struct critbit_node_allocator node_allocator = {
+    .alloc_node = &alloc_critbit_node_ctx,
+    .free_node = &free_critbit_node_ctx,
+    .ctx = &r,
+    .retire_node = &retire_critbit_node,
+  };
+  struct concurrent_data data = {
+    .cb = critbit_create(&node_allocator),
+    .n = n,
+    .stop = 0,
+  };
+  for (size_t i = 0; i < n; i += 2) {
+    critbit_add(data.cb, (i + 1) * 2);
+  }
+
+  pthread_t readers[READERS];
+  for (size_t i = 0; i < READERS; ++i) {
+    pthread_create(&readers[i], NULL, &concurrent_reader, &data);
+  }
+  for (size_t k = 0; k < 10; ++k) {
+    for (size_t i = 1; i < n; i += 2) {
+      critbit_add(data.cb, (i + 1) * 2);
+    }
+    for (size_t i = 1; i < n; i += 2) {
+      critbit_remove(data.cb, (i + 1) * 2);
+    }
+  }
+  __atomic_store_n(&data.stop, 1, __ATOMIC_RELEASE);
+  for (size_t i = 0; i < READERS; ++i) {
+    pthread_join(readers[i], NULL);
+  }
+  release_retired_nodes(&r);
+
+  critbit_delete(data.cb);
+  free(r.nodes);
+  pthread_mutex_destroy(&r.mutex);
+
+  printf("OK\n");
+}
+#endif
+
+static void test_stats(const size_t n,
+    const struct critbit_node_allocator *const node_allocator)
+{
+  printf("test_stats(n=%zu) ", n);
+
+  struct critbit *const cb = critbit_create(node_allocator);
+  struct critbit_stats stats;
+
+  critbit_get_stats(cb, &stats);
+  assert(stats.node_count == 0);
+  assert(stats.leaf_count == 0);
+  assert(stats.max_depth == 0);
+
+  size_t m = 0;
+  uintptr_t v;
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      v = rand() * 2;
+    } while (v == 0);
+    m += critbit_add(cb, v);
+  }
+
+  critbit_get_stats(cb, &stats);
+  assert(stats.leaf_count == m);
+  assert(stats.node_count == m - 1);
+  assert(stats.node_bytes == stats.node_count * critbit_node_size());
+  assert(stats.avg_depth > 0);
+  assert(stats.avg_depth <= stats.max_depth);
+  size_t leaf_count = 0;
+  size_t node_count = 0;
+  for (size_t i = 0; i < sizeof(stats.depth_histogram) /
+      sizeof(stats.depth_histogram[0]); ++i) {
+    leaf_count += stats.depth_histogram[i];
+    if (i > stats.max_depth) {
+      assert(stats.depth_histogram[i] == 0);
+    }
+  }
+  for (size_t i = 0; i < sizeof(stats.crit_bit_histogram) /
+      sizeof(stats.crit_bit_histogram[0]); ++i) {
+    node_count += stats.crit_bit_histogram[i];
+  }
+  assert(leaf_count == stats.leaf_count);
+  assert(node_count == stats.node_count);
+  assert(stats.depth_histogram[stats.max_depth] > 0);
+
+#if defined(CRITBIT_COUNTERS)
+  struct critbit_counters counters;
+  critbit_get_counters(cb, &counters);
+  assert(counters.add_calls == n);
+  assert(counters.add_node_visits > 0);
+  critbit_reset_counters(cb);
+  for (size_t i = 0; i < 10; ++i) {
+    critbit_contains(cb, 2);
+  }
+  critbit_remove(cb, 2);
+  critbit_get_counters(cb, &counters);
+  assert(counters.contains_calls == 10);
+  assert(counters.contains_node_visits >= 10);
+  assert(counters.contains_node_visits <= 10 * stats.max_depth);
+  assert(counters.remove_calls == 1);
+  assert(counters.add_calls == 0);
+
+  /* Splits aren't counted as adds, though they descend the same way. */
+  struct critbit *const right = critbit_split_at(cb, (uintptr_t)n * 2);
+  critbit_join(cb, right);
+  critbit_delete(right);
+  critbit_get_counters(cb, &counters);
+  assert(counters.add_calls == 0);
+  assert(counters.add_node_visits == 0);
+#endif
+
+  critbit_delete(cb);
+
+  printf("OK\n");
+}
+
+#if defined(CRITBIT_ORDER_STATS)
+/* Checks order statistics of cb against its items. */
+static void check_order_stats(const struct critbit *const cb)
+{
+  const size_t n = critbit_size(cb);
+  struct collect_data data = {
+    .a = malloc(sizeof(data.a[0]) * (n + 1)),
+    .n = 0,
+  };
+  const struct critbit_visitor collect_visitor = {
+    .callback = &collect_callback,
+    .ctx = &data,
+  };
+  critbit_foreach(cb, &collect_visitor);
+  assert(data.n == n);
+
+  uintptr_t v;
+  for (size_t i = 0; i < n; ++i) {
+    int rv = critbit_select(cb, i, &v);
+    assert(rv);
+    (void)rv;
+    assert(v == data.a[i]);
+    assert(critbit_rank(cb, v) == i);
+    v += 2;
+    assert(critbit_rank(cb, v) == lower_bound(data.a, n, v));
+    v -= 4;
+    if (v != 0) {
+      assert(critbit_rank(cb, v) == lower_bound(data.a, n, v));
+    }
+  }
+  assert(!critbit_select(cb, n, &v));
+  if (n > 0) {
+    const uintptr_t lo = data.a[n / 4];
+    const uintptr_t hi = data.a[n - 1 - n / 4];
+    assert(critbit_count_range(cb, lo, hi) == n - 1 - n / 4 - n / 4);
+    assert(critbit_count_range(cb, hi, lo) == 0);
+
+    /* Bounds needn't be valid keys. */
+    assert(critbit_count_range(cb, 0, UINTPTR_MAX) == n);
+    assert(critbit_count_range(cb, lo - 1, hi + 1) == n - n / 4 - n / 4);
+    (void)lo;
+    (void)hi;
+  }
+  free(data.a);
+}
+
+static void test_order_stats(const size_t n,
+    const struct critbit_node_allocator *const node_allocator)
+{
+  printf("test_order_stats(n=%zu) ", n);
+
+  struct critbit *cb = critbit_create(node_allocator);
+  uintptr_t v;
+  assert(critbit_size(cb) == 0);
+  assert(critbit_rank(cb, 2) == 0);
+  assert(!critbit_select(cb, 0, &v));
+  assert(critbit_count_range(cb, 2, 4) == 0);
+
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      v = rand() * 2;
+    } while (v == 0);
+    critbit_add(cb, v);
+    if (i % 3 == 0) {
+      critbit_remove(cb, rand() % 2 ? v : v + 2);
+    }
+  }
+  check_order_stats(cb);
+
+  /* Counts must survive structural operations. */
+  const uintptr_t half = (uintptr_t)RAND_MAX + 1;
+  struct critbit *right = critbit_split_at(cb, half);
+  check_order_stats(cb);
+  check_order_stats(right);
+  struct critbit *other = critbit_split_at(right, half / 2 * 3);
+  check_order_stats(right);
+  check_order_stats(other);
+  critbit_join(cb, right);
+  check_order_stats(cb);
+  critbit_union(cb, other);
+  check_order_stats(cb);
+  critbit_delete(other);
+
+  for (size_t i = 0; i < n; ++i) {
+    critbit_add(right, (uintptr_t)rand() * 2 + 2);
+  }
+  critbit_intersect(right, cb);
+  check_order_stats(right);
+  critbit_difference(cb, right);
+  check_order_stats(cb);
+  critbit_delete(right);
+  critbit_delete(cb);
+
+  printf("OK\n");
+}
+#endif
+
+static int compare_keys(const void *const a, const void *const b)
+{
+  const uintptr_t x = *(const uintptr_t *)a;
+  const uintptr_t y = *(const uintptr_t *)b;
+  return (x > y) - (x < y);
+}
+
+#if defined(CRITBIT_ANY_KEYS)
+static void test_any_keys(const size_t n,
+    const struct critbit_node_allocator *const node_allocator)
+{
+  printf("test_any_keys(n=%zu) ", n);
+
+  /* Zero, odd and extreme keys mixed with random full-width keys. */
+  uintptr_t *const keys = malloc(sizeof(keys[0]) * n);
+  static const uintptr_t special_keys[] = {0, 1, 2, 3, UINTPTR_MAX,
+      UINTPTR_MAX - 1, UINTPTR_MAX / 2, UINTPTR_MAX / 2 + 1};
+  static const size_t SPECIAL_KEYS_COUNT =
+      sizeof(special_keys) / sizeof(special_keys[0]);
+  assert(n >= SPECIAL_KEYS_COUNT);
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = (i < SPECIAL_KEYS_COUNT) ? special_keys[i] :
+        (((uintptr_t)rand() << 40) ^ ((uintptr_t)rand() << 20) ^ rand());
+  }
+
+  struct critbit *cb = critbit_create(node_allocator);
+  assert(!critbit_contains(cb, 0));
+  int rv = critbit_remove(cb, 0);
+  assert(!rv);
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const int exists = critbit_contains(cb, keys[i]);
+    rv = critbit_add(cb, keys[i]);
+    assert(rv == !exists);
+    (void)exists;
+    count += rv;
+    assert(critbit_contains(cb, keys[i]));
+  }
+
+  struct collect_data data = {
+    .a = malloc(sizeof(data.a[0]) * n),
+    .n = 0,
+  };
+  const struct critbit_visitor collect_visitor = {
+    .callback = &collect_callback,
+    .ctx = &data,
+  };
+  critbit_foreach(cb, &collect_visitor);
+  assert(data.n == count);
+  for (size_t i = 1; i < data.n; ++i) {
+    assert(data.a[i - 1] < data.a[i]);
+  }
+  assert(data.a[0] == 0);
+  assert(data.a[data.n - 1] == UINTPTR_MAX);
+
+  struct critbit_cursor c;
+  rv = critbit_seek_first(&c, cb);
+  assert(rv);
+  assert(critbit_cursor_get(&c) == 0);
+  rv = critbit_cursor_prev(&c);
+  assert(!rv);
+  rv = critbit_seek_ge(&c, cb, 1);
+  assert(rv);
+  assert(critbit_cursor_get(&c) == 1);
+  rv = critbit_cursor_next(&c);
+  assert(rv);
+  assert(critbit_cursor_get(&c) == 2);
+  rv = critbit_seek_last(&c, cb);
+  assert(rv);
+  assert(critbit_cursor_get(&c) == UINTPTR_MAX);
+
+  /* The crit-bit built from sorted keys must have the same items. */
+  struct critbit *const sorted = critbit_build_sorted(node_allocator,
+      data.a, data.n);
+  int *const out = malloc(sizeof(out[0]) * n);
+  critbit_contains_batch(sorted, keys, n, out);
+  for (size_t i = 0; i < n; ++i) {
+    assert(out[i]);
+  }
+  critbit_delete(sorted);
+
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_map_node_size());
+  struct critbit_map *const m = critbit_map_create(&s.node_allocator);
+  for (size_t i = 0; i < data.n; ++i) {
+    rv = critbit_map_put(m, data.a[i], &data.a[i]);
+    assert(rv);
+  }
+  for (size_t i = 0; i < data.n; ++i) {
+    void *value = NULL;
+    rv = critbit_map_get(m, data.a[i], &value);
+    assert(rv);
+    assert(value == &data.a[i]);
+    rv = critbit_map_remove(m, data.a[i], NULL);
+    assert(rv);
+    rv = critbit_map_get(m, data.a[i], &value);
+    assert(!rv);
+  }
+  critbit_map_delete(m);
+  critbit_slab_allocator_destroy(&s);
+
+  for (size_t i = 0; i < n; ++i) {
+    count -= critbit_remove(cb, keys[i]);
+    assert(!critbit_contains(cb, keys[i]));
+  }
+  assert(count == 0);
+  critbit_delete(cb);
+
+  /* Every crit bit, including the lowest one, is used by some node. */
+  qsort(keys, SPECIAL_KEYS_COUNT, sizeof(keys[0]), &compare_keys);
+  cb = critbit_build_sorted(node_allocator, keys, SPECIAL_KEYS_COUNT);
+  struct critbit_stats stats;
+  critbit_get_stats(cb, &stats);
+  assert(stats.leaf_count == SPECIAL_KEYS_COUNT);
+  assert(stats.crit_bit_histogram[_CRITBIT_MAX_DEPTH - 1] > 0);
+  critbit_delete(cb);
+
+  free(out);
+  free(data.a);
+  free(keys);
+
+  printf("OK\n");
+}
+#endif
+
+/*
+ * Checks prefix queries on cb against the sorted unique items a[0..n).
+ * Returns the number of items with the prefix.
+ */
+static size_t check_prefix(const struct critbit *const cb,
+    const uintptr_t *const a, const size_t n, const uintptr_t prefix,
+    const unsigned bits)
+{
+  const uintptr_t mask = (bits == 0) ? 0 :
+      ~((uintptr_t)0) << (_CRITBIT_PTR_BITS - bits);
+  const size_t lo = lower_bound(a, n, prefix & mask);
+  size_t hi = lo;
+  while (hi < n && (a[hi] & mask) == (prefix & mask)) {
+    ++hi;
+  }
+
+  struct collect_data data = {
+    .a = malloc(sizeof(data.a[0]) * (hi - lo + 1)),
+    .n = 0,
+  };
+  const struct critbit_visitor collect_visitor = {
+    .callback = &collect_callback,
+    .ctx = &data,
+  };
+  critbit_foreach_prefix(cb, prefix, bits, &collect_visitor);
+  assert(data.n == hi - lo);
+  for (size_t i = lo; i < hi; ++i) {
+    assert(data.a[i - lo] == a[i]);
+  }
+
+  struct critbit_subtree st;
+  const int found = critbit_subtree_root(cb, prefix, bits, &st);
+  assert(found == (hi > lo));
+  if (found) {
+    assert(st.shared_bits >= bits);
+    assert(st.shared_bits == _CRITBIT_PTR_BITS || hi - lo > 1);
+    data.n = 0;
+    critbit_subtree_foreach(&st, &collect_visitor);
+    assert(data.n == hi - lo);
+    assert(data.a[0] == a[lo]);
+  }
+#if defined(CRITBIT_ORDER_STATS)
+  assert(critbit_count_prefix(cb, prefix, bits) == hi - lo);
+#endif
+  free(data.a);
+  return hi - lo;
+}
+
+static void test_prefix(const size_t n,
+    const struct critbit_node_allocator *const node_allocator)
+{
+  printf("test_prefix(n=%zu) ", n);
+
+  struct critbit *const cb = critbit_create(node_allocator);
+  int rv = critbit_remove_prefix(cb, 0, 0);
+  assert(!rv);
+  assert(check_prefix(cb, NULL, 0, 0, 0) == 0);
+
+  /* Random items and clusters of items in aligned regions. */
+  uintptr_t v;
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      v = rand() * 2;
+    } while (v == 0);
+    critbit_add(cb, v);
+  }
+  for (size_t i = 1; i <= 64; ++i) {
+    const uintptr_t base = (uintptr_t)i << (_CRITBIT_PTR_BITS - 8);
+    for (size_t j = 0; j < i * 16; ++j) {
+      critbit_add(cb, base + j * 16);
+    }
+  }
+  struct collect_data data = {
+    .a = malloc(sizeof(data.a[0]) * (n + 64 * 65 * 8)),
+    .n = 0,
+  };
+  const struct critbit_visitor collect_visitor = {
+    .callback = &collect_callback,
+    .ctx = &data,
+  };
+  critbit_foreach(cb, &collect_visitor);
+
+  /* Prefixes of existing items and prefixes next to them of every length. */
+  size_t matched = 0;
+  for (size_t i = 0; i < data.n; i += 1 + data.n / 20) {
+    for (unsigned bits = 0; bits <= _CRITBIT_PTR_BITS; ++bits) {
+      matched += check_prefix(cb, data.a, data.n, data.a[i], bits);
+      check_prefix(cb, data.a, data.n, data.a[i] ^ 2, bits);
+      check_prefix(cb, data.a, data.n, ~data.a[i], bits);
+    }
+  }
+  assert(matched > 0);
+  assert(check_prefix(cb, data.a, data.n, 0, 0) == data.n);
+
+#if defined(CRITBIT_PERSISTENT)
+  struct critbit *const snapshot = critbit_snapshot(cb);
+#endif
+
+  /* Remove clusters, a part of a cluster and a single item. */
+  for (size_t i = 1; i <= 64; i += 3) {
+    const uintptr_t base = (uintptr_t)i << (_CRITBIT_PTR_BITS - 8);
+    rv = critbit_remove_prefix(cb, base, 8);
+    assert(rv);
+    rv = critbit_remove_prefix(cb, base, 8);
+    assert(!rv);
+    assert(!critbit_contains(cb, base));
+  }
+  const uintptr_t base = (uintptr_t)2 << (_CRITBIT_PTR_BITS - 8);
+  rv = critbit_remove_prefix(cb, base, _CRITBIT_PTR_BITS - 6);
+  assert(rv);
+  assert(!critbit_contains(cb, base + 48));
+  assert(critbit_contains(cb, base + 64));
+  rv = critbit_remove_prefix(cb, base + 64, _CRITBIT_PTR_BITS);
+  assert(rv);
+  assert(!critbit_contains(cb, base + 64));
+  assert(critbit_contains(cb, base + 80));
+
+  uintptr_t *const a = malloc(sizeof(a[0]) * data.n);
+  size_t m = 0;
+  for (size_t i = 0; i < data.n; ++i) {
+    v = data.a[i];
+    const size_t cluster = (size_t)(v >> (_CRITBIT_PTR_BITS - 8));
+    const int removed = (cluster != 0 && cluster % 3 == 1) ||
+        (v >= base && v <= base + 64);
+    if (!removed) {
+      a[m++] = v;
+    }
+  }
+  check_range(cb, a, 0, m);
+#if defined(CRITBIT_ORDER_STATS)
+  check_order_stats(cb);
+#endif
+#if defined(CRITBIT_PERSISTENT)
+  check_range(snapshot, data.a, 0, data.n);
+  critbit_delete(snapshot);
+#endif
+
+  rv = critbit_remove_prefix(cb, 0, 0);
+  assert(rv);
+  check_range(cb, a, 0, 0);
+  rv = critbit_add(cb, 2);
+  assert(rv);
+  (void)rv;
+
+  critbit_delete(cb);
+  free(a);
+  free(data.a);
+
+  printf("OK\n");
+}
+
+#if defined(CRITBIT_TRACE)
+struct trace_data
+{
+  size_t allocated_nodes;
+  size_t freed_nodes;
+  size_t deep_paths;
+};
+
+static void trace_alloc_node(void *const ctx, void *const node)
+{
+  struct trace_data *const data = (struct trace_data *)ctx;
+  assert(node != NULL);
+  (void)node;
+  ++data->allocated_nodes;
+}
+
+static void trace_free_node(void *const ctx, void *const node)
+{
+  struct trace_data *const data = (struct trace_data *)ctx;
+  assert(node != NULL);
+  (void)node;
+  ++data->freed_nodes;
+}
+
+static void trace_deep_path(void *const ctx, const enum critbit_trace_op op,
+    const uintptr_t v, const size_t depth)
+{
+  struct trace_data *const data = (struct trace_data *)ctx;
+  assert(op < CRITBIT_TRACE_OPS);
+  assert(v != 0);
+  assert(depth > 10);
+  (void)op;
+  (void)v;
+  (void)depth;
+  ++data->deep_paths;
+}
+
+static uint64_t get_depth_count(const struct critbit_trace_stats *const stats,
+    const size_t min_depth)
+{
+  uint64_t count = 0;
+  for (size_t i = min_depth; i <= _CRITBIT_MAX_DEPTH; ++i) {
+    count += stats->depth_histogram[i];
+  }
+  return count;
+}
+
+static void test_trace(const size_t n,
+    const struct critbit_node_allocator *const node_allocator)
+{
+  printf("test_trace(n=%zu) ", n);
+
+  /* Bucket bounds are within 1/16 of recorded values. */
+  for (uint64_t v = 0; v < (UINT64_MAX >> 8); v = v * 3 / 2 + 1) {
+    const size_t index = _critbit_histogram_get_index(v);
+    assert(index < CRITBIT_HISTOGRAM_BUCKETS);
+    assert(_critbit_histogram_get_upper_bound(index) >= v);
+    assert(_critbit_histogram_get_upper_bound(index) - v <= v / 16);
+    assert(index == 0 || _critbit_histogram_get_upper_bound(index - 1) < v);
+    (void)index;
+  }
+  assert(_critbit_histogram_get_index(UINT64_MAX) ==
+      CRITBIT_HISTOGRAM_BUCKETS - 1);
+  assert(_critbit_histogram_get_upper_bound(CRITBIT_HISTOGRAM_BUCKETS - 1) ==
+      UINT64_MAX);
+
+  struct critbit_histogram *const h = malloc(sizeof(*h));
+  memset(h, 0, sizeof(*h));
+  assert(critbit_histogram_percentile(h, 50) == 0);
+  for (uint64_t v = 1; v <= 1000; ++v) {
+    _critbit_histogram_record(h, v);
+  }
+  assert(critbit_histogram_percentile(h, 0) == 1);
+  assert(critbit_histogram_percentile(h, 50) >= 500);
+  assert(critbit_histogram_percentile(h, 50) <= 500 + 500 / 16);
+  assert(critbit_histogram_percentile(h, 99) >= 990);
+  assert(critbit_histogram_percentile(h, 100) == 1000);
+  free(h);
+
+  struct trace_data data = {
+    .allocated_nodes = 0,
+    .freed_nodes = 0,
+    .deep_paths = 0,
+  };
+  struct critbit_tracer *const tracer = malloc(sizeof(*tracer));
+  critbit_tracer_init(tracer);
+  tracer->on_alloc_node = &trace_alloc_node;
+  tracer->on_free_node = &trace_free_node;
+  tracer->on_deep_path = &trace_deep_path;
+  tracer->deep_path_threshold = 10;
+  tracer->ctx = &data;
+  struct critbit_traced_allocator ta;
+  critbit_traced_allocator_init(&ta, node_allocator, tracer);
+  struct critbit *const cb = critbit_create(&ta.node_allocator);
+  critbit_set_tracer(cb, tracer);
+
+  size_t m = 0;
+  uintptr_t v;
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      v = rand() * 2;
+    } while (v == 0);
+    m += critbit_add(cb, v);
+  }
+  /* Powers of two produce a path as deep as the key size. */
+  for (uint8_t bit = 1; bit < _CRITBIT_PTR_BITS; ++bit) {
+    m += critbit_add(cb, (uintptr_t)1 << bit);
+  }
+  assert(data.allocated_nodes == m - 1);
+  assert(data.freed_nodes == 0);
+
+  struct critbit_stats stats;
+  critbit_get_stats(cb, &stats);
+  const struct critbit_trace_stats *const add_stats =
+      &tracer->stats[CRITBIT_TRACE_ADD];
+  const uint64_t add_count = get_depth_count(add_stats, 0);
+  assert(add_stats->cycles.count == n + _CRITBIT_PTR_BITS - 1);
+  assert(add_count == add_stats->cycles.count);
+  (void)add_count;
+  assert(get_depth_count(add_stats, stats.max_depth + 1) == 0);
+  assert(add_stats->depth_histogram[0] > 0);
+  assert(data.deep_paths == get_depth_count(add_stats, 11));
+  assert(data.deep_paths > 0);
+  assert(critbit_histogram_percentile(&add_stats->cycles, 50) <=
+      critbit_histogram_percentile(&add_stats->cycles, 99));
+  assert(critbit_histogram_percentile(&add_stats->cycles, 100) ==
+      add_stats->cycles.max);
+
+  critbit_tracer_reset(tracer);
+  data.deep_paths = 0;
+  assert(tracer->stats[CRITBIT_TRACE_ADD].cycles.count == 0);
+  int rv = critbit_contains(cb, 2);
+  assert(rv);
+  rv = critbit_contains(cb, ((uintptr_t)1 << (_CRITBIT_PTR_BITS - 1)) + 2);
+  assert(!rv);
+  const struct critbit_trace_stats *const contains_stats =
+      &tracer->stats[CRITBIT_TRACE_CONTAINS];
+  assert(contains_stats->cycles.count == 2);
+  assert(contains_stats->depth_histogram[stats.max_depth] == 1);
+  assert(data.deep_paths == get_depth_count(contains_stats, 11));
+
+  /* Operations on a crit-bit without a tracer aren't recorded. */
+  critbit_set_tracer(cb, NULL);
+  rv = critbit_contains(cb, 2);
+  assert(rv);
+  assert(contains_stats->cycles.count == 2);
+  (void)contains_stats;
+  critbit_set_tracer(cb, tracer);
+
+  critbit_tracer_reset(tracer);
+  rv = critbit_remove(cb, 2);
+  assert(rv);
+  rv = critbit_remove(cb, 2);
+  assert(!rv);
+  (void)rv;
+  assert(tracer->stats[CRITBIT_TRACE_REMOVE].cycles.count == 2);
+  assert(data.freed_nodes == 1);
+
+  critbit_delete(cb);
+  assert(data.freed_nodes == data.allocated_nodes);
+  free(tracer);
+
+  printf("OK\n");
+}
+#endif
+
+struct check_map_data
+{
+  uintptr_t prev_key;
+  size_t n;
+};
+
+static void check_map_callback(void *const ctx, const uintptr_t key,
+    void *const value)
+{
+  struct check_map_data *const data = (struct check_map_data *)ctx;
+  assert(data->prev_key < key);
+  assert((uintptr_t)value == ~key);
+  (void)value;
+  data->prev_key = key;
+  ++data->n;
+}
+
+static void test_map(const size_t n)
+{
+  printf("test_map(n=%zu) ", n);
+
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_map_node_size());
+  struct critbit_map *const m = critbit_map_create(&s.node_allocator);
+  uintptr_t key;
+  void *value;
+  int rv;
+
+  rv = critbit_map_get(m, 2, &value);
+  assert(!rv);
+
+  size_t count = 0;
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      key = rand() * 2;
+    } while (key == 0);
+    rv = critbit_map_put(m, key, (void *)key);
+    if (!rv) {
+      continue;
+    }
+    ++count;
+    rv = critbit_map_get(m, key, &value);
+    assert(rv);
+    assert(value == (void *)key);
+  }
+
+  /* Replace all the values. */
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      key = rand() * 2;
+    } while (key == 0);
+    critbit_map_put(m, key, (void *)~key);
+    rv = critbit_map_get(m, key, &value);
+    assert(rv);
+    assert(value == (void *)~key);
+  }
+
+  struct check_map_data data = {
+    .prev_key = 0,
+    .n = 0,
+  };
+  const struct critbit_map_visitor check_map_visitor = {
+    .callback = &check_map_callback,
+    .ctx = &data,
+  };
+  critbit_map_foreach(m, &check_map_visitor);
+  assert(data.n == count);
+
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      key = rand() * 2;
+    } while (key == 0);
+    value = NULL;
+    rv = critbit_map_remove(m, key, &value);
+    if (!rv) {
+      continue;
+    }
+    --count;
+    assert(value == (void *)~key);
+    rv = critbit_map_get(m, key, &value);
+    assert(!rv);
+
+    /* Check values for the remaining keys now and then. */
+    if (count % 1024 == 0) {
+      data.prev_key = 0;
+      data.n = 0;
+      critbit_map_foreach(m, &check_map_visitor);
+      assert(data.n == count);
+    }
+  }
+  assert(count == 0);
+
+  critbit_map_delete(m);
+  critbit_slab_allocator_destroy(&s);
+
+  printf("OK\n");
+}
+
+struct check_bytes_data
+{
+  const char *prev_key;
+  size_t key_size;
+  size_t n;
+};
+
+static void check_bytes_callback(void *const ctx, const void *const key)
+{
+  struct check_bytes_data *const data = (struct check_bytes_data *)ctx;
+  if (data->prev_key != NULL) {
+    if (data->key_size == 0) {
+      assert(strcmp(data->prev_key, key) < 0);
+    }
+    else {
+      assert(memcmp(data->prev_key, key, data->key_size) < 0);
+    }
+  }
+  data->prev_key = key;
+  ++data->n;
+}
+
+static void test_bytes(const size_t n, const size_t key_size)
+{
+  printf("test_bytes(n=%zu, key_size=%zu) ", n, key_size);
+
+  /* Keys are 8-byte aligned and short enough for shared prefixes. */
+  static const size_t stride = 24;
+  char *const keys = malloc(stride * n);
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    char *const key = keys + i * stride;
+    if (key_size == 0) {
+      snprintf(key, stride, "%x", (unsigned)rand() % 100000);
+    }
+    else {
+      for (size_t j = 0; j < key_size; ++j) {
+        key[j] = (char)((rand() & 1) ? rand() : 0);
+      }
+    }
+  }
+
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_bytes_node_size());
+  critbit_slab_allocator_set_exclusive(&s);
+  struct critbit_bytes *const cb = critbit_bytes_create(&s.node_allocator,
+      key_size);
+  int rv;
+
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const char *const key = keys + i * stride;
+    const int exists = critbit_bytes_contains(cb, key);
+    rv = critbit_bytes_add(cb, key);
+    assert(rv == !exists);
+    (void)exists;
+    count += rv;
+    rv = critbit_bytes_contains(cb, key);
+    assert(rv);
+  }
+
+  struct check_bytes_data data = {
+    .prev_key = NULL,
+    .key_size = key_size,
+    .n = 0,
+  };
+  const struct critbit_bytes_visitor check_bytes_visitor = {
+    .callback = &check_bytes_callback,
+    .ctx = &data,
+  };
+  critbit_bytes_foreach(cb, &check_bytes_visitor);
+  assert(data.n == count);
+
+  /* Remove a half of keys using copies in order to compare by value. */
+  char copy[24];
+  for (size_t i = 0; i < n; i += 2) {
+    memcpy(copy, keys + i * stride, stride);
+    rv = critbit_bytes_remove(cb, copy);
+    count -= rv;
+    rv = critbit_bytes_contains(cb, copy);
+    assert(!rv);
+  }
+  data.prev_key = NULL;
+  data.n = 0;
+  critbit_bytes_foreach(cb, &check_bytes_visitor);
+  assert(data.n == count);
+
+  critbit_bytes_delete(cb);
+  critbit_slab_allocator_destroy(&s);
+
+  /* Delete without release_all_nodes. */
+  const struct critbit_node_allocator node_allocator = {
+    .alloc_node = &alloc_critbit_bytes_node,
+    .free_node = &free_critbit_node,
+    .ctx = NULL,
+  };
+  struct critbit_bytes *const cb2 = critbit_bytes_create(&node_allocator,
+      key_size);
+  for (size_t i = 0; i < n; ++i) {
+    critbit_bytes_add(cb2, keys + i * stride);
+  }
+  critbit_bytes_delete(cb2);
+
+  free(keys);
+
+  printf("OK\n");
+}
+
+static void test_deep_bytes(const size_t depth)
+{
+  printf("test_deep_bytes(depth=%zu) ", depth);
+
+  /* Each key is a prefix of the next key, so the crit-bit degenerates. */
+  char *const s = malloc(depth + 1);
+  memset(s, 'a', depth);
+  s[depth] = 0;
+
+  struct critbit_slab_allocator a;
+  critbit_slab_allocator_init(&a, critbit_bytes_node_size());
+  struct critbit_bytes *const cb = critbit_bytes_create(&a.node_allocator, 0);
+  char **const keys = malloc(sizeof(keys[0]) * depth);
+  for (size_t i = 0; i < depth; ++i) {
+    keys[i] = malloc(depth + 1);
+    memcpy(keys[i], s + depth - i, i + 1);
+    const int rv = critbit_bytes_add(cb, keys[i]);
+    assert(rv);
+    (void)rv;
+  }
+
+  struct check_bytes_data data = {
+    .prev_key = NULL,
+    .key_size = 0,
+    .n = 0,
+  };
+  const struct critbit_bytes_visitor check_bytes_visitor = {
+    .callback = &check_bytes_callback,
+    .ctx = &data,
+  };
+  critbit_bytes_foreach(cb, &check_bytes_visitor);
+  assert(data.n == depth);
+  assert(strlen(data.prev_key) == depth - 1);
+
+  critbit_bytes_delete(cb);
+  critbit_slab_allocator_destroy(&a);
+  for (size_t i = 0; i < depth; ++i) {
+    free(keys[i]);
+  }
+  free(keys);
+  free(s);
+
+  printf("OK\n");
+}
+
+static void *alloc_critbit_bucket(void *const ctx)
+{
+  assert(ctx == NULL);
+  return malloc(critbit_hybrid_bucket_size());
+}
+
+static void test_array_search(void)
+{
+  printf("test_array_search(isa=%s) ", critbit_array_get_isa());
+
+  static const size_t MAX_N = 300;
+  uintptr_t a[300];
+  srand(0);
+
+  for (size_t n = 0; n <= MAX_N; n += (n < 40) ? 1 : 37) {
+    /* Keys around UINTPTR_MAX check unsigned compares in SIMD kernels. */
+    uintptr_t v = (n % 2 == 0) ? 1 : UINTPTR_MAX - 3 * n;
+    for (size_t i = 0; i < n; ++i) {
+      a[i] = v;
+      v += 1 + (uintptr_t)rand() % 3;
+    }
+    for (size_t j = 0; j < n + 2; ++j) {
+      const uintptr_t key = (j < n) ? a[j] - (uintptr_t)(j % 2) :
+          ((j == n) ? 0 : UINTPTR_MAX);
+      const size_t find_index = _critbit_array_find_scalar(a, n, key);
+      const size_t lower_bound = _critbit_array_lower_bound_scalar(a, n,
+          key);
+      assert(find_index == n || a[find_index] == key);
+      assert(lower_bound == n || a[lower_bound] >= key);
+      assert(lower_bound == 0 || a[lower_bound - 1] < key);
+
+      /* Compare all the kernels supported by the CPU with scalar ones. */
+      for (size_t k = 0; k < _CRITBIT_ARRAY_KERNELS_COUNT; ++k) {
+        const struct _critbit_array_kernels *const kernels =
+            &_CRITBIT_ARRAY_KERNELS[k];
+        if (!kernels->is_supported()) {
+          continue;
+        }
+        size_t index = kernels->find(a, n, key);
+        assert(index == find_index);
+        index = kernels->lower_bound(a, n, key);
+        assert(index == lower_bound);
+        (void)index;
+      }
+      assert(critbit_array_find(a, n, key) == find_index);
+      assert(critbit_array_lower_bound(a, n, key) == lower_bound);
+      (void)find_index;
+      (void)lower_bound;
+    }
+  }
+
+  printf("OK\n");
+}
+
+static void test_hybrid(const size_t n)
+{
+  printf("test_hybrid(n=%zu) ", n);
+
+  struct critbit_slab_allocator nodes;
+  struct critbit_slab_allocator buckets;
+  critbit_slab_allocator_init(&nodes, critbit_node_size());
+  critbit_slab_allocator_init(&buckets, critbit_hybrid_bucket_size());
+  struct critbit_hybrid *h = critbit_hybrid_create(&nodes.node_allocator,
+      &buckets.node_allocator);
+  uintptr_t v;
+  int rv;
+
+  rv = critbit_hybrid_contains(h, 2);
+  assert(!rv);
+
+  /* Random keys are sparse, while sequential keys fill buckets densely. */
+  size_t count = 0;
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      v = (i % 2 == 0) ? (uintptr_t)rand() * 2 : (i + 1) * 2;
+    } while (v == 0);
+    const int exists = critbit_hybrid_contains(h, v);
+    rv = critbit_hybrid_add(h, v);
+    assert(rv == !exists);
+    (void)exists;
+    count += rv;
+    rv = critbit_hybrid_contains(h, v);
+    assert(rv);
+  }
+
+  struct check_order_data order_data = {
+    .prev_v = 0,
+  };
+  const struct critbit_visitor check_order_visitor = {
+    .callback = &check_order_callback,
+    .ctx = &order_data,
+  };
+  critbit_hybrid_foreach(h, &check_order_visitor);
+  struct count_data data = {
+    .n = 0,
+  };
+  const struct critbit_visitor count_visitor = {
+    .callback = &count_callback,
+    .ctx = &data,
+  };
+  critbit_hybrid_foreach(h, &count_visitor);
+  assert(data.n == count);
+
+  srand(0);
+  for (size_t i = 0; i < n; ++i) {
+    do {
+      v = (i % 2 == 0) ? (uintptr_t)rand() * 2 : (i + 1) * 2;
+    } while (v == 0);
+    count -= critbit_hybrid_remove(h, v);
+    rv = critbit_hybrid_contains(h, v);
+    assert(!rv);
+
+    /* Check the remaining items now and then. */
+    if (i % 4096 == 0) {
+      order_data.prev_v = 0;
+      critbit_hybrid_foreach(h, &check_order_visitor);
+      data.n = 0;
+      critbit_hybrid_foreach(h, &count_visitor);
+      assert(data.n == count);
+    }
+  }
+  assert(count == 0);
+  data.n = 0;
+  critbit_hybrid_foreach(h, &count_visitor);
+  assert(data.n == 0);
+
+  critbit_hybrid_delete(h);
+  critbit_slab_allocator_destroy(&nodes);
+  critbit_slab_allocator_destroy(&buckets);
+
+  /* Delete a non-empty hybrid crit-bit node by node. */
+  const struct critbit_node_allocator node_allocator = {
+    .alloc_node = &alloc_critbit_node,
+    .free_node = &free_critbit_node,
+    .ctx = NULL,
+  };
+  const struct critbit_node_allocator bucket_allocator = {
+    .alloc_node = &alloc_critbit_bucket,
+    .free_node = &free_critbit_node,
+    .ctx = NULL,
+  };
+  h = critbit_hybrid_create(&node_allocator, &bucket_allocator);
+  for (size_t i = 0; i < n; ++i) {
+    critbit_hybrid_add(h, (i + 1) * 2);
+  }
+  critbit_hybrid_delete(h);
+
+  printf("OK\n");
+}
+
+static void *alloc_wide_node(void *const ctx)
+{
+  return malloc(*(const size_t *)ctx);
+}
+
+static void test_wide(const size_t n)
+{
+  printf("test_wide(n=%zu) ", n);
+
+  struct critbit_slab_allocator slabs[CRITBIT_WIDE_SIZE_CLASSES];
+  const struct critbit_node_allocator *node_allocators[
+      CRITBIT_WIDE_SIZE_CLASSES];
+  for (size_t i = 0; i < CRITBIT_WIDE_SIZE_CLASSES; ++i) {
+    critbit_slab_allocator_init(&slabs[i], critbit_wide_node_size(i));
+    node_allocators[i] = &slabs[i].node_allocator;
+  }
+  struct critbit_wide *w = critbit_wide_create(node_allocators);
+  uintptr_t v;
+  int rv;
+
+  rv = critbit_wide_contains(w, 2);
+  assert(!rv);
+
+  /*
+   * Full-width random keys make sparse nodes at all the levels, while
+   * sequential keys make full nodes at the bottom.
+   */
+  const size_t max_n = 2 * n;
+  uintptr_t *const keys = malloc(sizeof(keys[0]) * max_n);
+  for (size_t i = 0; i < max_n; ++i) {
+    keys[i] = (i % 2 == 0) ?
+        ((uintptr_t)(i + 1) * (uintptr_t)0x9e3779b97f4a7c15ULL) << 1 :
+        (i + 1) * 2;
+  }
+  size_t count = 0;
+  for (size_t i = 0; i < max_n; ++i) {
+    v = keys[i];
+    const int exists = critbit_wide_contains(w, v);
+    rv = critbit_wide_add(w, v);
+    assert(rv == !exists);
+    (void)exists;
+    count += rv;
+    rv = critbit_wide_add(w, v);
+    assert(!rv);
+    rv = critbit_wide_contains(w, v);
+    assert(rv);
+  }
+
+  qsort(keys, max_n, sizeof(keys[0]), &compare_keys);
+  size_t k = 0;
+  for (size_t i = 0; i < max_n; ++i) {
+    if (k == 0 || keys[k - 1] != keys[i]) {
+      keys[k++] = keys[i];
+    }
+  }
+  assert(k == count);
+  struct collect_data data = {
+    .a = malloc(sizeof(data.a[0]) * max_n),
+    .n = 0,
+  };
+  const struct critbit_visitor collect_visitor = {
+    .callback = &collect_callback,
+    .ctx = &data,
+  };
+  critbit_wide_foreach(w, &collect_visitor);
+  assert(data.n == count);
+  for (size_t i = 0; i < count; ++i) {
+    assert(data.a[i] == keys[i]);
+  }
+
+  /* Remove items in random order, so nodes shrink and collapse. */
+  srand(0);
+  for (size_t i = count; i > 1; --i) {
+    const size_t j = (size_t)rand() % i;
+    v = keys[j];
+    keys[j] = keys[i - 1];
+    keys[i - 1] = v;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    rv = critbit_wide_remove(w, keys[i]);
+    assert(rv);
+    rv = critbit_wide_remove(w, keys[i]);
+    assert(!rv);
+    rv = critbit_wide_contains(w, keys[i]);
+    assert(!rv);
+
+    /* Check the remaining items now and then. */
+    if (i % 4096 == 0) {
+      data.n = 0;
+      critbit_wide_foreach(w, &collect_visitor);
+      assert(data.n == count - i - 1);
+      for (size_t j = 1; j < data.n; ++j) {
+        assert(data.a[j - 1] < data.a[j]);
+      }
+      for (size_t j = i + 1; j < count; j += 97) {
+        rv = critbit_wide_contains(w, keys[j]);
+        assert(rv);
+      }
+    }
+  }
+  data.n = 0;
+  critbit_wide_foreach(w, &collect_visitor);
+  assert(data.n == 0);
+  critbit_wide_delete(w);
+  for (size_t i = 0; i < CRITBIT_WIDE_SIZE_CLASSES; ++i) {
+    critbit_slab_allocator_destroy(&slabs[i]);
+  }
+
+  /* Delete a non-empty wide crit-bit node by node. */
+  size_t node_sizes[CRITBIT_WIDE_SIZE_CLASSES];
+  struct critbit_node_allocator malloc_allocators[CRITBIT_WIDE_SIZE_CLASSES];
+  for (size_t i = 0; i < CRITBIT_WIDE_SIZE_CLASSES; ++i) {
+    node_sizes[i] = critbit_wide_node_size(i);
+    malloc_allocators[i].alloc_node = &alloc_wide_node;
+    malloc_allocators[i].free_node = &free_critbit_node_ctx;
+    malloc_allocators[i].ctx = &node_sizes[i];
+    malloc_allocators[i].release_all_nodes = NULL;
+    malloc_allocators[i].retire_node = NULL;
+    node_allocators[i] = &malloc_allocators[i];
+  }
+  w = critbit_wide_create(node_allocators);
+  for (size_t i = 0; i < count; ++i) {
+    critbit_wide_add(w, keys[i]);
+  }
+  critbit_wide_delete(w);
+
+  free(data.a);
+  free(keys);
+
+  printf("OK\n");
+}
+
+/* Spreads keys over the whole key space, so they hit all the shards. */
+static uintptr_t get_sharded_key(const size_t i)
+{
+  return ((uintptr_t)(i + 1) * (uintptr_t)0x9e3779b97f4a7c15ULL) << 1;
+}
+
+#define SHARDED_WRITERS ((size_t)4)
+#define SHARD_BITS 3
+
+struct sharded_writer_data
+{
+  struct critbit_sharded *sh;
+  size_t n;
+  size_t writer;
+};
+
+/* Adds all the writer keys, then removes odd ones. */
+static void *sharded_writer(void *const ctx)
+{
+  const struct sharded_writer_data *const data =
+      (const struct sharded_writer_data *)ctx;
+  for (size_t i = data->writer; i < data->n; i += SHARDED_WRITERS) {
+    const int rv = critbit_sharded_add(data->sh, get_sharded_key(i));
+    assert(rv);
+    (void)rv;
+  }
+  for (size_t i = data->writer; i < data->n; i += SHARDED_WRITERS) {
+    if (i % 2 == 1) {
+      const int rv = critbit_sharded_remove(data->sh, get_sharded_key(i));
+      assert(rv);
+      (void)rv;
+    }
+  }
+  return NULL;
+}
+
+static void test_sharded(const size_t n)
+{
+  printf("test_sharded(n=%zu, shard_bits=%d) ", n, SHARD_BITS);
+
+  const size_t shards_count = ((size_t)1) << SHARD_BITS;
+  struct critbit_slab_allocator slabs[1 << SHARD_BITS];
+  const struct critbit_node_allocator *node_allocators[1 << SHARD_BITS];
+  for (size_t i = 0; i < shards_count; ++i) {
+    critbit_slab_allocator_init(&slabs[i], critbit_node_size());
+    node_allocators[i] = &slabs[i].node_allocator;
+  }
+  struct critbit_sharded *sh = critbit_sharded_create(node_allocators,
+      SHARD_BITS);
+  struct critbit_sharded_cursor c;
+  int rv;
+
+  rv = critbit_sharded_seek_first(&c, sh);
+  assert(!rv);
+  rv = critbit_sharded_seek_last(&c, sh);
+  assert(!rv);
+  rv = critbit_sharded_contains(sh, 2);
+  assert(!rv);
+
+  uintptr_t *const keys = malloc(n * sizeof(keys[0]));
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = get_sharded_key(i);
+    rv = critbit_sharded_add(sh, keys[i]);
+    assert(rv);
+    rv = critbit_sharded_add(sh, keys[i]);
+    assert(!rv);
+    rv = critbit_sharded_contains(sh, keys[i]);
+    assert(rv);
+  }
+  qsort(keys, n, sizeof(keys[0]), &compare_keys);
+
+  struct check_order_data order_data = {
+    .prev_v = 0,
+  };
+  const struct critbit_visitor check_order_visitor = {
+    .callback = &check_order_callback,
+    .ctx = &order_data,
+  };
+  critbit_sharded_foreach(sh, &check_order_visitor);
+  struct count_data data = {
+    .n = 0,
+  };
+  const struct critbit_visitor count_visitor = {
+    .callback = &count_callback,
+    .ctx = &data,
+  };
+  critbit_sharded_foreach(sh, &count_visitor);
+  assert(data.n == n);
+
+  /* Cursors cross shard boundaries in both directions. */
+  rv = critbit_sharded_seek_first(&c, sh);
+  assert(rv);
+  for (size_t i = 0; i < n; ++i) {
+    assert(critbit_sharded_cursor_get(&c) == keys[i]);
+    rv = critbit_sharded_cursor_next(&c);
+    assert(rv == (i + 1 < n));
+  }
+  assert(critbit_sharded_cursor_get(&c) == keys[n - 1]);
+  rv = critbit_sharded_seek_last(&c, sh);
+  assert(rv);
+  for (size_t i = n; i > 0; --i) {
+    assert(critbit_sharded_cursor_get(&c) == keys[i - 1]);
+    rv = critbit_sharded_cursor_prev(&c);
+    assert(rv == (i > 1));
+  }
+  assert(critbit_sharded_cursor_get(&c) == keys[0]);
+
+  for (size_t i = 0; i < n; ++i) {
+    rv = critbit_sharded_seek_ge(&c, sh, keys[i]);
+    assert(rv && critbit_sharded_cursor_get(&c) == keys[i]);
+    rv = critbit_sharded_seek_le(&c, sh, keys[i]);
+    assert(rv && critbit_sharded_cursor_get(&c) == keys[i]);
+    rv = critbit_sharded_seek_ge(&c, sh, keys[i] + 2);
+    assert(rv == (i + 1 < n));
+    assert(!rv || critbit_sharded_cursor_get(&c) == keys[i + 1]);
+    rv = critbit_sharded_seek_le(&c, sh, keys[i] - 2);
+    assert(rv == (i > 0));
+    assert(!rv || critbit_sharded_cursor_get(&c) == keys[i - 1]);
+  }
+
+  /* Removing the current item doesn't invalidate the cursor. */
+  rv = critbit_sharded_seek_first(&c, sh);
+  assert(rv);
+  for (size_t i = 0; i < n; ++i) {
+    rv = critbit_sharded_remove(sh, keys[i]);
+    assert(rv);
+    rv = critbit_sharded_remove(sh, keys[i]);
+    assert(!rv);
+    rv = critbit_sharded_contains(sh, keys[i]);
+    assert(!rv);
+    rv = critbit_sharded_cursor_next(&c);
+    assert(rv == (i + 1 < n));
+    assert(!rv || critbit_sharded_cursor_get(&c) == keys[i + 1]);
+  }
+  rv = critbit_sharded_seek_first(&c, sh);
+  assert(!rv);
+  (void)rv;
+
+  /* Concurrent writers. */
+  pthread_t writers[SHARDED_WRITERS];
+  struct sharded_writer_data writer_data[SHARDED_WRITERS];
+  for (size_t i = 0; i < SHARDED_WRITERS; ++i) {
+    writer_data[i].sh = sh;
+    writer_data[i].n = n;
+    writer_data[i].writer = i;
+    pthread_create(&writers[i], NULL, &sharded_writer, &writer_data[i]);
+  }
+  for (size_t i = 0; i < SHARDED_WRITERS; ++i) {
+    pthread_join(writers[i], NULL);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    rv = critbit_sharded_contains(sh, get_sharded_key(i));
+    assert(rv == (i % 2 == 0));
+  }
+  order_data.prev_v = 0;
+  critbit_sharded_foreach(sh, &check_order_visitor);
+  data.n = 0;
+  critbit_sharded_foreach(sh, &count_visitor);
+  assert(data.n == (n + 1) / 2);
+
+  free(keys);
+  critbit_sharded_delete(sh);
+  for (size_t i = 0; i < shards_count; ++i) {
+    critbit_slab_allocator_destroy(&slabs[i]);
+  }
+
+  printf("OK\n");
+}
+
+static void test_slab_allocator(void)
+{
+  static const size_t N = 10 * 1000;
+
+  printf("test_slab_allocator(n=%zu) ", N);
+
+  struct critbit_slab_allocator s;
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  const struct critbit_node_allocator *const a = &s.node_allocator;
+  void **const nodes = malloc(sizeof(nodes[0]) * N);
+
+  for (size_t i = 0; i < N; ++i) {
+    nodes[i] = a->alloc_node(a->ctx);
+    assert((uintptr_t)nodes[i] % sizeof(void *) == 0);
+    memset(nodes[i], 0xff, critbit_node_size());
+  }
+  for (size_t i = 0; i < N; ++i) {
+    a->free_node(a->ctx, nodes[i]);
+  }
+  /* Released nodes must be reused in LIFO order. */
+  for (size_t i = 0; i < N; ++i) {
+    void *const node = a->alloc_node(a->ctx);
+    assert(node == nodes[N - 1 - i]);
+    (void)node;
+  }
+
+  free(nodes);
+  critbit_slab_allocator_destroy(&s);
+
+  /* Deleting a crit-bit must keep nodes of other crit-bits by default. */
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  struct critbit *const cb1 = critbit_create(&s.node_allocator);
+  struct critbit *const cb2 = critbit_create(&s.node_allocator);
+  for (size_t i = 0; i < N; ++i) {
+    critbit_add(cb1, (i + 1) * 2);
+    critbit_add(cb2, (i + 1) * 2);
+  }
+  critbit_delete(cb1);
+  for (size_t i = 0; i < N; ++i) {
+    const int rv = critbit_contains(cb2, (i + 1) * 2);
+    assert(rv);
+    (void)rv;
+  }
+  critbit_delete(cb2);
+  critbit_slab_allocator_destroy(&s);
+
+  /* An exclusive allocator releases all the slabs in critbit_delete(). */
+  critbit_slab_allocator_init(&s, critbit_node_size());
+  critbit_slab_allocator_set_exclusive(&s);
+  struct critbit *const cb = critbit_create(&s.node_allocator);
+  for (size_t i = 0; i < N; ++i) {
+    critbit_add(cb, (i + 1) * 2);
+  }
+  critbit_delete(cb);
+#if !defined(CRITBIT_PERSISTENT)
+  assert(s.slabs == NULL);
+#endif
+  critbit_slab_allocator_destroy(&s);
+
+  printf("OK\n");
+}
+
+int main(void)
+{
+  static const size_t N = 128 * 1024;
+
+  const struct critbit_node_allocator node_allocator = {
+    .alloc_node = &alloc_critbit_node,
+    .free_node = &free_critbit_node,
+    .ctx = NULL,
+  };
+  test_critbit(N, &node_allocator, "malloc");
+  test_deep_critbit(&node_allocator);
+  test_cursor(N, &node_allocator);
+  test_nearest(N, &node_allocator);
+  test_batch(N, &node_allocator);
+  test_build_sorted(N, &node_allocator);
+#if defined(CRITBIT_PARALLEL)
+  test_parallel(N * 4, &node_allocator);
+#endif
+  test_set_algebra(N, &node_allocator);
+  test_set_algebra(10, &node_allocator);
+  test_split_join(N, &node_allocator);
+  test_prefix(N / 4, &node_allocator);
+  test_serialize(N / 4, &node_allocator);
+  test_compact(N, &node_allocator);
+#if defined(CRITBIT_PERSISTENT)
+  test_persistent(N);
+#endif
+  test_stats(N, &node_allocator);
+#if defined(CRITBIT_ORDER_STATS)
+  test_order_stats(N / 4, &node_allocator);
+#endif
+#if defined(CRITBIT_TRACE)
+  test_trace(N, &node_allocator);
+#endif
+  test_map(N);
+#if defined(CRITBIT_ANY_KEYS)
+  test_any_keys(N, &node_allocator);
+#endif
+  test_bytes(N, 0);
+  test_bytes(N, 5);
+  test_bytes(N, 8);
+  test_bytes(N, 16);
+  test_deep_bytes(1000);
+  test_hybrid(N);
+  test_wide(N);
+  test_sharded(N);
+  test_array_search();
+  test_retire_node(1000);
+#if defined(CRITBIT_CONCURRENT)
+  test_concurrent(N);
+#endif
+
+  struct critbit_slab_allocator slab_allocator;
+  critbit_slab_allocator_init(&slab_allocator, critbit_node_size());
+  test_critbit(N, &slab_allocator.node_allocator, "slab");
+  critbit_slab_allocator_destroy(&slab_allocator);
+
+  /*
+   * Split and joined crit-bits share nodes of the exclusive allocator,
+   * so deleting one of them mustn't release nodes of the other one.
+   */
+  critbit_slab_allocator_init(&slab_allocator, critbit_node_size());
+  critbit_slab_allocator_set_exclusive(&slab_allocator);
+  test_split_join(N, &slab_allocator.node_allocator);
+  critbit_slab_allocator_destroy(&slab_allocator);
 
-  test_critbit(N);
+  test_slab_allocator();
 
   return 0;
 }
@@ -0,0 +1,359 @@
+#include "critbit.hpp"
+
+#include <cassert>
+#include <cstddef>  /* for std::size_t */
+#include <cstdint>  /* for std::uint*_t */
+#include <cstdio>
+#include <random>
+#include <set>
+#include <type_traits>
+#include <utility>  /* for std::move */
+#include <vector>
+
+
+/* Counts live allocations, so tests may check for leaks and reuse. */
+static std::size_t allocated_count;
+
+template <typename T>
+struct counting_allocator
+{
+  typedef T value_type;
+
+  counting_allocator()
+  {
+  }
+
+  template <typename U>
+  counting_allocator(const counting_allocator<U> &)
+  {
+  }
+
+  T *allocate(const std::size_t n)
+  {
+    allocated_count += n;
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T *const p, const std::size_t n)
+  {
+    assert(allocated_count >= n);
+    allocated_count -= n;
+    std::allocator<T>().deallocate(p, n);
+  }
+};
+
+template <typename T, typename U>
+static bool operator==(const counting_allocator<T> &,
+    const counting_allocator<U> &)
+{
+  return true;
+}
+
+template <typename T, typename U>
+static bool operator!=(const counting_allocator<T> &,
+    const counting_allocator<U> &)
+{
+  return false;
+}
+
+/* Detects whether key_traits are defined for Key. */
+template <typename Key, typename Enable = void>
+struct has_key_traits : std::false_type
+{
+};
+
+template <typename Key>
+struct has_key_traits<Key, typename std::enable_if<
+    (critbits::key_traits<Key>::bits > 0)>::type> : std::true_type
+{
+};
+
+/* bool has a single value bit, so it can't be mapped to its storage width. */
+static_assert(!has_key_traits<bool>::value, "bool keys must be rejected");
+static_assert(has_key_traits<unsigned char>::value &&
+    has_key_traits<signed char>::value && has_key_traits<const int *>::value,
+    "integer and pointer keys must be supported");
+
+template <typename Key>
+static Key random_key(std::mt19937_64 &rng)
+{
+  return static_cast<Key>(rng());
+}
+
+/* Checks cb against the reference set in both directions. */
+template <typename Key, typename Allocator>
+static void check_items(const critbits::critbit<Key, Allocator> &cb,
+    const std::set<Key> &expected)
+{
+  assert(cb.size() == expected.size());
+  assert(cb.empty() == expected.empty());
+  assert(std::vector<Key>(cb.begin(), cb.end()) ==
+      std::vector<Key>(expected.begin(), expected.end()));
+  assert(std::vector<Key>(cb.rbegin(), cb.rend()) ==
+      std::vector<Key>(expected.rbegin(), expected.rend()));
+
+  std::vector<Key> visited;
+  cb.for_each([&visited](const Key &key) {
+    visited.push_back(key);
+  });
+  assert(visited == std::vector<Key>(expected.begin(), expected.end()));
+  (void)expected;
+}
+
+template <typename Key>
+static void test_keys(const std::size_t n, const char *const key_name)
+{
+  printf("test_keys(n=%zu, key=%s) ", n, key_name);
+
+  std::mt19937_64 rng(n);
+  critbits::critbit<Key> cb;
+  std::set<Key> expected;
+  for (std::size_t i = 0; i < n; ++i) {
+    const Key key = random_key<Key>(rng);
+    const bool inserted = cb.insert(key);
+    const bool expected_inserted = expected.insert(key).second;
+    assert(inserted == expected_inserted);
+    (void)inserted;
+    (void)expected_inserted;
+  }
+  check_items(cb, expected);
+
+  for (std::size_t i = 0; i < n; ++i) {
+    const Key key = random_key<Key>(rng);
+    assert(cb.contains(key) == (expected.count(key) > 0));
+    const typename critbits::critbit<Key>::const_iterator it = cb.find(key);
+    assert((it == cb.end()) == (expected.count(key) == 0));
+
+    const typename std::set<Key>::const_iterator lower =
+        expected.lower_bound(key);
+    const typename critbits::critbit<Key>::const_iterator cb_lower =
+        cb.lower_bound(key);
+    assert((cb_lower == cb.end()) == (lower == expected.end()));
+    assert(cb_lower == cb.end() || *cb_lower == *lower);
+
+    const typename std::set<Key>::const_iterator upper =
+        expected.upper_bound(key);
+    const typename critbits::critbit<Key>::const_iterator cb_upper =
+        cb.upper_bound(key);
+    assert((cb_upper == cb.end()) == (upper == expected.end()));
+    assert(cb_upper == cb.end() || *cb_upper == *upper);
+    (void)it;
+    (void)lower;
+    (void)cb_lower;
+    (void)upper;
+    (void)cb_upper;
+  }
+
+  /* Bounds of existing items and iterating from them. */
+  for (const Key key : expected) {
+    assert(cb.count(key) == 1);
+    assert(*cb.find(key) == key);
+    assert(*cb.lower_bound(key) == key);
+    typename critbits::critbit<Key>::const_iterator it = cb.upper_bound(key);
+    --it;
+    assert(*it == key);
+  }
+  assert(*--cb.end() == *expected.rbegin());
+
+  std::size_t i = 0;
+  for (typename std::set<Key>::iterator it = expected.begin();
+      it != expected.end(); ++i) {
+    if (i % 2 == 0) {
+      std::size_t erased = cb.erase(*it);
+      assert(erased == 1);
+      erased = cb.erase(*it);
+      assert(erased == 0);
+      (void)erased;
+      it = expected.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+  check_items(cb, expected);
+
+  cb.clear();
+  assert(cb.empty());
+  assert(cb.begin() == cb.end());
+  assert(cb.lower_bound(Key()) == cb.end());
+  assert(!cb.contains(Key()));
+
+  printf("OK\n");
+}
+
+/* Checks all the 8-bit keys, including the extreme ones. */
+static void test_small_keys()
+{
+  printf("test_small_keys() ");
+
+  critbits::critbit<std::int8_t> cb;
+  for (int i = 127; i >= -128; --i) {
+    const bool inserted = cb.insert(static_cast<std::int8_t>(i));
+    assert(inserted);
+    (void)inserted;
+  }
+  assert(cb.size() == 256);
+  int expected = -128;
+  for (const std::int8_t key : cb) {
+    assert(key == expected);
+    (void)key;
+    ++expected;
+  }
+  assert(*cb.lower_bound(-1) == -1);
+  assert(cb.upper_bound(127) == cb.end());
+  for (int i = -128; i < 128; i += 2) {
+    const std::size_t erased = cb.erase(static_cast<std::int8_t>(i));
+    assert(erased == 1);
+    (void)erased;
+  }
+  assert(*cb.lower_bound(-128) == -127);
+  assert(*cb.upper_bound(-127) == -125);
+  assert(*cb.rbegin() == 127);
+
+  printf("OK\n");
+}
+
+static void test_pointer_keys(const std::size_t n)
+{
+  printf("test_pointer_keys(n=%zu) ", n);
+
+  std::vector<int> items(n);
+  critbits::critbit<const int *> cb;
+  for (std::size_t i = n; i > 0; --i) {
+    const bool inserted = cb.insert(&items[i - 1]);
+    assert(inserted);
+    (void)inserted;
+  }
+  std::size_t i = 0;
+  for (const int *const p : cb) {
+    assert(p == &items[i]);
+    (void)p;
+    ++i;
+  }
+  assert(i == n);
+  assert(*cb.upper_bound(&items[0]) == &items[1]);
+
+  printf("OK\n");
+}
+
+/* Returns the number of nodes needed for holding n items. */
+static std::size_t get_nodes_count(const std::size_t n)
+{
+  return (n > 0) ? n - 1 : 0;
+}
+
+/*
+ * Moves all the items between crit-bits. Only the first item
+ * and the last item change the number of allocated nodes.
+ */
+static void test_node_handles(const std::size_t n)
+{
+  printf("test_node_handles(n=%zu) ", n);
+
+  typedef critbits::critbit<std::uint64_t,
+      counting_allocator<std::uint64_t> > critbit_type;
+  {
+    critbit_type a, b;
+    for (std::uint64_t i = 0; i < n; ++i) {
+      const bool inserted = a.insert(i * 3);
+      assert(inserted);
+      (void)inserted;
+    }
+    const std::size_t nodes_count = get_nodes_count(n);
+    assert(allocated_count == nodes_count);
+    (void)nodes_count;
+
+    const critbit_type::node_type missing = a.extract(1);
+    assert(missing.empty());
+    for (std::uint64_t i = 0; i < n; ++i) {
+      critbit_type::node_type nh = a.extract(i * 3);
+      assert(!nh.empty() && nh.value() == i * 3);
+      nh.value() += 1;
+      const bool inserted = b.insert(std::move(nh));
+      assert(inserted);
+      (void)inserted;
+      assert(nh.empty());
+      assert(allocated_count ==
+          get_nodes_count(a.size()) + get_nodes_count(b.size()));
+    }
+    assert(a.empty() && b.size() == n);
+    assert(*b.begin() == 1);
+
+    /* A failed insert keeps the item in the handle. */
+    critbit_type::node_type nh = b.extract(b.begin());
+    assert(nh.value() == 1);
+    bool inserted = b.insert(2);
+    assert(inserted);
+    nh.value() = 2;
+    inserted = b.insert(std::move(nh));
+    assert(!inserted);
+    (void)inserted;
+    assert(!nh.empty() && nh.value() == 2);
+  }
+  assert(allocated_count == 0);
+
+  printf("OK\n");
+}
+
+static void test_copy_move(const std::size_t n)
+{
+  printf("test_copy_move(n=%zu) ", n);
+
+  typedef critbits::critbit<std::int32_t,
+      counting_allocator<std::int32_t> > critbit_type;
+  {
+    std::mt19937_64 rng(n);
+    critbit_type a;
+    std::set<std::int32_t> expected;
+    for (std::size_t i = 0; i < n; ++i) {
+      const std::int32_t key = random_key<std::int32_t>(rng);
+      a.insert(key);
+      expected.insert(key);
+    }
+
+    critbit_type b(a);
+    check_items(a, expected);
+    check_items(b, expected);
+    const std::size_t erased = b.erase(*expected.begin());
+    assert(erased == 1);
+    (void)erased;
+
+    const std::size_t nodes_count = allocated_count;
+    critbit_type c(std::move(a));
+    assert(a.empty() && a.begin() == a.end());
+    check_items(c, expected);
+    assert(allocated_count == nodes_count);
+    (void)nodes_count;
+
+    a = c;
+    check_items(a, expected);
+    c = std::move(b);
+    assert(b.empty());
+    assert(c.size() == expected.size() - 1);
+    assert(!c.contains(*expected.begin()));
+
+    swap(a, c);
+    check_items(c, expected);
+    assert(a.size() == expected.size() - 1);
+  }
+  assert(allocated_count == 0);
+
+  printf("OK\n");
+}
+
+int main()
+{
+  static const std::size_t N = 128 * 1024;
+
+  test_keys<std::uint64_t>(N, "uint64_t");
+  test_keys<std::uint32_t>(N, "uint32_t");
+  test_keys<std::uint16_t>(N / 16, "uint16_t");
+  test_keys<std::int64_t>(N, "int64_t");
+  test_keys<int>(N, "int");
+  test_small_keys();
+  test_pointer_keys(N);
+  test_node_handles(N);
+  test_copy_move(N);
+
+  return 0;
+}